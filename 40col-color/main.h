@@ -47,6 +47,7 @@
 #define MENU_CONFIG    0x01 // support several menu
 #define MENU_CHARSET   0x02 // display current charset
 #define MENU_HELP      0x03 // display the HELP menu
+#define MENU_STATS     0x05 // live performance counters
 #define MENU_COMMAND   0x04 // display Command interpreter
 
 #define USB_POWER_GPIO 26 // this GPIO can be used with a MOSFET to power-up USB
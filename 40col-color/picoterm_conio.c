@@ -6,6 +6,7 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <stdio.h>
 #include "../common/picoterm_conio_config.h"
 #include "picoterm_conio.h"
 #include "picoterm_core.h" // scanline functions
@@ -17,6 +18,7 @@
 #include "bsp/board.h" // board_millis()
 
 #include "../common/picoterm_debug.h"
+#include "../common/picoterm_snapshot.h"
 
 /* picoterm_cursor.c */
 extern bool is_blinking;
@@ -107,7 +109,7 @@ void print_element (int x,int scanlineNumber, uint8_t* custom_bitmap ){
 }
 
 // most important accessor
-uint32_t * wordsForRow(int y){
+uint32_t * __not_in_flash_func(wordsForRow)(int y){
     return (uint32_t * )&ptr[y]->pixels[0];
 }
 
@@ -257,6 +259,7 @@ void shuffle_down(){
     // because we're using pointers to rows, we only need to shuffle the array of pointers
     // with textmode it's just ~30 pointers. Colourmode it's every scanline (~240)
     // recycle first line, and clear it.
+    conio_config.scroll_count++; // statistics (see replay CLI command)
 
     for(int r=0;r<8;r++){
         ptr[(ROWS-8)+r]=ptr[r];
@@ -277,6 +280,7 @@ void shuffle_up(){
     // this is our scroll UP
     // (domeu: adapted from shuffle_down)
     debug_print( "picoterm_conio: shuffle_up() - scroll_down3 test have issue");
+    conio_config.scroll_count++; // statistics (see replay CLI command)
     for(int r=0;r<8;r++){
         ptr[r]=ptr[(ROWS-8)+r];
         clear_entire_scanline((ROWS-8)+r);
@@ -639,3 +643,67 @@ void csr_blinking_task() {
     refresh_cursor();
   }
 }
+
+// === Screen snapshot (see picoterm_snapshot.c) ================================
+
+typedef struct snapshot_cell {
+  uint8_t bits[8];  // one byte per pixel row of the cell, bit set = ink
+  uint16_t paper;   // colour of the cleared bits
+  uint16_t ink;     // colour of the set bits
+} snapshot_cell_t;
+
+static snapshot_cell_t snapshot_cells[TEXTROWS][COLUMNS]; // staging area (~14 KB)
+
+const char *snapshot_stage(){
+  // The framebuffer (~150 KB) cannot be duplicated in RAM. It is staged as
+  // cells (8x8 bitmap + 2 colours), which is exact for the text. A pixel with
+  // a third colour in its cell is staged with the ink colour.
+  uint32_t lossy = 0;
+
+  clear_cursor();
+  for( int y=0; y<TEXTROWS; y++ )
+    for( int x=0; x<COLUMNS; x++ ){
+      snapshot_cell_t *cell = &snapshot_cells[y][x];
+      cell->paper = ptr[y*8]->pixels[x*8];
+      cell->ink = cell->paper;
+      for( int r=0; r<8; r++ ){
+        uint16_t *pixels = &(ptr[y*8+r]->pixels[x*8]);
+        uint8_t bits = 0;
+        for( int bit=0; bit<8; bit++ ){
+          if( pixels[bit]==cell->paper )
+            continue;
+          if( cell->ink==cell->paper )
+            cell->ink = pixels[bit];
+          else if( pixels[bit]!=cell->ink )
+            lossy++;
+          bits |= 0x80>>bit;
+        }
+        cell->bits[r] = bits;
+      }
+    }
+  print_cursor();
+  if( lossy>0 ){
+    sprintf( debug_msg, "snapshot_stage: %lu pixels with a 3rd colour in their cell", lossy );
+    debug_print( debug_msg );
+  }
+  return "ppm";
+}
+
+uint16_t snapshot_render( uint16_t part, char *buf ){
+  // part 0: PPM header, then one scanline per part (5 bits per component)
+  if( part==0 )
+    return sprintf( buf, "P6\n%d %d\n31\n", COLUMNS*8, TEXTROWS*8 );
+  int line = part-1;
+  if( line>=TEXTROWS*8 )
+    return 0;
+  for( int x=0; x<COLUMNS; x++ ){
+    snapshot_cell_t *cell = &snapshot_cells[line/8][x];
+    for( int bit=0; bit<8; bit++ ){
+      uint16_t pixel = (cell->bits[line%8] & (0x80>>bit)) ? cell->ink : cell->paper;
+      *buf++ = PICO_SCANVIDEO_R5_FROM_PIXEL( pixel );
+      *buf++ = PICO_SCANVIDEO_G5_FROM_PIXEL( pixel );
+      *buf++ = PICO_SCANVIDEO_B5_FROM_PIXEL( pixel );
+    }
+  }
+  return COLUMNS*8*3;
+}
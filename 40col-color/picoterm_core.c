@@ -19,12 +19,18 @@
  */
 
 #include "picoterm_core.h"
+#include "../common/picoterm_bell.h"
 #include "picoterm_conio.h"
 #include "../common/picoterm_debug.h"
+#include "../common/picoterm_trace.h"
 #include "../common/picoterm_config.h"
 #include "../common/picoterm_conio_config.h"
 #include "../common/picoterm_dec.h"
 #include "../common/picoterm_cursor.h"
+#include "../common/picoterm_capture.h" // private mode CAPTURE_PRIVATE_MODE
+#include "../common/picoterm_snapshot.h" // CSI i
+#include "../common/picoterm_uart.h" // replies to the host
+#include "../common/picoterm_stats.h" // parser counters
 
 #include "main.h" // UART_ID
 
@@ -34,13 +40,8 @@ extern picoterm_config_t config;
 extern uint16_t foreground_colour;
 extern uint16_t background_colour;
 
-// 0 = BUZZER_STOPPED, 1 = BUZZER_SIGNAL (Play Please), 2 = BUZZER_RUNNING
-char bell_state = 0;
 bool insert_mode = false;
 
-char get_bell_state() { return bell_state; }
-void set_bell_state(char state) { bell_state = state; }
-
 // early declaration
 void reset_escape_sequence();
 // Command answer
@@ -61,6 +62,7 @@ static int esc_parameters[MAX_ESC_PARAMS];
 static bool parameter_q; // true when ? in request
 static bool parameter_p; // true when parenthesis in request
 static bool parameter_sp; // true when ESC sequence contains a space
+static bool parameter_cm; // true when ESC sequence contains a comma (DECPS)
 static int esc_parameter_count;
 static unsigned char esc_c1;
 static unsigned char esc_final_byte;
@@ -96,6 +98,7 @@ void reset_escape_sequence(){
     parameter_q=false;
     parameter_p=false;
     parameter_sp=false;
+    parameter_cm=false;
 }
 
 
@@ -116,6 +119,10 @@ void esc_sequence_received(){
         static unsigned char esc_final_byte;
     */
   int n,m;
+  if(esc_c1=='[')
+      STATS_INC( esc_csi );
+  else
+      STATS_INC( esc_charset );
   if(esc_c1=='['){
     // CSI
     // VT100 Support
@@ -185,6 +192,7 @@ void esc_sequence_received(){
             //[ ? 47 h      save screen
             //[ ? 50 h    Cursor ON
             //[ ? 75 h    Screen display ON
+            //[ ? 7730 h  PicoTerm: start capture to SD
             //[ ? 1049 h  enables the alternative buffer
             if(parameter_q){
                 if(esc_parameters[0]==25 || esc_parameters[0]==50){
@@ -205,8 +213,7 @@ void esc_sequence_received(){
                 }
                 else if(esc_parameters[0]==47 || esc_parameters[0]==1047){
                     //TODO: save screen
-                    debug_print( "picoterm_core: esc_sequence_received() to be implemented" );
-                    debug_print( "[?47h or [?1047h  save screen" );
+                    TRACE( TR_ESC_NOT_IMPLEMENTED, esc_parameters[0], 'h' );
                     //copy_main_to_secondary_screen();
                 }
                 else if(esc_parameters[0]==1048){
@@ -215,11 +222,14 @@ void esc_sequence_received(){
                 }
                 else if(esc_parameters[0]==1049){
                     //TODO: save cursor and save screen
-                    debug_print( "picoterm_core: esc_sequence_received() to be implemented" );
-                    debug_print( "[?1049h  enables the alternative buffer" );
+                    TRACE( TR_ESC_NOT_IMPLEMENTED, esc_parameters[0], 'h' );
                     //save_cursor_position();
                     //copy_main_to_secondary_screen();
                 }
+                else if(esc_parameters[0]==CAPTURE_PRIVATE_MODE){
+                    //start capture of the host stream to SD
+                    capture_request( CAPTURE_REQ_START ); // next free capNNN.log (see capture_task)
+                }
             }
             else{
                 if(esc_parameters[0]==4){
@@ -251,6 +261,7 @@ void esc_sequence_received(){
             //[ ? 50 l      Cursor OFF
             //[ ? 75 l      Screen display OFF
 
+            //[ ? 7730 l  PicoTerm: stop capture to SD
             //[ ? 1049 l  disables the alternative buffer
 
             if(parameter_q){
@@ -261,8 +272,7 @@ void esc_sequence_received(){
                 else if(esc_parameters[0]==2){
                     //TODO: Set VT52 (versus ANSI)
                     //mode = VT52;
-                    debug_print( "picoterm_core: esc_sequence_received() to be implemented" );
-                    debug_print( "[?2l set VT52 (versus ANSI)" );
+                    TRACE( TR_ESC_NOT_IMPLEMENTED, esc_parameters[0], 'l' );
                 }
                 else if(esc_parameters[0]==7){
                     //Auto-wrap mode off ESC [?7l
@@ -279,21 +289,22 @@ void esc_sequence_received(){
                 else if(esc_parameters[0]==47 || esc_parameters[0]==1047){
                     //TODO: restore screen
                     //copy_secondary_to_main_screen();
-                    debug_print( "picoterm_core: esc_sequence_received() to be implemented" );
-                    debug_print( "[?47l or [?1047l  restore screen" );
+                    TRACE( TR_ESC_NOT_IMPLEMENTED, esc_parameters[0], 'l' );
                 }
                 else if(esc_parameters[0]==1048){
                     //TODO: restore cursor
                     //copy_secondary_to_main_screen();
-                    debug_print( "picoterm_core: esc_sequence_received() to be implemented" );
-                    debug_print( "[?1048l  restore screen" );
+                    TRACE( TR_ESC_NOT_IMPLEMENTED, esc_parameters[0], 'l' );
                 }
                 else if(esc_parameters[0]==1049){
                     //TODO: restore screen and restore cursor
                     //copy_secondary_to_main_screen();
                     //restore_cursor_position();
-                    debug_print( "picoterm_core: esc_sequence_received() to be implemented" );
-                    debug_print( "[?1049l  restore screen & Cursor" );
+                    TRACE( TR_ESC_NOT_IMPLEMENTED, esc_parameters[0], 'l' );
+                }
+                else if(esc_parameters[0]==CAPTURE_PRIVATE_MODE){
+                    //stop capture of the host stream
+                    capture_request( CAPTURE_REQ_STOP );
                 }
             }
             else{
@@ -304,6 +315,13 @@ void esc_sequence_received(){
             }
             break; // case 'l'
 
+        case 'i':
+            //[ i     Media copy: print screen
+            //[ 0 i   Same
+            // the snapshot is written to the SD card in the background
+            if( !parameter_q && (esc_parameters[0]==0) )
+                snapshot_request();
+            break;
 
         case 'm':
             //SGR
@@ -542,6 +560,16 @@ void esc_sequence_received(){
             }
             break; // case q
 
+        case '~':
+            if(parameter_cm){
+                parameter_cm = false;
+                //ESC [ Pvol ; Pdur ; Pnote ; ... , ~  DECPS - Play Sound
+                //  Pvol 0 (off) to 7, Pdur in 1/32 s, Pnote 1 (C5) to 25 (C7), 0 = silent
+                for(int i=2; (i<=esc_parameter_count) && (i<MAX_ESC_PARAMS); i++)
+                    bell_play_note( esc_parameters[0], esc_parameters[1], esc_parameters[i] );
+            }
+            break; // case ~
+
         case 'c':
             response_VT100ID();
             break;
@@ -621,6 +649,8 @@ void handle_new_character(unsigned char asc){
           case ESC_ESC_RECEIVED:
               // --- waiting on c1 character ---
               // c1 is the first parameter after the ESC
+              if( (asc!='(') && (asc!='[') )
+                  STATS_INC( esc_single );
               if( (asc=='(') || (asc=='[') ){
                   // 0x9B = CSI, that's the only one we're interested in atm
                   // the others are 'Fe Escape sequences'
@@ -649,14 +679,14 @@ void handle_new_character(unsigned char asc){
                     reset_escape_sequence();
               }
               else if (asc=='F' ){
-                    debug_print( "picoterm_code: handle_new_character() - \\ESCF" );
+                    TRACE( TR_ESC_CHARSET, 'F', 0 );
                     // config.font_id=config.graph_id; // Enter graphic charset
                     // build_font( config.font_id );
                     conio_config.dec_mode = DEC_MODE_NONE; // use approriate ESC to enter DEC Line Drawing mode
                     reset_escape_sequence();
               }
               else if (asc=='G'){
-                    debug_print( "picoterm_code: handle_new_character() - \\ESCG" );
+                    TRACE( TR_ESC_CHARSET, 'G', 0 );
                     //config.font_id=FONT_ASCII; // Enter ASCII charset
                     //build_font( config.font_id );
                     conio_config.dec_mode = DEC_MODE_NONE;
@@ -777,7 +807,10 @@ void handle_new_character(unsigned char asc){
               else if(asc==' '){
                   parameter_sp=true;
               }
-              else if(asc>=0x40 && asc<0x7E){
+              else if(asc==','){
+                  parameter_cm=true;
+              }
+              else if(asc>=0x40 && asc<=0x7E){
                   // final byte. Log and handle
                   esc_final_byte = asc;
                   esc_sequence_received(); // execute esc sequence
@@ -834,7 +867,7 @@ void handle_new_character(unsigned char asc){
           // --- return, backspace etc ---
           switch (asc){
               case BEL:
-              bell_state = 1;
+              bell_ring();
               break;
 
               case BSP:
@@ -864,6 +897,15 @@ void handle_new_character(unsigned char asc){
     conio_config.cursor.state.blink_state = false;
 }
 
+void terminal_ingest( const char *buf, uint16_t len ){
+  // Bulk entry point: feed a block of host data to the parser
+  // (see replay CLI command)
+  clear_cursor();
+  for( uint16_t i=0; i<len; i++ )
+    handle_new_character( buf[i] );
+  print_cursor();
+}
+
 
 /*
 void handle_new_character(unsigned char asc){
@@ -919,7 +961,10 @@ void handle_new_character(unsigned char asc){
                 else if(asc==' '){
                   parameter_sp=true;
                 }
-                else if(asc>=0x40 && asc<0x7E){
+                else if(asc==','){
+                  parameter_cm=true;
+                }
+                else if(asc>=0x40 && asc<=0x7E){
                     // final byte. Log and handle
                     esc_final_byte = asc;
                     esc_sequence_received();
@@ -985,7 +1030,7 @@ void handle_new_character(unsigned char asc){
             // --- return, backspace etc ---
             switch (asc){
                 case BEL:
-                    bell_state = 1; //BUZZER_SIGNAL
+                    bell_ring();
                     break;
 
                 case BSP:
@@ -1041,13 +1086,8 @@ void print_ascii_value(unsigned char asc){
 
 
 void __send_string(char str[]){
-  /* send string back to host via UART */
-  char c;
-  for(int i=0;i<strlen(str);i++){
-      c = str[i];
-      //insert_key_into_buffer( c );
-      uart_putc (UART_ID, c);
-  }
+  /* send a reply back to host via UART (priority queue, the parser never waits) */
+  uart_tx_reply( str, strlen(str) );
 }
 
 void response_VT100OK() {
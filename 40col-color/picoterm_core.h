@@ -52,9 +52,7 @@ void reset_escape_sequence();
 void clear_escape_parameters();
 void esc_sequence_received();
 void handle_new_character(unsigned char asc);
-
-char get_bell_state();
-void set_bell_state(char state);
+void terminal_ingest( const char *buf, uint16_t len ); // block of host data
 
 void print_logo_element(int x,int scanlineNumber);
 void print_ascii_value(unsigned char asc);
@@ -31,6 +31,8 @@
 #include <stdio.h>
 #include "../cli/cli.h"
 #include "../common/picoterm_debug.h"
+#include "../common/picoterm_stats.h"
+#include "bsp/board.h" // board_millis()
 
 
 /* #define CSRCHAR     128 */
@@ -146,9 +148,7 @@ char handle_config_input(){
 	if ( _ch == 'S' ){
 		print_string( "\r\nWrite to flash! Will reboot in 2 seconds.");
 		sleep_ms( 1000 );
-		stop_core1(); // suspend rendering for race condition
-		sleep_ms(10);
-		save_config();
+		save_config(); // core 1 parked during the flash write (multicore lockout)
 		watchdog_enable( 1000, 0 );
 	}
 
@@ -293,6 +293,9 @@ void display_help(){
   //print_string("| * Shift+Ctrl+L : Toggle ASCII/ANSI charset  |\r\n" );
   print_string("| Shift+Ctrl+M: Configuration menu    |\r\n" );
   print_string("| Shift+Ctrl+N: Display charset       |\r\n" );
+  print_string("| Shift+Ctrl+P: Screen snapshot to SD |\r\n" );
+  print_string("| Shift+Ctrl+R: Capture host to SD    |\r\n" );
+  print_string("| Shift+Ctrl+S: Statistics            |\r\n" );
   print_string("|                                     |\r\n" );
   print_string("+-------------------------------------+\r\n" );
 
@@ -303,6 +306,40 @@ void display_help(){
 }
 
 
+/* --- STATISTICS -------------------------------------------------------------
+   -
+   ---------------------------------------------------------------------------*/
+
+static uint32_t stats_refresh_ms = 0;
+
+static void print_stats(){
+  move_cursor_home();
+  print_string( "     >>>>  PicoTerm statistics <<<<\r\n\r\n" );
+  stats_print( print_string );
+  print_string( "\r\n(R=reset, ESC=close) ? " );
+  stats_refresh_ms = board_millis();
+}
+
+void display_stats(){
+  clrscr();
+  cursor_visible(false);
+  print_stats();
+}
+
+char handle_stats_input(){
+  // Refresh the counters every second (same layout, only the values change)
+  char _ch = read_key();
+  if( (_ch=='r') || (_ch=='R') ){
+    stats_reset();
+    display_stats(); // values are shorter
+  }
+  else if( board_millis()-stats_refresh_ms >= 1000 )
+    print_stats();
+  if( _ch==ESC )
+    cursor_visible(true);
+  return _ch;
+}
+
 /* --- TERMINAL ---------------------------------------------------------------
    -
    ---------------------------------------------------------------------------*/
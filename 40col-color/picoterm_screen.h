@@ -37,6 +37,9 @@ char handle_command_input();
 void display_charset();
 void display_help();
 
+void display_stats(); // performance counters
+char handle_stats_input();
+
 void display_config();
 char handle_config_input();
 
@@ -60,13 +60,27 @@
 #include "../common/keybd.h"
 #include "../common/picoterm_i2c.h"
 #include "../common/pca9536.h"
+#include "../common/picoterm_bell.h"
+#include "picoterm_scrollback.h"
+#include "picoterm_session.h"
 #include "../common/pio_sd.h"
+#include "../common/picoterm_uart.h"
+#include "../common/picoterm_hotkey.h"
+#include "../common/picoterm_capture.h"
+#include "../common/picoterm_xfer.h"
+#include "../common/picoterm_snapshot.h"
+#include "../common/picoterm_bench.h"
+#include "../common/picoterm_stdio.h" // set_idle_task
+#include "../common/picoterm_stats.h"
+#include "../common/picoterm_boot.h"
+#include "../common/picoterm_timeline.h"
 #include "../cli/cli.h"
 //#include "hardware/structs/bus_ctrl.h"
 #include "bsp/board.h"
 #include "tusb.h"
 #include "hardware/i2c.h"
 #include "hardware/uart.h"
+#include "hardware/clocks.h"
 
 
 /* picoterm_cursor.c */
@@ -153,14 +167,16 @@ static int x_sprites = 1;
 void init_render_state(int core);
 void led_blinking_task();
 void usb_power_task();
-void bell_task();
 
-void render_loop() {
-    /* Multithreaded execution */
+void __not_in_flash_func(render_loop)() {
+    /* Multithreaded execution, from RAM: the flash is not readable while the
+       config is written (see picoterm_config.c) */
     static uint8_t last_input = 0;
     static uint32_t last_frame_num = 0;
     int core_num = get_core_num();
     assert(core_num >= 0 && core_num < 2);
+    if( core_num == 1 )
+      multicore_lockout_victim_init(); // parked by save_config()
     //printf("Rendering on core %d\n", core_num);
 
     while (true) {
@@ -180,11 +196,16 @@ void render_loop() {
         }
         mutex_exit(&frame_logic_mutex);
         //DEBUG_PINS_SET(frame_gen, core_num ? 2 : 4);
+        TIMELINE_BEGIN( TL_RENDER );
         render_scanline(scanline_buffer, core_num);
+        TIMELINE_END( TL_RENDER );
         //DEBUG_PINS_CLR(frame_gen, core_num ? 2 : 4);
 #if PICO_SCANVIDEO_PLANE_COUNT > 2
         assert(false);
 #endif
+        // late: the display already went past this scanline (see stats)
+        if( (int32_t)(scanvideo_get_next_scanline_id() - scanline_buffer->scanline_id) > 0 )
+          STATS_INC( late_scanlines );
         // release the scanline into the wild
         scanvideo_end_scanline_generation(scanline_buffer);
         // do this outside mutex and scanline generation
@@ -205,8 +226,6 @@ void setup_video() {
   volatile uint32_t scanline_color = 0;
 #endif
 
-uint8_t pad[65536]; // to check!!!
-
 #define FONT_MAX_HEIGHT 15
 #define FONT_WIDTH_WORDS FRAGMENT_WORDS
 #define FONT_HEIGHT (font->line_height) // Should be identical accross all fonts.
@@ -214,6 +233,10 @@ uint8_t pad[65536]; // to check!!!
 #define FONT_SIZE_WORDS (FONT_HEIGHT * FONT_WIDTH_WORDS)
 
 uint32_t *font_raw_pixels = NULL;
+// font metrics copied by build_font(): render_scanline_bg() runs from RAM and
+// does not read the font descriptors (in flash)
+static uint8_t render_font_height = 8;
+static uint16_t render_max_char = 95;
 
 void select_graphic_font( uint8_t font_id ){
   /* Assign GRAPHICAL font (nupetscii, cp437) by reassigning the `font` pointer */
@@ -370,6 +393,8 @@ void build_font( uint8_t font_id ){
 
         } // for Y
     } // for c
+    render_font_height = FONT_HEIGHT;
+    render_max_char = font_id!=FONT_ASCII ? font->dsc->cmaps->range_length : 95;
 }
 
 int video_main(void) {
@@ -413,7 +438,7 @@ static __not_in_flash("y") uint16_t end_of_line[] = {
 };
 
 
-bool render_scanline_bg(struct scanvideo_scanline_buffer *dest, int core) {
+bool __not_in_flash_func(render_scanline_bg)(struct scanvideo_scanline_buffer *dest, int core) {
     // 1 + line_num red, then white
     uint32_t *buf = dest->data;
     size_t buf_length = dest->data_max;
@@ -429,14 +454,14 @@ bool render_scanline_bg(struct scanvideo_scanline_buffer *dest, int core) {
 
     uint32_t *output32 = buf;
     *output32++ = host_safe_hw_ptr(beginning_of_line);
-    uint32_t *dbase = font_raw_pixels + FONT_WIDTH_WORDS * (y % FONT_HEIGHT);
-    int max_char = config.font_id>0 ?  font->dsc->cmaps->range_length : 95;
+    uint32_t *dbase = font_raw_pixels + FONT_WIDTH_WORDS * (y % render_font_height);
+    int max_char = render_max_char;
 
     char ch = 0;
     char inv = 0;
     char blk = 0;
 
-    int tr = (y/FONT_HEIGHT);
+    int tr = (y/render_font_height);
     unsigned char *rowslots = slotsForRow(tr); // I want a better word for slots. (Character positions).
     unsigned char *rowinv = slotsForInvRow(tr);
     unsigned char *rowblk = slotsForBlkRow(tr);
@@ -453,14 +478,14 @@ bool render_scanline_bg(struct scanvideo_scanline_buffer *dest, int core) {
 
       if(blk == 1 && is_blinking){
         if(inv == 1)
-            *output32++ = host_safe_hw_ptr(dbase + ((max_char) * FONT_HEIGHT * FONT_WIDTH_WORDS));
+            *output32++ = host_safe_hw_ptr(dbase + ((max_char) * render_font_height * FONT_WIDTH_WORDS));
 
         else
             *output32++ = host_safe_hw_ptr(&block);
       }
       else{
         if(inv == 1){
-            *output32++ = host_safe_hw_ptr(dbase + ((ch + max_char) * FONT_HEIGHT * FONT_WIDTH_WORDS));
+            *output32++ = host_safe_hw_ptr(dbase + ((ch + max_char) * render_font_height * FONT_WIDTH_WORDS));
         }
         else{
           if(ch==0)
@@ -470,7 +495,7 @@ bool render_scanline_bg(struct scanvideo_scanline_buffer *dest, int core) {
             // if this character is a space, just use this predefined zero block rather than the calculation below
 
           else
-            *output32++ = host_safe_hw_ptr(dbase + (ch * FONT_HEIGHT * FONT_WIDTH_WORDS));
+            *output32++ = host_safe_hw_ptr(dbase + (ch * render_font_height * FONT_WIDTH_WORDS));
           }
       }
     }
@@ -536,6 +561,42 @@ bool render_scanline_bg(struct scanvideo_scanline_buffer *dest, int core) {
     return true;
 }
 
+uint8_t bench_fonts( uint32_t *us, uint8_t max ){
+  // build_font() time for ASCII then each graphic font (see picoterm_bench.h)
+  static const uint8_t font_ids[] = { FONT_ASCII, FONT_NUPETSCII_MONO8, FONT_CP437_MONO8, FONT_NUPETSCII_OLIVETTITHIN, FONT_CP437_OLIVETTITHIN };
+  uint8_t n;
+  for( n=0; (n<count_of(font_ids)) && (n<max); n++ ){
+    uint32_t start = time_us_32();
+    select_graphic_font( font_ids[n] );
+    build_font( font_ids[n] );
+    us[n] = time_us_32() - start;
+  }
+  select_graphic_font( config.graph_id ); // restore the current font
+  build_font( config.font_id );
+  return n;
+}
+
+uint32_t bench_scanline(){
+  // clk_sys cycles to render a scanline into a scratch buffer (see picoterm_bench.h)
+  static uint32_t line[COUNT+8];
+  struct scanvideo_scanline_buffer dest;
+  memset( &dest, 0, sizeof(dest) );
+  dest.data = line;
+  dest.data_max = count_of(line);
+#if PICO_SCANVIDEO_PLANE_COUNT > 1
+  static uint32_t line2[PICO_SCANVIDEO_MAX_SCANLINE_BUFFER2_WORDS];
+  dest.data2 = line2;
+  dest.data2_max = count_of(line2);
+#endif
+  uint32_t start = time_us_32();
+  for( int y=0; y<BENCH_SCANLINES; y++ ){
+    dest.scanline_id = y;
+    render_scanline_bg( &dest, 0 );
+  }
+  uint32_t elapsed = time_us_32() - start;
+  return ((uint64_t)elapsed * (clock_get_hz(clk_sys)/1000000)) / BENCH_SCANLINES;
+}
+
 void render_on_core1(){
   multicore_launch_core1(render_loop);
 }
@@ -550,10 +611,24 @@ void on_uart_rx() {
   // FIFO turned off, we should be here once for each character,
   // but the while does no harm and at least acts as an if()
   while (uart_is_readable (UART_ID)){
-    insert_key_into_buffer(uart_getc (UART_ID));
+    char ch = uart_getc (UART_ID);
+    STATS_INC( uart_rx );
+    capture_byte( ch ); // record the host stream (when enabled)
+    if( xfer_rx_byte( ch ) ) // XMODEM/YMODEM transfer in progress
+      continue;
+    if( !stream_flow_control( ch ) ) // XON/XOFF while sending a file
+      insert_key_into_buffer( ch );
   }
 }
 
+void on_uart_irq() {
+  // UART1_IRQ is shared by the reception and the transmission
+  TIMELINE_BEGIN( TL_UART_IRQ );
+  on_uart_rx();
+  on_uart_tx(); // see picoterm_uart.c
+  TIMELINE_END( TL_UART_IRQ );
+}
+
 void tih_handler(){
     gpio_put(LED,true);
 }
@@ -561,25 +636,38 @@ void tih_handler(){
 void handle_keyboard_input(){
   // normal terminal operation: if key received -> display it on term
   if(key_ready()){
-    clear_cursor();
+    TIMELINE_BEGIN( TL_KEYBOARD_INPUT );
+    // the session bound to the UART may be hidden (no cursor drawn)
+    bool hidden = session_enter_source( SESSION_SRC_UART );
+    if( !hidden )
+      clear_cursor();
     do {
+        STATS_INC( parsed );
         handle_new_character(read_key_from_buffer());
         // or for analysing what comes in
         //print_ascii_value(read_key_from_buffer());
     } while(key_ready());
-    print_cursor();
+    if( !hidden )
+      print_cursor();
+    session_leave();
+    TIMELINE_END( TL_KEYBOARD_INPUT );
   }
 }
 
+static void host_input_task(){
+  // host output, also under a menu (from the main loop, get_key & get_string)
+  handle_keyboard_input();
+  session_task(); // debug messages to their session
+}
+
 void usb_serial_task(){
   // Fill keyboard input buffer with char coming over the serial buffer
   //  (don't forget to make pico_enable_stdio_usb(picoterm 1)
   volatile int userInput = getchar_timeout_us (0);
   // 0xff if no character
   if(userInput!=PICO_ERROR_TIMEOUT){
-    if (uart_is_writable(UART_ID)) {
-      uart_putc (UART_ID, userInput);
-    }
+    char ch = userInput;
+    uart_tx_send( &ch, 1 );
   }
 }
 
@@ -589,6 +677,7 @@ void usb_serial_task(){
 
 
 int main(void) {
+  boot_mark( "runtime" ); // time spent before main()
   debug_init(); // GPIO 22 as rx @ 115200
   debug_print( "main() - 80 column version" );
 
@@ -656,37 +745,9 @@ int main(void) {
 	// AFTER   reading and writing
   stdio_init_all();
 
-  // Checking GP26 & GP27 will be handled as GPIO or I2C bus (with PCA9536 see issue #21)
-  // Then initialize the IO for USB_POWER &
-  i2c_bus_available = false;
-  debug_print( "Check I2C capability" );
-  init_i2c_bus(); // try to initialize the PicoTerm I2C bus
-  if( has_pca9536( i2c_bus ) ){
-    debug_print( "pca9536 detected!" );
-    i2c_bus_available = true;
-    pca9536_output_reset( i2c_bus, 0b0011 ); // preinitialize output at LOW
-    pca9536_setup_io( i2c_bus, IO_0, IO_MODE_OUT ); // USB_POWER
-    pca9536_setup_io( i2c_bus, IO_1, IO_MODE_OUT ); // BUZZER
-    pca9536_setup_io( i2c_bus, IO_2, IO_MODE_IN ); // not used yet
-    pca9536_setup_io( i2c_bus, IO_3, IO_MODE_IN ); // not used yet
-  }
-	// check other I2C GPIO expander here!
-
-  if( i2c_bus_available )
-    debug_print( "I2C bus detected" );
-
-  if( !i2c_bus_available ){
-    debug_print( "Using GPIO capability" );
-    deinit_i2c_bus();
-
-    gpio_init(USB_POWER_GPIO); // GPIO 26
-    gpio_set_dir(USB_POWER_GPIO, GPIO_OUT);
-    gpio_put(USB_POWER_GPIO,false);
-
-    gpio_init(BUZZER_GPIO);
-    gpio_set_dir(BUZZER_GPIO, GPIO_OUT);
-    gpio_put(BUZZER_GPIO,false);
-  }
+  // GP26 & GP27 (I2C expander or GPIO) are probed by boot_task(), after
+  // the first frame (see picoterm_boot.h)
+  boot_mark( "config" );
 
   start_time = board_millis();
 
@@ -706,40 +767,54 @@ int main(void) {
   int UART_IRQ = UART_ID == uart0 ? UART0_IRQ : UART1_IRQ;
 
   // set up and enable the interrupt handlers
-  irq_set_exclusive_handler(UART_IRQ, on_uart_rx);
+  uart_tx_init(); // Interrupt driven transmission queue
+  irq_set_exclusive_handler(UART_IRQ, on_uart_irq);
   irq_set_enabled(UART_IRQ, true);
 
   // enable the UART
   uart_set_irq_enables(UART_ID, true, false);
+  boot_mark( "UART" );
 
   // Initialise keyboard module
   keybd_init( pico_key_down, pico_key_up );
   terminal_init();
 	cli_init();
-	spi_sd_init(); // Initialize pio_FatFS over PIO_SPI
-	sd_mount(); // perform a mount test at boot
+	spi_sd_init(); // Initialize pio_FatFS over PIO_SPI (mounted by boot_task)
+  boot_mark( "terminal" );
 
   video_main();       // also build the font
   terminal_reset();
+  session_init(); // the terminal screen is the session 1
+  set_idle_task( host_input_task ); // the command menu waits in get_string
   display_terminal(); // display terminal entry screen
   tusb_init(); // initialize tinyusb stack
+  boot_mark( "video & USB" );
 
   char _ch = 0;
   bool old_menu = false; // used to trigger when is_menu is changed
 
   while(true){
     // TinyUsb Host Task (see keybd.c::process_kdb_report() callback and pico_key_down() here below)
+    stats_loop( !is_menu ); // main loop timing (see stats CLI command)
+    boot_task(); // I/O expander & SD card probes (see boot CLI command)
+    debug_task(); // debug UART output (DMA)
+    TIMELINE_BEGIN( TL_TUH_TASK );
     tuh_task();
+    TIMELINE_END( TL_TUH_TASK );
+    keybd_task(); // key events of all the keyboards, in order
     usb_power_task();
     led_blinking_task();
     csr_blinking_task();
     key_repeat_task();
     bell_task();
+    sd_stream_task(); // send_file & hotkeys
+    capture_task(); // write the captured host stream to SD
+    snapshot_task(); // screen snapshot to SD
 
     if( is_menu && !(old_menu) ){ // menu activated ?
-      copy_main_to_secondary_screen(); // copy terminal screen
-      save_cursor_position();
-      clear_key_buffer(); // empty the keyboard buffer
+      scrollback_live(); // the menu replaces the live screen
+      session_overlay_open(); // drawn into the overlay, the terminal keeps parsing
+      clear_menu_key_buffer();
       switch( id_menu ){
         case MENU_CONFIG:
           display_config();
@@ -749,6 +824,9 @@ int main(void) {
           break;
         case MENU_HELP:
           display_help();
+          break;
+        case MENU_STATS:
+          display_stats();
           break;
 				case MENU_COMMAND:
 					display_command();
@@ -757,11 +835,8 @@ int main(void) {
       old_menu = is_menu;
     }
     else if( !(is_menu) && old_menu ){ // menu de-activated ?
-      //display_terminal();
-      clrscr();
-      copy_secondary_to_main_screen(); // restore terminal screen
-      restore_cursor_position();
-      clear_key_buffer(); // empty the keyboard buffer
+      session_overlay_close(); // terminal screen, as updated meanwhile
+      clear_menu_key_buffer();
       old_menu = is_menu;
     }
 
@@ -775,6 +850,9 @@ int main(void) {
 					// Specialized handler managing keyboard input for command
 					_ch = handle_command_input();
 					break;
+        case MENU_STATS:
+          _ch = handle_stats_input();
+          break;
         default:
           _ch = handle_default_input();
       } // eof Switch
@@ -783,8 +861,7 @@ int main(void) {
           id_menu = 0x00;
       }
     }
-    else
-      handle_keyboard_input(); // normal terminal management
+    host_input_task();
   }
   return 0;
 }
@@ -816,11 +893,11 @@ void led_blinking_task() {
 }
 
 void usb_power_task() {
-  if( !usb_power_state && ((board_millis() - start_time)>USB_POWER_DELAY )){
+  if( !usb_power_state && boot_io_ready() && ((board_millis() - start_time)>USB_POWER_DELAY )){
     usb_power_state = true;
     if( i2c_bus_available ){
       // USB_POWER wired on the IO_0 of PCA9536
-      pca9536_output_io( i2c_bus, IO_0, true );
+      pca9536_output_io_async( IO_0, true );
     }
     else
       // USB_POWER wired directly on the GPIO
@@ -828,31 +905,6 @@ void usb_power_task() {
   }
 }
 
-
-
-void bell_task() {
-  const uint32_t interval_ms_bell = 100;
-  static uint32_t start_ms_bell = 0;
-
-  if(get_bell_state() == 1){
-    start_ms_bell = board_millis();
-    if(i2c_bus_available) // BuZZER wired on the IO_1 of PCA9536
-      pca9536_output_io( i2c_bus, IO_1, true );
-    else
-      gpio_put(BUZZER_GPIO, true); // buzzer Wired directly on GPIO
-    set_bell_state(2);
-  }
-
-  else if (get_bell_state() == 2 && board_millis() - start_ms_bell > interval_ms_bell) {
-    if(i2c_bus_available)
-      pca9536_output_io( i2c_bus, IO_1, false ); // BuZZER wired on the IO_1 of PCA9536
-    else
-      gpio_put(BUZZER_GPIO, false); // buzzer Wired directly on GPIO
-    set_bell_state(0);
-  }
-
-}
-
 //--------------------------------------------------------------------+
 // keybd - Callback routines
 //--------------------------------------------------------------------+
@@ -866,9 +918,7 @@ static void pico_key_down(int scancode, int keysym, int modifiers) {
 			if( (scancode>=SCANCODE_F1) && (scancode<=SCANCODE_F12) && ((modifiers&WITH_SHIFT)==WITH_SHIFT) ){
 				debug_print("Hotkey captured!");
 				int f_key = (scancode-SCANCODE_F1)+1;
-				char fname[20];
-				sprintf( fname, "hotkey/f%d-%s.dat", f_key, ((modifiers|WITH_SHIFT)==WITH_SHIFT) ? "s" : "sc"  );
-				send_file_to_uart( fname );
+				hotkey_send( f_key, (modifiers & WITH_CTRL)==WITH_CTRL ); // from the RAM cache
 				return; // do not add key to "Keyboard buffer"
 			}
 
@@ -905,12 +955,46 @@ static void pico_key_down(int scancode, int keysym, int modifiers) {
         return; // do not add key to "Keyboard buffer"
       }
 
+      if( (ch=='r') && (modifiers == (WITH_CTRL + WITH_SHIFT)) ){
+        // start/stop the capture of the host stream to SD
+        capture_request( CAPTURE_REQ_TOGGLE ); // SD access done by capture_task()
+        return; // do not add key to "Keyboard buffer"
+      }
+
+      if( (ch=='s') && (modifiers == (WITH_CTRL + WITH_SHIFT)) ){
+        id_menu = MENU_STATS;
+        is_menu = !(is_menu);
+        return; // do not add key to "Keyboard buffer"
+      }
+
+      if( (ch=='p') && (modifiers == (WITH_CTRL + WITH_SHIFT)) ){
+        // screen snapshot to SD (written in the background)
+        snapshot_request();
+        return; // do not add key to "Keyboard buffer"
+      }
+
+      if( !(is_menu) && (ch>='1') && (ch<'1'+SESSION_MAX) && (modifiers == (WITH_CTRL + WITH_SHIFT)) ){
+        // display another virtual session
+        session_show( ch-'1' );
+        return; // do not add key to "Keyboard buffer"
+      }
+
+      if( !(is_menu) && (modifiers == WITH_SHIFT) && ((scancode==SCANCODE_PAGE_UP) || (scancode==SCANCODE_PAGE_DOWN)) ){
+        // browse the scrollback history, one screen at once (one row kept)
+        scrollback_scroll( scancode==SCANCODE_PAGE_UP ? VISIBLEROWS-1 : -(VISIBLEROWS-1) );
+        return; // do not send the key to the host
+      }
+
       // Is this a scancode with special Escape Sequence Attached
       signed char idx = scancode_has_esc_seq(scancode);
       if ( !(is_menu) && (idx>-1) ){
         // debug_print("has esc sequence!");
-        for( char k=0; k < scancode_esc_seq_len(idx); k++)
-          uart_putc( UART_ID, scancode_esc_seq_item(idx,k) );
+        char seq[PM_ESC_SEQ_MAX_LEN];
+        int len = scancode_esc_seq_len(idx);
+        for( char k=0; k < len; k++)
+          seq[k] = scancode_esc_seq_item(idx,k);
+        scrollback_live(); // typing returns to the live screen
+        uart_tx_unit( seq, len ); // in one piece, after the bytes already queued (eg: hotkey)
         return;
       }
 
@@ -934,9 +1018,10 @@ static void pico_key_down(int scancode, int keysym, int modifiers) {
       // foward key-pressed to UART (only when typing in the terminal)
       // otherwise, send it directly to the keyboard buffer
       if( is_menu )
-        insert_key_into_buffer( ch );
+        insert_key_into_menu_buffer( ch );
       else {
-         uart_putc (UART_ID, ch);
+         scrollback_live(); // typing returns to the live screen
+         uart_tx_unit( (char *)&ch, 1 ); // never waits in the USB callback
       }
     }
 }
@@ -11,6 +11,7 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <stdio.h>
 #include "picoterm_conio.h"
 #include "../common/picoterm_conio_config.h"
 #include "../common/picoterm_cursor.h"
@@ -19,6 +20,8 @@
 #include "../common/keybd.h" // Keyboard device
 #include "picoterm_core.h"
 #include "../common/picoterm_config.h"
+#include "../common/picoterm_snapshot.h"
+#include "picoterm_scrollback.h"
 #include <stdlib.h>
 #include "bsp/board.h" // board_millis()
 
@@ -31,8 +34,18 @@ extern picoterm_config_t config; // required to read config.font_id
 /* picoterm_conio_config.c */
 extern picoterm_conio_config_t conio_config;
 
-array_of_row_text_pointer ptr;           // primary screen content
-array_of_row_text_pointer secondary_ptr; // secondary screen content
+static array_of_row_text_pointer primary_rows;
+row_of_text_t **ptr = primary_rows;      // screen content of the active session
+row_of_text_t **display_ptr = primary_rows; // screen content displayed (see picoterm_session.c)
+static row_of_text_t **history_ptr = primary_rows; // screen feeding the scrollback history
+static array_of_row_text_pointer primary_secondary;
+static row_of_text_t **secondary_ptr = primary_secondary; // secondary screen of the active session
+
+// secondary screen of the other sessions, allocated on first use
+typedef struct secondary_screen {
+  array_of_row_text_pointer rows;
+  row_of_text_t data[ROWS];
+} secondary_screen_t;
 
 // Private members
 unsigned char __chr_under_csr; // Character under the cursor
@@ -264,12 +277,12 @@ void print_nupet(char str[], uint8_t font_id ){
 }
 
 char read_key(){
-  // read a key from input buffer (the keyboard or serial line). This is used
-  // for menu handling. Return 0 if no char available
-  if( key_ready()==false ) return 0;
+  // read a key typed in a menu (the host bytes keep going to the terminal).
+  // Return 0 if no char available
+  if( menu_key_ready()==false ) return 0;
   if(conio_config.cursor.state.blink_state)
     conio_config.cursor.state.blink_state = false; // hide cursor
-  return read_key_from_buffer();
+  return read_key_from_menu_buffer();
 }
 
 
@@ -294,6 +307,8 @@ void clear_primary_screen(){
 }
 
 void clear_secondary_screen(){
+    if( secondary_ptr == NULL ) // never saved: empty
+        return;
     for(int r=0;r<ROWS;r++){
         // tighter method, as too much of a delay here can cause dropped characters
         void *sl = &secondary_ptr[r]->slot[0];
@@ -308,6 +323,8 @@ void clear_secondary_screen(){
 }
 
 void copy_secondary_to_main_screen(){
+    if( secondary_ptr == NULL ) // nothing saved
+        return;
     for(int r=0;r<ROWS;r++){
         memcpy(ptr[r]->slot,
                 secondary_ptr[r]->slot,
@@ -324,6 +341,14 @@ void copy_secondary_to_main_screen(){
 }
 
 void copy_main_to_secondary_screen(){
+    if( secondary_ptr == NULL ){
+        secondary_screen_t *screen = (secondary_screen_t *)calloc(1, sizeof(secondary_screen_t));
+        if( screen == NULL ) // the screen will not be restored
+            return;
+        for(int r=0;r<ROWS;r++)
+            screen->rows[r] = &screen->data[r];
+        secondary_ptr = screen->rows;
+    }
     for(int r=0;r<ROWS;r++){
         void *src = &ptr[r]->slot[0];
         void *dst = &secondary_ptr[r]->slot[0];
@@ -360,9 +385,12 @@ void clear_screen_to_cursor(){
 void shuffle_down(){
     // this is our scroll
     // because we're using pointers to rows, we only need to shuffle the array of pointers
+    conio_config.scroll_count++; // statistics (see replay CLI command)
 
     // recycle first line.
     struct row_of_text *temphandle = ptr[0];
+    if( ptr == history_ptr )
+      scrollback_push( temphandle ); // compressed into the history (Shift+PgUp)
     //ptr[ROWS-1]=ptr[0];
 
     for(int r=0;r<ROWS-1;r++){
@@ -382,6 +410,7 @@ void shuffle_down(){
 void shuffle_up(){
     // this is our scroll
     // because we're using pointers to rows, we only need to shuffle the array of pointers
+    conio_config.scroll_count++; // statistics (see replay CLI command)
 
     // recycle first line.
     struct row_of_text *temphandle = ptr[ROWS-1];
@@ -508,14 +537,20 @@ unsigned char slop_character(int x,int y){
     return ptr[y]->slot[x];
 }
 
-unsigned char * slotsForRow(int y){
-    return &ptr[y]->slot[0];
+static inline row_of_text_t *display_row(int y){
+    // Shift+PgUp: the first rows of the display come from the history
+    scrollback_view_t *view = scrollback_view;
+    return (y < view->shift) ? &view->rows[y] : display_ptr[y-view->shift];
 }
-unsigned char * slotsForInvRow(int y){
-    return &ptr[y]->inv[0];
+
+unsigned char * __not_in_flash_func(slotsForRow)(int y){
+    return &display_row(y)->slot[0];
+}
+unsigned char * __not_in_flash_func(slotsForInvRow)(int y){
+    return &display_row(y)->inv[0];
 }
-unsigned char * slotsForBlkRow(int y){
-    return &ptr[y]->blk[0];
+unsigned char * __not_in_flash_func(slotsForBlkRow)(int y){
+    return &display_row(y)->blk[0];
 }
 
 
@@ -738,6 +773,75 @@ void set_cursor_blink_state( bool state ) {
   conio_config.cursor.state.blink_state = state;
 }
 
+// === Virtual sessions ========================================================
+
+void conio_save_context( conio_context_t *ctx ){
+  ctx->rows = ptr;
+  ctx->secondary = secondary_ptr;
+  ctx->config = conio_config;
+  ctx->chr_under_csr = __chr_under_csr;
+  ctx->inv_under_csr = __inv_under_csr;
+  ctx->blk_under_csr = __blk_under_csr;
+  ctx->saved_csr = __saved_csr;
+}
+
+void conio_load_context( conio_context_t *ctx ){
+  // the row table is swapped, not copied
+  uint32_t scroll_count = conio_config.scroll_count; // statistics, not per session
+  ptr = ctx->rows;
+  secondary_ptr = ctx->secondary;
+  conio_config = ctx->config;
+  conio_config.scroll_count = scroll_count;
+  __chr_under_csr = ctx->chr_under_csr;
+  __inv_under_csr = ctx->inv_under_csr;
+  __blk_under_csr = ctx->blk_under_csr;
+  __saved_csr = ctx->saved_csr;
+}
+
+bool conio_new_context( conio_context_t *ctx ){
+  // empty screen with the default attributes, cursor home
+  for(int c=0;c<ROWS;c++){
+      ctx->rows_alloc[c] = (struct row_of_text *)calloc(1, sizeof(struct row_of_text));
+      if(ctx->rows_alloc[c]==NULL){
+        while( --c>=0 )
+          free( ctx->rows_alloc[c] );
+        return false;
+      }
+  }
+  ctx->rows = ctx->rows_alloc;
+  ctx->secondary = NULL; // allocated by copy_main_to_secondary_screen
+  conio_reset_context( ctx );
+  return true;
+}
+
+void conio_reset_context( conio_context_t *ctx ){
+  // default attributes, cursor home (the rows are not cleared)
+  ctx->config = conio_config;
+  ctx->config.rvs = false;
+  ctx->config.blk = false;
+  ctx->config.wrap_text = true;
+  ctx->config.just_wrapped = false;
+  ctx->config.dec_mode = DEC_MODE_NONE;
+  ctx->config.cursor.pos.x = 0;
+  ctx->config.cursor.pos.y = 0;
+  ctx->config.cursor.state.visible = true;
+  ctx->chr_under_csr = 0;
+  ctx->inv_under_csr = false;
+  ctx->blk_under_csr = false;
+  ctx->saved_csr.x = 0;
+  ctx->saved_csr.y = 0;
+}
+
+void conio_display( row_of_text_t **rows ){
+  display_ptr = rows;
+  history_ptr = rows;
+}
+
+void conio_display_overlay( row_of_text_t **rows ){
+  // displayed instead of the session screen, which keeps its history
+  display_ptr = rows;
+}
+
 void save_cursor_position(){
   __saved_csr.x = conio_config.cursor.pos.x;
   __saved_csr.y = conio_config.cursor.pos.y;
@@ -772,3 +876,45 @@ void csr_blinking_task() {
   refresh_cursor();
   }
 }
+
+// === Screen snapshot (see picoterm_snapshot.c) ================================
+
+static row_of_text_t snapshot_rows[VISIBLEROWS]; // staging area
+
+const char *snapshot_stage(){
+  // copy the visible rows without the cursor (only memcpy, done in one frame)
+  clear_cursor();
+  for( int r=0; r<VISIBLEROWS; r++ )
+    memcpy( &snapshot_rows[r], ptr[r], sizeof(row_of_text_t) );
+  print_cursor();
+  return "ans";
+}
+
+uint16_t snapshot_render( uint16_t part, char *buf ){
+  // one text row per part, with ANSI reverse (7) & blink (5) attributes.
+  // Chars above 0x7F are stored as is (current charset).
+  if( part>=VISIBLEROWS )
+    return 0;
+  row_of_text_t *row = &snapshot_rows[part];
+  uint16_t len = 0;
+  bool inv = false, blk = false;
+
+  if( part==0 )
+    len += sprintf( buf, "\x1b[0m" );
+  int last = COLUMNS-1; // strip the trailing blanks
+  while( (last>=0) && (row->slot[last]==0) && !row->inv[last] && !row->blk[last] )
+    last--;
+  for( int x=0; x<=last; x++ ){
+    if( ((row->inv[x]!=0) != inv) || ((row->blk[x]!=0) != blk) ){
+      inv = row->inv[x]!=0;
+      blk = row->blk[x]!=0;
+      len += sprintf( buf+len, "\x1b[0%s%sm", inv ? ";7" : "", blk ? ";5" : "" );
+    }
+    buf[len++] = row->slot[x]+32;
+  }
+  if( inv || blk )
+    len += sprintf( buf+len, "\x1b[0m" );
+  buf[len++] = '\r';
+  buf[len++] = '\n';
+  return len;
+}
@@ -34,12 +34,31 @@ typedef struct row_of_text {
 // array of pointers, each pointer points to a row structure
 typedef row_of_text_t *array_of_row_text_pointer[ROWS];
 
+// Screen & cursor of a virtual session (see picoterm_session.c)
+typedef struct conio_context {
+  row_of_text_t **rows; // row table
+  array_of_row_text_pointer rows_alloc; // rows allocated by conio_new_context
+  row_of_text_t **secondary; // saved screen (ESC[?1049h), NULL until used
+  picoterm_conio_config_t config;
+  unsigned char chr_under_csr;
+  bool inv_under_csr;
+  bool blk_under_csr;
+  struct point saved_csr;
+} conio_context_t;
+
 void conio_init( uint8_t ansi_font_id ); // allocate required ressources
 void conio_reset( char default_cursor_symbol );
 
+void conio_save_context( conio_context_t *ctx ); // active screen, cursor & attributes
+void conio_load_context( conio_context_t *ctx ); // O(1) swap of the row table
+bool conio_new_context( conio_context_t *ctx ); // allocate an empty screen
+void conio_reset_context( conio_context_t *ctx ); // default attributes, cursor home
+void conio_display( row_of_text_t **rows ); // row table used by the renderer
+void conio_display_overlay( row_of_text_t **rows ); // menus (no scrollback history)
+
 
-// Read a key from input buffer (the keyboard or serial line). Return 0 if no
-// char available (this is used by the menu handling)
+// Read a key typed in a menu (see insert_key_into_menu_buffer). Return 0 if
+// no char available
 char read_key();
 void put_char(unsigned char ch,int x,int y);
 //void print_string(char str[]); --> picoterm_stdio.C
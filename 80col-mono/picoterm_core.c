@@ -19,6 +19,7 @@
 
 
 #include "picoterm_core.h"
+#include "../common/picoterm_bell.h"
 #include "main.h" // Build font
 #include "hardware/uart.h"
 #include "../common/pmhid.h" // keyboard definitions
@@ -29,7 +30,11 @@
 #include "picoterm_conio.h" // basic input/output function for console
 //#include "tusb_option.h"
 #include "../common/picoterm_harddef.h" // UART_ID
+#include "../common/picoterm_uart.h" // replies to the host
+#include "../common/picoterm_stats.h" // parser counters
 #include "../common/picoterm_debug.h"
+#include "../common/picoterm_capture.h" // private mode CAPTURE_PRIVATE_MODE
+#include "../common/picoterm_snapshot.h" // CSI i
 
 
 // escape sequence state
@@ -37,12 +42,12 @@
 #define ESC_ESC_RECEIVED        1
 #define ESC_PARAMETER_READY     2
 
-#define MAX_ESC_PARAMS          5
 static int esc_state = ESC_READY;
 static int esc_parameters[MAX_ESC_PARAMS+1];
 static bool parameter_q;
 static bool parameter_p;
 static bool parameter_sp;
+static bool parameter_cm;
 static int esc_parameter_count;
 static unsigned char esc_c1;
 static unsigned char esc_final_byte;
@@ -60,7 +65,6 @@ extern picoterm_config_t config; // Issue #13, awesome contribution of Spock64
 /* picoterm_conio.c */
 extern picoterm_conio_config_t conio_config;
 
-char bell_state = 0;
 bool insert_mode = false;
 
 // early declaration
@@ -96,6 +100,7 @@ void reset_escape_sequence(){
     parameter_q=false;
     parameter_p=false;
     parameter_sp=false;
+    parameter_cm=false;
 }
 
 void terminal_reset(){
@@ -111,8 +116,40 @@ void terminal_reset(){
     print_cursor();  // turns on
 }
 
-char get_bell_state() { return bell_state; }
-void set_bell_state(char state) { bell_state = state; }
+
+void terminal_save_state( terminal_state_t *state ){
+    state->esc_state = esc_state;
+    memcpy( state->esc_parameters, esc_parameters, sizeof(esc_parameters) );
+    state->parameter_q = parameter_q;
+    state->parameter_p = parameter_p;
+    state->parameter_sp = parameter_sp;
+    state->parameter_cm = parameter_cm;
+    state->esc_parameter_count = esc_parameter_count;
+    state->esc_c1 = esc_c1;
+    state->esc_final_byte = esc_final_byte;
+    state->mode = mode;
+    state->insert_mode = insert_mode;
+}
+
+void terminal_load_state( terminal_state_t *state ){
+    esc_state = state->esc_state;
+    memcpy( esc_parameters, state->esc_parameters, sizeof(esc_parameters) );
+    parameter_q = state->parameter_q;
+    parameter_p = state->parameter_p;
+    parameter_sp = state->parameter_sp;
+    parameter_cm = state->parameter_cm;
+    esc_parameter_count = state->esc_parameter_count;
+    esc_c1 = state->esc_c1;
+    esc_final_byte = state->esc_final_byte;
+    mode = state->mode;
+    insert_mode = state->insert_mode;
+}
+
+void terminal_default_state( terminal_state_t *state ){
+    memset( state, 0, sizeof(terminal_state_t) );
+    state->esc_state = ESC_READY;
+    state->mode = VT100;
+}
 
 
 // for debugging purposes only
@@ -147,6 +184,10 @@ void esc_sequence_received(){
 */
 
   int n,m;
+  if(esc_c1=='[')
+      STATS_INC( esc_csi );
+  else
+      STATS_INC( esc_charset );
   if(mode==VT100){
       //ESC H           Set tab at current column
       //ESC [ g         Clear tab at current column
@@ -228,6 +269,7 @@ void esc_sequence_received(){
               //[ ? 47 h      save screen
               //[ ? 50 h    Cursor ON
               //[ ? 75 h    Screen display ON
+              //[ ? 7730 h  PicoTerm: start capture to SD
               //[ ? 1049 h  enables the alternative buffer
               if(parameter_q){
                   if(esc_parameters[0]==25 || esc_parameters[0]==50){
@@ -259,6 +301,10 @@ void esc_sequence_received(){
                       save_cursor_position();
                       copy_main_to_secondary_screen();
                   }
+                  else if(esc_parameters[0]==CAPTURE_PRIVATE_MODE){
+                      //start capture of the host stream to SD
+                      capture_request( CAPTURE_REQ_START ); // next free capNNN.log (see capture_task)
+                  }
               }
               else{
                   if(esc_parameters[0]==4){
@@ -289,6 +335,7 @@ void esc_sequence_received(){
               //[ ? 50 l      Cursor OFF
               //[ ? 75 l      Screen display OFF
 
+              //[ ? 7730 l  PicoTerm: stop capture to SD
               //[ ? 1049 l  disables the alternative buffer
 
               if(parameter_q){
@@ -327,6 +374,10 @@ void esc_sequence_received(){
                       //conio_config.cursor.pos.x = saved_csr.x;
                       //conio_config.cursor.pos.y = saved_csr.y;
                   }
+                  else if(esc_parameters[0]==CAPTURE_PRIVATE_MODE){
+                      //stop capture of the host stream
+                      capture_request( CAPTURE_REQ_STOP );
+                  }
               }
               else{
                   if(esc_parameters[0]==4){
@@ -336,6 +387,14 @@ void esc_sequence_received(){
               }
               break;
 
+          case 'i':
+              //[ i     Media copy: print screen
+              //[ 0 i   Same
+              // the snapshot is written to the SD card in the background
+              if( !parameter_q && (esc_parameters[0]==0) )
+                  snapshot_request();
+              break;
+
           case 'm':
               //SGR
               // Sets colors and style of the characters following this code
@@ -512,6 +571,16 @@ void esc_sequence_received(){
               }
               break; // case q
 
+          case '~':
+              if(parameter_cm){
+                  parameter_cm = false;
+                  //ESC [ Pvol ; Pdur ; Pnote ; ... , ~  DECPS - Play Sound
+                  //  Pvol 0 (off) to 7, Pdur in 1/32 s, Pnote 1 (C5) to 25 (C7), 0 = silent
+                  for(int i=2; (i<=esc_parameter_count) && (i<MAX_ESC_PARAMS); i++)
+                      bell_play_note( esc_parameters[0], esc_parameters[1], esc_parameters[i] );
+              }
+              break; // case ~
+
           case 'c':
               response_VT100ID();
               break;
@@ -580,6 +649,8 @@ void handle_new_character(unsigned char asc){
           case ESC_ESC_RECEIVED:
               // --- waiting on c1 character ---
               // c1 is the first parameter after the ESC
+              if( (asc!='(') && (asc!='[') )
+                  STATS_INC( esc_single );
               if( (asc=='(') || (asc=='[') ){
                   // 0x9B = CSI, that's the only one we're interested in atm
                   // the others are 'Fe Escape sequences'
@@ -734,7 +805,10 @@ void handle_new_character(unsigned char asc){
               else if(asc==' '){
                   parameter_sp=true;
               }
-              else if(asc>=0x40 && asc<0x7E){
+              else if(asc==','){
+                  parameter_cm=true;
+              }
+              else if(asc>=0x40 && asc<=0x7E){
                   // final byte. Log and handle
                   esc_final_byte = asc;
                   esc_sequence_received(); // execute esc sequence
@@ -774,7 +848,7 @@ void handle_new_character(unsigned char asc){
           // --- return, backspace etc ---
           switch (asc){
               case BEL:
-              bell_state = 1;
+              bell_ring();
               break;
 
               case BSP:
@@ -805,14 +879,19 @@ void handle_new_character(unsigned char asc){
 }
 
 
+void terminal_ingest( const char *buf, uint16_t len ){
+  // Bulk entry point: feed a block of host data to the parser
+  // (see replay CLI command)
+  clear_cursor();
+  for( uint16_t i=0; i<len; i++ )
+    handle_new_character( buf[i] );
+  print_cursor();
+}
+
+
 void __send_string(char str[]){
-  /* send string back to host via UART */
-  char c;
-  for(int i=0;i<strlen(str);i++){
-      c = str[i];
-      //insert_key_into_buffer( c );
-      uart_putc (UART_ID, c);
-  }
+  /* send a reply back to host via UART (priority queue, the parser never waits) */
+  uart_tx_reply( str, strlen(str) );
 }
 
 
@@ -20,17 +20,37 @@
 
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef _PICOTERM_CORE_H
 #define _PICOTERM_CORE_H
 
+#define MAX_ESC_PARAMS          5
+
+// Parser state, saved & restored when switching the virtual sessions
+typedef struct terminal_state {
+  int esc_state;
+  int esc_parameters[MAX_ESC_PARAMS+1];
+  bool parameter_q;
+  bool parameter_p;
+  bool parameter_sp;
+  bool parameter_cm;
+  int esc_parameter_count;
+  unsigned char esc_c1;
+  unsigned char esc_final_byte;
+  int mode; // VT100 or VT52
+  bool insert_mode;
+} terminal_state_t;
 
 void terminal_init();
 void terminal_reset();
 
-char get_bell_state();
-void set_bell_state(char state);
 void handle_new_character(unsigned char ch);
+void terminal_ingest( const char *buf, uint16_t len ); // block of host data
+
+void terminal_save_state( terminal_state_t *state );
+void terminal_load_state( terminal_state_t *state );
+void terminal_default_state( terminal_state_t *state ); // no sequence pending, VT100
 
 
 // for debugging purposes
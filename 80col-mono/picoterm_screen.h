@@ -22,6 +22,9 @@ char handle_config_input();
 
 void display_help();
 
+void display_stats(); // performance counters
+char handle_stats_input();
+
 
 
 #endif
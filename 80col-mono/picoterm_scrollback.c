@@ -0,0 +1,187 @@
+/* ==========================================================================
+    Scrollback history (see picoterm_scrollback.h)
+   ========================================================================== */
+
+#include "picoterm_scrollback.h"
+#include <string.h>
+
+#define ATTR_INV 0x01
+#define ATTR_BLK 0x02
+#define RUN_REPEAT 0x80
+#define RUN_ATTR   0xF0
+
+static uint8_t arena[SCROLLBACK_ARENA_SIZE]; // replaces the former pad[] of main.c
+static uint32_t arena_head = 0; // next byte written
+static uint32_t arena_used = 0;
+static uint16_t line_start[SCROLLBACK_LINES]; // arena offset of each row
+static uint16_t line_head = 0; // next row index
+static uint16_t line_count = 0;
+
+static scrollback_view_t live_view = { .shift = 0 }; // no history row
+static scrollback_view_t views[2]; // on display & decoded off-screen, in turn
+static int back_view = 0; // index of the off-screen view
+scrollback_view_t * volatile scrollback_view = &live_view;
+static int view_offset = 0; // rows back in the history (0 = live screen)
+
+static uint8_t row_attr( row_of_text_t *row, int i ){
+	return (row->inv[i] ? ATTR_INV : 0) | (row->blk[i] ? ATTR_BLK : 0);
+}
+
+static int encode_row( row_of_text_t *row, uint8_t *out ){
+	int len = COLUMNS;
+	while( (len > 0) && (row->slot[len-1] == 0) && (row_attr( row, len-1 ) == 0) )
+		len--;
+
+	int size = 0;
+	uint8_t attr = 0;
+	int i = 0;
+	while( i < len ){
+		uint8_t a = row_attr( row, i );
+		if( a != attr ){
+			out[size++] = RUN_ATTR | a;
+			attr = a;
+		}
+		int run = 1;
+		while( (i+run < len) && (row->slot[i+run] == row->slot[i]) && (row_attr( row, i+run ) == attr) )
+			run++;
+		if( run >= 3 ){
+			out[size++] = RUN_REPEAT | (run-1);
+			out[size++] = row->slot[i];
+			i += run;
+			continue;
+		}
+		// literal: up to the next attribute change or repeat run
+		int start = i;
+		int n = 0;
+		while( (i < len) && (row_attr( row, i ) == attr) ){
+			if( (i+2 < len) && (row->slot[i+1] == row->slot[i]) && (row->slot[i+2] == row->slot[i])
+			    && (row_attr( row, i+1 ) == attr) && (row_attr( row, i+2 ) == attr) )
+				break;
+			i++;
+			n++;
+		}
+		out[size++] = n-1;
+		memcpy( &out[size], &row->slot[start], n );
+		size += n;
+	}
+	return size;
+}
+
+static uint8_t arena_get( uint32_t pos ){
+	return arena[pos & (SCROLLBACK_ARENA_SIZE-1)];
+}
+
+static void decode_row( uint16_t line, row_of_text_t *row ){
+	// line: 1 = newest row of the history
+	memset( row, 0, sizeof(row_of_text_t) );
+	uint32_t pos = line_start[(line_head - line) & (SCROLLBACK_LINES-1)];
+	uint32_t end = pos + 1 + arena_get( pos );
+	pos++;
+	uint8_t attr = 0;
+	int x = 0;
+	while( (pos < end) && (x < COLUMNS) ){
+		uint8_t c = arena_get( pos++ );
+		int n = 0;
+		if( c >= RUN_ATTR ){
+			attr = c & (ATTR_INV | ATTR_BLK);
+			continue;
+		}
+		if( c & RUN_REPEAT ){
+			n = (c & 0x7F) + 1;
+			uint8_t ch = arena_get( pos++ );
+			for( int k=0; (k<n) && (x+k<COLUMNS); k++ )
+				row->slot[x+k] = ch;
+		}
+		else {
+			n = c + 1;
+			for( int k=0; (k<n) && (x+k<COLUMNS); k++ )
+				row->slot[x+k] = arena_get( pos++ );
+		}
+		for( int k=0; (k<n) && (x<COLUMNS); k++, x++ ){
+			row->inv[x] = (attr & ATTR_INV) ? 1 : 0;
+			row->blk[x] = (attr & ATTR_BLK) ? 1 : 0;
+		}
+	}
+}
+
+static void drop_oldest(){
+	uint16_t idx = (line_head - line_count) & (SCROLLBACK_LINES-1);
+	arena_used -= 1 + arena_get( line_start[idx] );
+	line_count--;
+}
+
+static void show_view( scrollback_view_t *view ){
+	// swap the view on display, the previous one becomes the off-screen one
+	scrollback_view = view;
+	if( view != &live_view )
+		back_view ^= 1;
+}
+
+static void decode_view(){
+	// history rows shown at the top of the display
+	scrollback_view_t *view = &views[back_view];
+	int shift = view_offset < VISIBLEROWS ? view_offset : VISIBLEROWS;
+	for( int y=0; y<shift; y++ )
+		decode_row( view_offset - y, &view->rows[y] );
+	view->shift = shift;
+	show_view( view );
+}
+
+void scrollback_push( row_of_text_t *row ){
+	uint8_t record[1 + 3*COLUMNS];
+	int size = 1 + encode_row( row, &record[1] );
+	record[0] = size - 1;
+
+	while( (line_count > 0) && ((arena_used + size > SCROLLBACK_ARENA_SIZE) || (line_count == SCROLLBACK_LINES)) )
+		drop_oldest();
+	line_start[line_head] = arena_head;
+	for( int i=0; i<size; i++ )
+		arena[(arena_head + i) & (SCROLLBACK_ARENA_SIZE-1)] = record[i];
+	arena_head = (arena_head + size) & (SCROLLBACK_ARENA_SIZE-1);
+	arena_used += size;
+	line_head = (line_head + 1) & (SCROLLBACK_LINES-1);
+	line_count++;
+
+	if( view_offset == 0 )
+		return;
+	if( view_offset < line_count ){
+		// keep the same history rows on display while the live screen scrolls
+		view_offset++;
+		if( view_offset <= VISIBLEROWS ){
+			// one more history row below the ones on display
+			scrollback_view_t *view = &views[back_view];
+			int shift = scrollback_view->shift;
+			memcpy( view->rows, scrollback_view->rows, shift * sizeof(row_of_text_t) );
+			decode_row( 1, &view->rows[view_offset-1] );
+			view->shift = view_offset;
+			show_view( view );
+		}
+		return;
+	}
+	decode_view(); // viewing the oldest row, dropped: the view moves on
+}
+
+void scrollback_scroll( int lines ){
+	int offset = view_offset + lines;
+	if( offset > line_count )
+		offset = line_count;
+	if( offset < 0 )
+		offset = 0;
+	if( offset == view_offset )
+		return;
+	view_offset = offset;
+	decode_view();
+}
+
+void scrollback_live(){
+	view_offset = 0;
+	show_view( &live_view );
+}
+
+bool scrollback_viewing(){
+	return view_offset > 0;
+}
+
+uint16_t scrollback_count(){
+	return line_count;
+}
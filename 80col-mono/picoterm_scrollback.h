@@ -0,0 +1,44 @@
+/* ==========================================================================
+    Scrollback history (Shift+PgUp / Shift+PgDn)
+
+		Each row leaving the top of the screen (shuffle_down) is compressed
+		into a 64 KB ring arena, the oldest rows are dropped when it is full.
+		A row is stored as a size byte followed by runs:
+		  0x00..0x4F  literal, (c+1) characters follow
+		  0x80..0xCF  repeat, next character (c&0x7F)+1 times
+		  0xF0..0xF3  attribute of the following cells (bit0 inv, bit1 blk)
+		The trailing blank cells are not stored.
+
+		Viewing the history copies nothing: the history rows are decoded in
+		a scrollback_view_t and the renderer takes its first shift rows from
+		there (see slotsForRow), the next ones from the live screen. Two views
+		are used in turn: the rows are decoded off-screen, then scrollback_view
+		is swapped, so core 1 never renders a row being decoded.
+		The host output keeps updating the live screen meanwhile, the view
+		stays on the same history rows.
+   ========================================================================== */
+
+#ifndef _PICOTERM_SCROLLBACK_H
+#define _PICOTERM_SCROLLBACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "picoterm_conio.h"
+
+#define SCROLLBACK_ARENA_SIZE 65536 // power of 2
+#define SCROLLBACK_LINES      2048  // max rows in the history (power of 2)
+
+typedef struct scrollback_view {
+	int shift; // rows of the display taken from rows[]
+	row_of_text_t rows[VISIBLEROWS]; // decoded history rows
+} scrollback_view_t;
+
+extern scrollback_view_t * volatile scrollback_view; // on display, never written
+
+void scrollback_push( row_of_text_t *row ); // row leaving the top of the screen
+void scrollback_scroll( int lines ); // view older (>0) or newer (<0) rows
+void scrollback_live(); // back to the live screen
+bool scrollback_viewing();
+uint16_t scrollback_count(); // rows in the history
+
+#endif
@@ -0,0 +1,180 @@
+/* ==========================================================================
+    Virtual sessions (see picoterm_session.h)
+   ========================================================================== */
+
+#include "picoterm_session.h"
+#include "picoterm_conio.h"
+#include "picoterm_core.h"
+#include "picoterm_scrollback.h"
+#include "../common/picoterm_debug.h"
+#include "pico/sync.h"
+
+typedef struct session {
+	bool used;
+	uint8_t source;
+	conio_context_t conio;   // screen, cursor & attributes
+	terminal_state_t parser; // escape sequence in progress, VT100/VT52
+} session_t;
+
+#define SESSION_OVERLAY SESSION_MAX // menus, drawn over the displayed session
+
+static session_t sessions[SESSION_MAX+1];
+static const uint8_t default_source[SESSION_MAX] = { SESSION_SRC_UART, SESSION_SRC_NONE, SESSION_SRC_NONE, SESSION_SRC_DEBUG };
+static uint8_t displayed = 0; // session on the screen
+static uint8_t active = 0;    // session receiving the parser output
+static uint8_t overlay_return = 0; // session displayed under the menu
+
+static uint8_t debug_input[SESSION_DEBUG_BUFFER];
+static volatile uint32_t debug_head = 0; // free running
+static volatile uint32_t debug_tail = 0;
+static critical_section_t debug_input_cs; // debug_print from both cores & IRQs
+
+static volatile bool debug_bound = false; // a session reads the debug messages
+
+static void session_debug_monitor( const uint8_t *data, uint32_t size ){
+	// copy of the debug messages (dropped when the session does not keep up)
+	if( !debug_bound )
+		return;
+	critical_section_enter_blocking( &debug_input_cs );
+	if( SESSION_DEBUG_BUFFER - (debug_head - debug_tail) >= size ){
+		for( uint32_t i=0; i<size; i++ )
+			debug_input[(debug_head+i) & (SESSION_DEBUG_BUFFER-1)] = data[i];
+		debug_head += size;
+	}
+	critical_section_exit( &debug_input_cs );
+}
+
+static void session_activate( uint8_t id ){
+	// save the parser output context, load the one of id
+	if( id == active )
+		return;
+	conio_save_context( &sessions[active].conio );
+	terminal_save_state( &sessions[active].parser );
+	conio_load_context( &sessions[id].conio );
+	terminal_load_state( &sessions[id].parser );
+	active = id;
+}
+
+static bool session_create( uint8_t id ){
+	// allocated on first use, bound to its default source
+	if( sessions[id].used )
+		return true;
+	if( !conio_new_context( &sessions[id].conio ) )
+		return false;
+	terminal_default_state( &sessions[id].parser );
+	sessions[id].used = true;
+	return session_bind( id, default_source[id] );
+}
+
+void session_init(){
+	critical_section_init( &debug_input_cs );
+	sessions[0].used = true;
+	sessions[0].source = SESSION_SRC_UART;
+	displayed = active = 0;
+	debug_set_monitor( session_debug_monitor );
+	// allocated once, a menu must open even when the heap is short
+	sessions[SESSION_OVERLAY].used = conio_new_context( &sessions[SESSION_OVERLAY].conio );
+	terminal_default_state( &sessions[SESSION_OVERLAY].parser );
+}
+
+bool session_overlay_open(){
+	// the menus are drawn into the overlay, the session keeps parsing its input
+	if( !sessions[SESSION_OVERLAY].used || (displayed == SESSION_OVERLAY) )
+		return false;
+	clear_cursor(); // the cursor of the session is drawn again on close
+	overlay_return = displayed;
+	conio_reset_context( &sessions[SESSION_OVERLAY].conio );
+	terminal_default_state( &sessions[SESSION_OVERLAY].parser );
+	session_activate( SESSION_OVERLAY );
+	conio_display_overlay( sessions[SESSION_OVERLAY].conio.rows );
+	displayed = SESSION_OVERLAY;
+	return true;
+}
+
+void session_overlay_close(){
+	if( displayed != SESSION_OVERLAY )
+		return;
+	session_activate( overlay_return );
+	conio_display( sessions[overlay_return].conio.rows );
+	displayed = overlay_return;
+	print_cursor();
+}
+
+bool session_exists( uint8_t id ){
+	return (id < SESSION_MAX) && sessions[id].used;
+}
+
+uint8_t session_displayed(){
+	return displayed;
+}
+
+uint8_t session_source( uint8_t id ){
+	return session_exists( id ) ? sessions[id].source : SESSION_SRC_NONE;
+}
+
+bool session_show( uint8_t id ){
+	if( id >= SESSION_MAX )
+		return false;
+	if( id == displayed )
+		return true;
+	if( !session_create( id ) )
+		return false;
+	scrollback_live(); // the history is the one of the displayed session
+	clear_cursor(); // the cursor is only drawn on the displayed session
+	session_activate( id );
+	conio_display( sessions[id].conio.rows );
+	displayed = id;
+	print_cursor();
+	return true;
+}
+
+bool session_bind( uint8_t id, uint8_t source ){
+	if( (id >= SESSION_MAX) || (source > SESSION_SRC_DEBUG) )
+		return false;
+	if( !sessions[id].used && !session_create( id ) )
+		return false;
+	if( source != SESSION_SRC_NONE )
+		for( int i=0; i<SESSION_MAX; i++ )
+			if( sessions[i].source == source )
+				sessions[i].source = SESSION_SRC_NONE;
+	sessions[id].source = source;
+	debug_bound = false;
+	for( int i=0; i<SESSION_MAX; i++ )
+		if( sessions[i].source == SESSION_SRC_DEBUG )
+			debug_bound = true;
+	return true;
+}
+
+bool session_enter_source( uint8_t source ){
+	for( int i=0; i<SESSION_MAX; i++ )
+		if( sessions[i].used && (sessions[i].source == source) ){
+			session_activate( i );
+			return i != displayed;
+		}
+	return false;
+}
+
+void session_leave(){
+	session_activate( displayed );
+}
+
+void session_task(){
+	// parse the debug messages into their session, a limited amount at once
+	if( debug_head == debug_tail )
+		return;
+	uint32_t head = debug_head;
+	if( !debug_bound ){ // unbound meanwhile
+		debug_tail = head;
+		return;
+	}
+	bool hidden = session_enter_source( SESSION_SRC_DEBUG );
+	if( !hidden )
+		clear_cursor();
+	for( int n=0; (n<256) && (debug_tail != head); n++ ){
+		handle_new_character( debug_input[debug_tail & (SESSION_DEBUG_BUFFER-1)] );
+		debug_tail++;
+	}
+	if( !hidden )
+		print_cursor();
+	session_leave();
+}
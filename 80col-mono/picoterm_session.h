@@ -0,0 +1,48 @@
+/* ==========================================================================
+    Virtual sessions (Shift+Ctrl+1 .. Shift+Ctrl+4)
+
+		Each session owns a screen (row table), a cursor with its attributes
+		and a parser state. Showing another session only swaps the row table
+		used by the renderer and the active one (no screen copy).
+
+		A session is bound to an input source, each source feeding one
+		session at a time:
+		  * SESSION_SRC_UART  : the host (hardware UART), session 1
+		  * SESSION_SRC_DEBUG : the messages sent to the PIO debug UART
+		                        (debug_print), session 4 once displayed
+		  * SESSION_SRC_NONE  : nothing, sessions 2 & 3
+		A session is allocated (8 KB) when displayed the first time. The
+		sessions hidden behind the displayed one keep parsing their input.
+		The keyboard always types to the host.
+
+		The menus are drawn into an overlay screen displayed instead of the
+		session: the host output keeps being parsed into the session while a
+		menu is open (see session_overlay_open).
+   ========================================================================== */
+
+#ifndef _PICOTERM_SESSION_H
+#define _PICOTERM_SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SESSION_MAX 4
+#define SESSION_DEBUG_BUFFER 1024 // debug messages waiting to be parsed (power of 2)
+
+#define SESSION_SRC_NONE  0
+#define SESSION_SRC_UART  1
+#define SESSION_SRC_DEBUG 2
+
+void session_init(); // the current screen becomes the session 1 (id 0), bound to the UART
+bool session_show( uint8_t id ); // display the session (created on first use)
+uint8_t session_displayed();
+bool session_bind( uint8_t id, uint8_t source ); // the source leaves its previous session
+uint8_t session_source( uint8_t id );
+bool session_exists( uint8_t id );
+bool session_enter_source( uint8_t source ); // parse into the session of source (true when hidden)
+void session_leave(); // back to the displayed session
+void session_task(); // parse the debug messages, to be called from the main loop
+bool session_overlay_open(); // menus drawn over the displayed session
+void session_overlay_close(); // displayed session back, as updated meanwhile
+
+#endif
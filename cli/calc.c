@@ -0,0 +1,316 @@
+/* ==========================================================================
+    CALC - calculator of the CLI, based on tinyexpr
+
+		The variables and the functions are given to tinyexpr as a lookup
+		table (te_variable). A variable is bound by address and a function is
+		a closure evaluating its own compiled expression, so the compiled
+		expressions stay valid when a value or a definition changes.
+		The cache is only flushed when a new name appears (it may hide a
+		builtin like "e" or "pi").
+   ========================================================================== */
+
+#include "calc.h"
+#include "tinyexpr.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "../common/keybd.h" // keybd_poll
+#include "picoterm_conio.h" // read_key
+#include "../common/picoterm_stdio.h"
+#include "../common/picoterm_stddef.h"
+#include "../common/picoterm_debug.h"
+
+typedef struct CalcVar {
+	char name[CALC_NAME_SIZE];
+	double value;
+} calc_var_t;
+
+typedef struct CalcFunc {
+	char name[CALC_NAME_SIZE];
+	char param[CALC_NAME_SIZE];
+	char text[CALC_EXPR_SIZE];
+	double arg;     // parameter value during the evaluation
+	te_expr *expr;
+	bool running;   // recursion guard
+} calc_func_t;
+
+typedef struct CalcCache {
+	char text[CALC_EXPR_SIZE];
+	te_expr *expr;
+	uint32_t used;  // LRU stamp
+} calc_cache_t;
+
+static calc_var_t vars[CALC_MAX_VARS];
+static uint8_t var_count = 0;
+static calc_func_t funcs[CALC_MAX_FUNCS];
+static uint8_t func_count = 0;
+static calc_cache_t cache[CALC_CACHE_SIZE];
+static uint32_t cache_stamp = 0;
+static te_variable lookup[CALC_MAX_VARS+CALC_MAX_FUNCS+1]; // +1 for a function parameter
+
+static double calc_call( void *context, double a ){
+	// closure of a named expression: f(a)
+	calc_func_t *f = context;
+	if( f->running || (f->expr==NULL) )
+		return NAN; // recursive definition
+	double saved = f->arg;
+	f->arg = a;
+	f->running = true;
+	double result = te_eval( f->expr );
+	f->running = false;
+	f->arg = saved;
+	return result;
+}
+
+static int calc_lookup( calc_func_t *param_of ){
+	// fill the lookup table, the parameter first (it hides a variable with the same name)
+	int n = 0;
+	if( param_of!=NULL ){
+		lookup[n].name = param_of->param;
+		lookup[n].address = &param_of->arg;
+		lookup[n].type = TE_VARIABLE;
+		lookup[n++].context = NULL;
+	}
+	for( int i=0; i<var_count; i++ ){
+		lookup[n].name = vars[i].name;
+		lookup[n].address = &vars[i].value;
+		lookup[n].type = TE_VARIABLE;
+		lookup[n++].context = NULL;
+	}
+	for( int i=0; i<func_count; i++ ){
+		lookup[n].name = funcs[i].name;
+		lookup[n].address = calc_call;
+		lookup[n].type = TE_CLOSURE1; // not pure, the definition may change
+		lookup[n++].context = &funcs[i];
+	}
+	return n;
+}
+
+static void calc_flush(){
+	for( int i=0; i<CALC_CACHE_SIZE; i++ ){
+		te_free( cache[i].expr );
+		cache[i].expr = NULL;
+		cache[i].used = 0;
+	}
+}
+
+static te_expr *calc_compile( const char *text, int *error ){
+	// compiled expression from the cache, otherwise compiled and cached (LRU)
+	int lru = 0;
+	for( int i=0; i<CALC_CACHE_SIZE; i++ ){
+		if( (cache[i].expr!=NULL) && (strcmp( cache[i].text, text )==0) ){
+			cache[i].used = ++cache_stamp;
+			return cache[i].expr;
+		}
+		if( cache[i].used < cache[lru].used )
+			lru = i;
+	}
+	te_expr *expr = te_compile( text, lookup, calc_lookup( NULL ), error );
+	if( expr==NULL )
+		return NULL;
+	te_free( cache[lru].expr );
+	strcpy( cache[lru].text, text );
+	cache[lru].expr = expr;
+	cache[lru].used = ++cache_stamp;
+	return expr;
+}
+
+static int calc_find_var( const char *name ){
+	for( int i=0; i<var_count; i++ )
+		if( strcmp( vars[i].name, name )==0 )
+			return i;
+	return -1;
+}
+
+static int calc_find_func( const char *name ){
+	for( int i=0; i<func_count; i++ )
+		if( strcmp( funcs[i].name, name )==0 )
+			return i;
+	return -1;
+}
+
+static bool calc_set_var( const char *name, double value ){
+	int i = calc_find_var( name );
+	if( i<0 ){
+		if( (var_count==CALC_MAX_VARS) || (calc_find_func( name )>=0) )
+			return false;
+		i = var_count++;
+		strcpy( vars[i].name, name );
+		calc_flush(); // the name may hide a builtin
+	}
+	vars[i].value = value;
+	return true;
+}
+
+bool calc_eval( const char *expr, double *result, int *error ){
+	// evaluate the expression, the result is also stored into "ans"
+	*error = 0;
+	if( strlen(expr) >= CALC_EXPR_SIZE )
+		return false;
+	te_expr *compiled = calc_compile( expr, error );
+	if( compiled==NULL )
+		return false;
+	*result = te_eval( compiled );
+	calc_set_var( "ans", *result );
+	return true;
+}
+
+static const char *calc_name( const char *str, char *name ){
+	// read a name [a-z][a-z0-9_]* (tinyexpr syntax), NULL when invalid
+	int len = 0;
+	while( *str==' ' )
+		str++;
+	if( (*str<'a') || (*str>'z') )
+		return NULL;
+	while( ((*str>='a') && (*str<='z')) || ((*str>='0') && (*str<='9')) || (*str=='_') ){
+		if( len==CALC_NAME_SIZE-1 )
+			return NULL;
+		name[len++] = *str++;
+	}
+	name[len] = 0;
+	while( *str==' ' )
+		str++;
+	return str;
+}
+
+bool calc_assign( const char *line ){
+	// "name = expr" stores the value, "name(param) = expr" defines a function
+	char name[CALC_NAME_SIZE], param[CALC_NAME_SIZE];
+	char msg[80];
+	double value;
+	int error;
+	bool is_func = false;
+
+	const char *p = calc_name( line, name );
+	if( (p!=NULL) && (*p=='(') ){
+		p = calc_name( p+1, param );
+		if( (p!=NULL) && (*p==')') ){
+			p++;
+			while( *p==' ' )
+				p++;
+			is_func = true;
+		}
+		else
+			p = NULL;
+	}
+	if( (p==NULL) || (*p!='=') ){
+		print_string( "Syntax: name = expr, name(x) = expr\r\n" );
+		return false;
+	}
+	p++;
+	while( *p==' ' )
+		p++;
+
+	if( !is_func ){
+		if( !calc_eval( p, &value, &error ) ){
+			sprintf( msg, "Error at position %d\r\n", error );
+			print_string( msg );
+			return false;
+		}
+		if( !calc_set_var( name, value ) ){
+			print_string( "No more variable (or name used by a function)\r\n" );
+			return false;
+		}
+		sprintf( msg, "%s = %.10g\r\n", name, value );
+		print_string( msg );
+		return true;
+	}
+
+	// function definition
+	if( strlen(p) >= CALC_EXPR_SIZE ){
+		print_string( "Expression too long\r\n" );
+		return false;
+	}
+	int i = calc_find_func( name );
+	bool is_new = (i<0);
+	if( is_new ){
+		if( (func_count==CALC_MAX_FUNCS) || (calc_find_var( name )>=0) ){
+			print_string( "No more function (or name used by a variable)\r\n" );
+			return false;
+		}
+		i = func_count++;
+		strcpy( funcs[i].name, name );
+		funcs[i].expr = NULL; // while compiling: f(x) = f(x) is an error at evaluation
+	}
+	calc_func_t *f = &funcs[i];
+	char old_param[CALC_NAME_SIZE];
+	strcpy( old_param, f->param );
+	strcpy( f->param, param );
+	te_expr *expr = te_compile( p, lookup, calc_lookup( f ), &error );
+	if( expr==NULL ){
+		strcpy( f->param, old_param );
+		if( is_new )
+			func_count--;
+		sprintf( msg, "Error at position %d\r\n", error );
+		print_string( msg );
+		return false;
+	}
+	te_free( f->expr );
+	f->expr = expr;
+	strcpy( f->text, p );
+	if( is_new )
+		calc_flush(); // the name may hide a builtin
+	sprintf( msg, "%s(%s) defined\r\n", name, param );
+	print_string( msg );
+	return true;
+}
+
+void calc_table( const char *name, double from, double to, double step ){
+	// evaluate a function over a range
+	char msg[80];
+	char func_name[CALC_NAME_SIZE];
+	const char *p = calc_name( name, func_name ); // "f" or "f(x)"
+	int i = (p==NULL) ? -1 : calc_find_func( func_name );
+	if( i<0 ){
+		print_string( "Unknown function\r\n" );
+		return;
+	}
+	if( (step==0) || ((to-from)/step < 0) || ((to-from)/step >= CALC_TABLE_MAX) ){
+		sprintf( msg, "Invalid range or more than %d rows\r\n", CALC_TABLE_MAX );
+		print_string( msg );
+		return;
+	}
+
+	uint32_t rows = (uint32_t)floor( (to-from)/step + 1E-9 ) + 1;
+	uint32_t eval_us = 0;
+	for( uint32_t row=0; row<rows; row++ ){
+		double x = from + row*step;
+		uint32_t start = time_us_32();
+		double y = calc_call( &funcs[i], x );
+		eval_us += time_us_32() - start;
+		sprintf( msg, "%14.6g %14.10g\r\n", x, y );
+		print_string( msg );
+		keybd_poll();
+		if( read_key()==ESC ){
+			print_string( "User abort!\r\n" );
+			return;
+		}
+	}
+	sprintf( msg, "%lu values in %lu us\r\n", rows, eval_us );
+	print_string( msg );
+}
+
+void calc_list(){
+	char msg[CALC_EXPR_SIZE+40];
+	for( int i=0; i<var_count; i++ ){
+		sprintf( msg, "%s = %.10g\r\n", vars[i].name, vars[i].value );
+		print_string( msg );
+	}
+	for( int i=0; i<func_count; i++ ){
+		sprintf( msg, "%s(%s) = %s\r\n", funcs[i].name, funcs[i].param, funcs[i].text );
+		print_string( msg );
+	}
+}
+
+void calc_clear(){
+	calc_flush();
+	for( int i=0; i<func_count; i++ ){
+		te_free( funcs[i].expr );
+		funcs[i].expr = NULL;
+	}
+	func_count = 0;
+	var_count = 0;
+}
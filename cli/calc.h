@@ -0,0 +1,27 @@
+/* ==========================================================================
+    CALC - calculator of the CLI, based on tinyexpr
+
+		Variables and named expressions (functions of one parameter) persist
+		between the calc commands. The compiled expressions are cached by text
+		so a repeated calc or a table does not parse the expression again.
+   ========================================================================== */
+
+#ifndef _CALC_H
+#define _CALC_H
+
+#include <stdbool.h>
+
+#define CALC_NAME_SIZE   12  // variable & function names
+#define CALC_EXPR_SIZE   120 // expression text
+#define CALC_MAX_VARS    16
+#define CALC_MAX_FUNCS   8
+#define CALC_CACHE_SIZE  8   // compiled expressions kept
+#define CALC_TABLE_MAX   1000 // rows displayed by calc table
+
+bool calc_eval( const char *expr, double *result, int *error ); // error: position in expr (1..n)
+bool calc_assign( const char *line ); // "name = expr" or "name(param) = expr"
+void calc_table( const char *name, double from, double to, double step );
+void calc_list();
+void calc_clear();
+
+#endif
@@ -8,6 +8,7 @@
 #include "user_funcs.h"
 #include "tinyexpr.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include "../common/picoterm_stdio.h"
 #include "../common/picoterm_debug.h"
@@ -24,19 +25,129 @@ int token_cnt = 0;
 char tokens[NUMBER_OF_STRING][MAX_STRING_SIZE];
 //char buffer[BUF_SIZE], prev_buffer[BUF_SIZE];
 
+// Command registry: open addressing hash table for the dispatch, and the
+// commands sorted by name for the completion.
+#define CMD_HASH_SIZE 64 // power of 2, at least twice MAX_USER_FUNCTIONS
+#if CMD_HASH_SIZE < 2*MAX_USER_FUNCTIONS
+#error "CMD_HASH_SIZE too small for MAX_USER_FUNCTIONS"
+#endif
+
+static uint8_t cmd_hash[CMD_HASH_SIZE];        // user_functions index + 1, 0 when free
+static uint8_t cmd_sorted[MAX_USER_FUNCTIONS]; // user_functions index, sorted by name
+static uint8_t cmd_count = 0;
+
+// Flags of the current command, parsed once by cli_execute()
+static uint32_t flag_bits = 0;              // one letter flags "-a" to "-z"
+static uint8_t flag_idx[NUMBER_OF_STRING];  // token index of each flag
+static uint8_t flag_count = 0;
+
+static uint32_t cmd_hash_of( const char *name ){
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	while( *name ){
+		h ^= (uint8_t)*name++;
+		h *= 16777619u;
+	}
+	return h & (CMD_HASH_SIZE-1);
+}
+
+static void cmd_index(){
+	// fill the hash table & the sorted list from user_functions[]
+	memset( cmd_hash, 0, sizeof(cmd_hash) );
+	cmd_count = 0;
+	for( int i = 0; (i < MAX_USER_FUNCTIONS) && (strlen(user_functions[i].command_name)>0); i++ ){
+		uint32_t h = cmd_hash_of( user_functions[i].command_name );
+		while( cmd_hash[h]!=0 )
+			h = (h+1) & (CMD_HASH_SIZE-1); // linear probing
+		cmd_hash[h] = i+1;
+
+		int j = cmd_count++; // insertion sort
+		while( (j>0) && (strcmp( user_functions[cmd_sorted[j-1]].command_name, user_functions[i].command_name )>0) ){
+			cmd_sorted[j] = cmd_sorted[j-1];
+			j--;
+		}
+		cmd_sorted[j] = i;
+	}
+}
+
+static usr_funcs *cmd_find( const char *name ){
+	uint32_t h = cmd_hash_of( name );
+	while( cmd_hash[h]!=0 ){
+		usr_funcs *f = &user_functions[cmd_hash[h]-1];
+		if( strcmp( f->command_name, name )==0 )
+			return f;
+		h = (h+1) & (CMD_HASH_SIZE-1);
+	}
+	return NULL;
+}
+
+static char *cmd_name( int sorted_idx ){
+	return user_functions[cmd_sorted[sorted_idx]].command_name;
+}
+
+int cli_complete( char *str, int pos, int max_size ){
+	// TAB pressed in get_string(): complete the command name with the prefix
+	// shared by all the matching commands (a space is added when only one
+	// command matches). The sorted list is searched like a prefix tree: the
+	// matching commands are contiguous. Returns the new length of str.
+	if( strchr( str, ' ' )!=NULL )
+		return pos; // only the command name is completed
+
+	int lo = 0, hi = cmd_count;
+	while( lo < hi ){ // first name >= str
+		int mid = (lo+hi)/2;
+		if( strncmp( cmd_name(mid), str, pos ) < 0 )
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	if( (lo==cmd_count) || (strncmp( cmd_name(lo), str, pos )!=0) )
+		return pos; // no match
+	int last = lo;
+	while( (last+1 < cmd_count) && (strncmp( cmd_name(last+1), str, pos )==0) )
+		last++;
+
+	char *first_name = cmd_name(lo);
+	char *last_name = cmd_name(last);
+	while( (first_name[pos]!=0) && (first_name[pos]==last_name[pos]) && (pos < max_size-1) ){
+		str[pos] = first_name[pos];
+		pos++;
+	}
+	if( (lo==last) && (pos < max_size-1) )
+		str[pos++] = ' ';
+	str[pos] = 0;
+	return pos;
+}
+
 void cli_init(){
 		// initialize the user functions
 		register_user_functions();
+		cmd_index();
+		set_completion( cli_complete );
 }
 
 bool has_flag( char *flag_str,  char tokens[][MAX_STRING_SIZE] ){
-	// flags are not counted in the tokens. So we ave to tested all the entries.
-	for( int i=0; i<NUMBER_OF_STRING; i++ )
-		if( strcmp( flag_str, tokens[i] )==0 )
+	// flags are not counted in the tokens. They are collected by cli_execute()
+	// so only the flags of the command are tested.
+	if( (flag_str[0]=='-') && (flag_str[1]>='a') && (flag_str[1]<='z') && (flag_str[2]==0) )
+		return (flag_bits >> (flag_str[1]-'a')) & 1;
+	for( int i=0; i<flag_count; i++ )
+		if( strcmp( flag_str, tokens[flag_idx[i]] )==0 )
 			return true;
 	return false;
 }
 
+char *flag_value( char *flag_str,  char tokens[][MAX_STRING_SIZE] ){
+	// value following a flag (eg: "-rate 9600"). The value is still counted in
+	// the tokens so it must be placed after the regular parameters.
+	for( int i=0; i<flag_count; i++ ){
+		int idx = flag_idx[i];
+		if( (idx < NUMBER_OF_STRING-1) && (strcmp( flag_str, tokens[idx] )==0) && (strlen(tokens[idx+1])>0) )
+			return tokens[idx+1];
+	}
+	return NULL;
+}
+
 void cli_execute( char *cmd, int max_size ){
 		// Parse & execute the command stored into the 'str' (char str[80] ).
 		// Delimiters are SPACE and COMA.
@@ -45,53 +156,50 @@ void cli_execute( char *cmd, int max_size ){
 		if( strlen(cmd)==0 )
 			return;
 
+		memset( tokens, 0, sizeof(tokens) ); // no flag left from the previous command
 		token_cnt = parse_string(cmd, tokens, " ,");
 	  if (token_cnt <= 0)
 			return;
 
-		// rectify token count to remove "-flag" entries
+		// collect the "-flag" entries and remove them from the token count
 		// they are tested with has_flag('-p')
-		for( int i=token_cnt-1; i>0; i-- )
-			if( strlen(tokens[i])>0 && tokens[i][0]=='-' )
-				token_cnt--;
-
-		// loop through the user defined functions and execute
-		// one if found
-		for (int i = 0; i < MAX_USER_FUNCTIONS; i++) {
-			//presumably end of user functions
-			if (strcmp(user_functions[i].command_name, "") == 0)
-				break;
-
-			//display help
-			if (strcmp(user_functions[i].command_name, tokens[0]) == 0) {
-				if ((strcmp(tokens[1], "?") == 0) ||
-						(strcmp(tokens[1], "-h") == 0)) {
-					print_string( user_functions[i].command_help );
-					return;
-				} // end if
+		flag_bits = 0;
+		flag_count = 0;
+		for( int i=1; i<token_cnt; i++ )
+			if( tokens[i][0]=='-' ){
+				flag_idx[flag_count++] = i;
+				if( (tokens[i][1]>='a') && (tokens[i][1]<='z') && (tokens[i][2]==0) )
+					flag_bits |= 1UL << (tokens[i][1]-'a');
 			}
+		token_cnt -= flag_count;
 
-			//list the user-defined functions
-			if (strcmp("list", tokens[0]) == 0) {
-				for (int j = 0; j < MAX_USER_FUNCTIONS; j++) {
-						sprintf(str, "%s, ", user_functions[j].command_name);
-						print_string(str);
-				}
-				return;
+		//list the user-defined functions
+		if (strcmp("list", tokens[0]) == 0) {
+			for (int j = 0; j < cmd_count; j++) {
+					sprintf(str, "%s, ", cmd_name(j));
+					print_string(str);
 			}
+			return;
+		}
 
-			//execute the command function
-			if (strcmp(user_functions[i].command_name, tokens[0]) == 0) {
-				sprintf( debug_msg, "%d", token_cnt );
-				debug_print( debug_msg );
-				user_functions[i].user_function(token_cnt, tokens);
-				return;
-			}
-		} // eof for
+		usr_funcs *f = cmd_find( tokens[0] );
+		if( f==NULL ){
+			// user function not found
+			sprintf(str, "%s ???", tokens[0]);
+			print_string(str);
+			return;
+		}
+
+		//display help
+		if( (strcmp(tokens[1], "?") == 0) || has_flag( "-h", tokens ) ){
+			print_string( f->command_help );
+			return;
+		}
 
-		// user function not found
-		sprintf(str, "%s ???", tokens[0]);
-		print_string(str);
+		//execute the command function
+		sprintf( debug_msg, "%d", token_cnt );
+		debug_print( debug_msg );
+		f->user_function(token_cnt, tokens);
 }
 
 
@@ -102,8 +210,8 @@ int parse_string(char *str, char tokens[][MAX_STRING_SIZE], char *delim) {
   int x = 0;
 
   char *token = strtok(buffer, delim);
-  while (token != NULL) {
-    strcpy(tokens[x], token); // getting each token
+  while ((token != NULL) && (x < NUMBER_OF_STRING)) {
+    strncpy(tokens[x], token, MAX_STRING_SIZE-1); // getting each token
     token = strtok(NULL, " ");
     x++;
   } // end while
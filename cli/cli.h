@@ -14,6 +14,8 @@
 
 void cli_init();
 bool has_flag( char *flag_str,  char tokens[][MAX_STRING_SIZE] );
+char *flag_value( char *flag_str,  char tokens[][MAX_STRING_SIZE] ); // "-flag value", NULL when missing
 void cli_execute( char *str, int max_size );
+int cli_complete( char *str, int pos, int max_size ); // TAB completion of the command name
 
 #endif
@@ -1,9 +1,16 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
 #include "user_funcs.h"
 #include "cli.h"
 #include "pico/stdlib.h"
 #include "tinyexpr.h"
+#include "calc.h"
+#include "../common/keybd.h" // keybd_poll
+#include "pico/scanvideo.h" // scanvideo_wait_for_vblank
+#include "picoterm_core.h" // terminal_ingest
+#include "picoterm_conio.h" // read_key
 #include "../common/picoterm_stdio.h"
 #include "../common/picoterm_stddef.h"
 #include "../common/picoterm_harddef.h"
@@ -11,9 +18,21 @@
 #include "../common/picoterm_debug.h"
 #include "../pio_fatfs/ff.h"
 #include "../pio_fatfs/diskio.h"
+#include "../pio_fatfs/tf_card.h" // SPI clock
+#include "../common/pio_sd.h"
+#include "../common/picoterm_hotkey.h"
+#include "../common/picoterm_capture.h"
+#include "../common/picoterm_xfer.h"
+#include "../common/picoterm_config.h"
+#include "../common/picoterm_bench.h"
+#include "../common/picoterm_stats.h"
+#include "../common/picoterm_boot.h"
+#include "../common/picoterm_timeline.h"
 
 
 extern picoterm_conio_config_t conio_config;
+/* picoterm_config.c */
+extern picoterm_config_t config;
 
 usr_funcs user_functions[MAX_USER_FUNCTIONS];
 
@@ -38,7 +57,7 @@ void register_user_functions() {
 
   //Here is a third user function.
   strcpy(user_functions[2].command_name, "calc");
-  strcpy(user_functions[2].command_help, "calc math_expression");
+  strcpy(user_functions[2].command_help, "calc expr|x=expr|f(x)=expr\r\nvars,clear,table");
   user_functions[2].user_function = calc;
 
 	strcpy(user_functions[3].command_name, "type");
@@ -49,6 +68,62 @@ void register_user_functions() {
   strcpy(user_functions[4].command_help, "send_file filename \r\nSend file content to UART.");
   user_functions[4].user_function = cli_send_file;
 
+	strcpy(user_functions[5].command_name, "pacing");
+  strcpy(user_functions[5].command_help, "pacing [char_us line_ms] [-x|-n]\r\nsend_file pacing.");
+  user_functions[5].user_function = cli_pacing;
+
+	strcpy(user_functions[6].command_name, "hotkeys");
+  strcpy(user_functions[6].command_help, "hotkeys [-r]\r\nHotkey cache. -r to rescan SD.");
+  user_functions[6].user_function = cli_hotkeys;
+
+	strcpy(user_functions[7].command_name, "sd_bench");
+  strcpy(user_functions[7].command_help, "sd_bench [size_kb]\r\nSD sequential write/read speed.");
+  user_functions[7].user_function = cli_sd_bench;
+
+	strcpy(user_functions[8].command_name, "capture");
+  strcpy(user_functions[8].command_help, "capture [filename] [-s]\r\nCapture host stream to SD.");
+  user_functions[8].user_function = cli_capture;
+
+	strcpy(user_functions[9].command_name, "replay");
+  strcpy(user_functions[9].command_help, "replay filename [-rate baud]\r\nParser throughput benchmark.");
+  user_functions[9].user_function = cli_replay;
+
+	strcpy(user_functions[10].command_name, "xmodem");
+  strcpy(user_functions[10].command_help, "xmodem filename [-s] [-k]\r\nReceive (or send) a file.");
+  user_functions[10].user_function = cli_xmodem;
+
+	strcpy(user_functions[11].command_name, "ymodem");
+  strcpy(user_functions[11].command_help, "ymodem [filename -s]\r\nReceive files (or send one).");
+  user_functions[11].user_function = cli_ymodem;
+
+	strcpy(user_functions[12].command_name, "view");
+  strcpy(user_functions[12].command_help, "view file [-rate baud] [-fps n]\r\nANSI art viewer");
+  user_functions[12].user_function = cli_view;
+
+	strcpy(user_functions[13].command_name, "bench");
+  strcpy(user_functions[13].command_help, "bench [-n] [-s]\r\nRun the benchmarks.");
+  user_functions[13].user_function = cli_bench;
+
+	strcpy(user_functions[14].command_name, "zmodem");
+  strcpy(user_functions[14].command_help, "zmodem [filename -s]\r\nReceive files (or send one).");
+  user_functions[14].user_function = cli_zmodem;
+
+	strcpy(user_functions[15].command_name, "stats");
+  strcpy(user_functions[15].command_help, "stats [-r]\r\nShow (or reset) the counters.");
+  user_functions[15].user_function = cli_stats;
+
+	strcpy(user_functions[16].command_name, "repeat");
+  strcpy(user_functions[16].command_help, "repeat [delay_ms interval_ms]\r\nKey repeat timing.");
+  user_functions[16].user_function = cli_repeat;
+
+	strcpy(user_functions[17].command_name, "boot");
+  strcpy(user_functions[17].command_help, "boot\r\nBoot timeline (us since reset).");
+  user_functions[17].user_function = cli_boot;
+
+	strcpy(user_functions[18].command_name, "timeline");
+  strcpy(user_functions[18].command_help, "timeline [-r] [-u] [-s]\r\nRecord, dump to UART or SD.");
+  user_functions[18].user_function = cli_timeline;
+
 }
 
 //--------------------------------------------------------------------+
@@ -58,17 +133,61 @@ void register_user_functions() {
 void calc(int token_count, char tokens[][MAX_STRING_SIZE]) {
 	// This is using the TinyExprMath Expression Parser
 	// found at: https://github.com/codeplea/tinyexpr
-  char expr[80];
-  char answer[10];
+	// Variables, functions & compiled expressions are kept by calc.c
+  char expr[CALC_EXPR_SIZE];
+  char answer[60];
+  double result;
+  int error;
 
-  strcpy(expr, tokens[1]);
+  if (strcmp(tokens[1], "vars") == 0) {
+    calc_list();
+    return;
+  }
+  if (strcmp(tokens[1], "clear") == 0) {
+    calc_clear();
+    return;
+  }
+  if (strcmp(tokens[1], "table") == 0) {
+    // calc table f(x) from..to [step]
+    char *range = strstr(tokens[3], "..");
+    if (range == NULL) {
+      print_string("Syntax: calc table f(x) from..to [step]\r\n");
+      return;
+    }
+    *range = 0;
+    calc_table(tokens[2], atof(tokens[3]), atof(range+2), strlen(tokens[4]) > 0 ? atof(tokens[4]) : 1);
+    return;
+  }
 
-  if (strlen(expr) <= 1) {
+  // the expression may contain spaces (splitted into several tokens)
+  expr[0] = 0;
+  for (int i = 1; (i < NUMBER_OF_STRING) && (strlen(tokens[i]) > 0); i++) {
+    if (strlen(expr) + strlen(tokens[i]) + 2 > sizeof(expr)) {
+      print_string("Expression too long.\r\n");
+      return;
+    }
+    if (i > 1)
+      strcat(expr, " ");
+    strcat(expr, tokens[i]);
+  }
+  if (strlen(expr) == 0) {
     print_string("Not a math_expression.\r\n");
     return;
   }
 
-  sprintf(answer, "%f\r\n", te_interp(expr, 0)); /* Prints 25. */
+  if (strchr(expr, '=') != NULL) { // x = expr, f(x) = expr
+    calc_assign(expr);
+    return;
+  }
+  if (!calc_eval(expr, &result, &error)) {
+    sprintf(answer, "Error at position %d\r\n", error);
+    print_string(answer);
+    return;
+  }
+  if ((result >= 0) && (result <= 0xFFFFFFFF) && (result == floor(result))) // register math
+    sprintf(answer, "%.10g (0x%lX)\r\n", result, (uint32_t)result);
+  else
+    sprintf(answer, "%.10g\r\n", result);
   print_string(answer);
 
 } // end calcware/uart.h"
@@ -80,21 +199,23 @@ void calc(int token_count, char tokens[][MAX_STRING_SIZE]) {
 
 void cli_sd_info(int token_count, char tokens[][MAX_STRING_SIZE]) {
 	// Perform SD test with lot of debug messages
-	FATFS fs;
-	//FIL fil;
+	FATFS *fs;
+	DWORD free_clust;
 	FRESULT fr;     /* FatFs return code */
-	//UINT br;
-	//UINT bw;
 
-	fr = f_mount(&fs, "", 1);
+	if( !is_sd_mount() ){ // will attempt to remount
+			print_string( "SD mount error\r\n" );
+			return;
+	}
+	fr = f_getfree("", &free_clust, &fs); // also retreive the mounted FATFS
 	if (fr != FR_OK) { // see FRESULT in ff.h
-			sprintf( debug_msg, "SD mount error %d\r\n", fr);
+			sprintf( debug_msg, "SD getfree error %d\r\n", fr);
 			print_string( debug_msg );
 			return;
 	}
 	print_string("SD mount ok\r\n");
 
-	switch (fs.fs_type) {
+	switch (fs->fs_type) {
 			case FS_FAT12:
 					print_string("FS type        : FAT12\r\n");
 					break;
@@ -111,7 +232,7 @@ void cli_sd_info(int token_count, char tokens[][MAX_STRING_SIZE]) {
 					print_string("FS type        : unknown\r\n");
 					break;
 	}
-	sprintf( debug_msg, "Card size      : %7.2f GB (GB = 1E9 bytes)\r\n", fs.csize * fs.n_fatent * 512E-9);
+	sprintf( debug_msg, "Card size      : %7.2f GB (GB = 1E9 bytes)\r\n", fs->csize * fs->n_fatent * 512E-9);
 	print_string( debug_msg );
 	// Print CID
 	BYTE cid[16];
@@ -128,6 +249,12 @@ void cli_sd_info(int token_count, char tokens[][MAX_STRING_SIZE]) {
 	print_string( debug_msg );
 	sprintf( debug_msg, "Manufact. date : %d/%d\r\n", (int) cid[14] & 0xf, ((int) cid[13] & 0xf)*16 + ((int) (cid[14] >> 2) & 0xf) + 2000);
 	print_string( debug_msg );
+	sprintf( debug_msg, "SPI clock      : %lu kHz\r\n", sd_spi_baudrate()/1000 );
+	print_string( debug_msg );
+	sprintf( debug_msg, "SPI errors     : %lu CRC, %lu response\r\n", sd_spi_crc_errors(), sd_spi_resp_errors() );
+	print_string( debug_msg );
+	sprintf( debug_msg, "Sector cache   : %lu hits, %lu misses\r\n", sd_cache_hits(), sd_cache_misses() );
+	print_string( debug_msg );
 }
 
 //--------------------------------------------------------------------+
@@ -144,16 +271,12 @@ void cli_dir(int token_count, char tokens[][MAX_STRING_SIZE]) {
 	char *path;
 	FRESULT res;
 
-	FATFS fs;
-	FRESULT fr;     /* FatFs return code */
 	bool paged = has_flag( "-p", tokens );
 
-	// Mount SD_Card
+	// Mount SD_Card (if not yet mounted)
 	//
-	fr = f_mount(&fs, "", 1);
-	if (fr != FR_OK) { // see FRESULT in ff.h
-			sprintf( debug_msg, "SD mount error %d\r\n", fr);
-			print_string( debug_msg );
+	if( !is_sd_mount() ){
+			print_string( "SD mount error\r\n" );
 			return;
 	}
 
@@ -224,12 +347,13 @@ void cli_type( int token_count, char tokens[][MAX_STRING_SIZE]){
 		char ch;
 		//FRESULT res;
 		FIL file;
-		FATFS fs;
+		DWORD linkmap[SD_LINKMAP_SIZE];
 		FRESULT fr;     /* FatFs return code */
 		uint16_t size;
 
 		bool paged = has_flag( "-p", tokens );
 		UINT bytesRead;
+		char chunk[100]; // file read by chunks
 
 		static bool _cr_lf_issued = false;
 
@@ -258,12 +382,10 @@ void cli_type( int token_count, char tokens[][MAX_STRING_SIZE]){
 		filename = tokens[1];
 
 
-		// Mount SD_Card
+		// Mount SD_Card (if not yet mounted)
 		//
-		fr = f_mount(&fs, "", 1);
-		if (fr != FR_OK) { // see FRESULT in ff.h
-				sprintf( debug_msg, "SD mount error %d\r\n", fr);
-				print_string( debug_msg );
+		if( !is_sd_mount() ){
+				print_string( "SD mount error\r\n" );
 				return;
 		}
 
@@ -276,11 +398,13 @@ void cli_type( int token_count, char tokens[][MAX_STRING_SIZE]){
 				return;
 		}
 
+		sd_fast_seek( &file, linkmap, SD_LINKMAP_SIZE );
+
 		// file size
 		size = f_size(&file);
 
-		// using debug_msg buffer to read FIRST CHUNCK of file content
-		fr = f_read(&file, debug_msg, sizeof(debug_msg), &bytesRead);
+		// read FIRST CHUNCK of file content
+		fr = f_read(&file, chunk, sizeof(chunk), &bytesRead);
 		if (fr != FR_OK) { // see FRESULT in ff.h
 				sprintf( debug_msg, "File read error %d\r\n", fr);
 				print_string( debug_msg );
@@ -293,13 +417,13 @@ void cli_type( int token_count, char tokens[][MAX_STRING_SIZE]){
 			// print_out the file CHUNCK
 			for( int i=0; i<bytesRead; i++) {
 				// type char takes care of /r or /n or /r/n
-				type_char( debug_msg[i] );
+				type_char( chunk[i] );
 				// if cursor @ position after a print_char --> we had a line return
 				if( conio_config.cursor.pos.x==1 )
 					line_count++;
 
 				//char ln[50];
-				//sprintf( ln, "[%d]=%c , x=%d", i, debug_msg[i], conio_config.cursor.pos.x );
+				//sprintf( ln, "[%d]=%c , x=%d", i, chunk[i], conio_config.cursor.pos.x );
 				//debug_print( ln );
 
 				if( paged && (line_count>VISIBLEROWS-3) && (line_count%VISIBLEROWS-2)==0 ) {
@@ -312,14 +436,14 @@ void cli_type( int token_count, char tokens[][MAX_STRING_SIZE]){
 						}
 						else {
 							print_string("\r\n" );
-							print_char( debug_msg[i] ); // reprint the initial char.
+							print_char( chunk[i] ); // reprint the initial char.
 							line_count++;
 						}
 				} // eof paged
 			} // for each char
 
 			// read next CHUNCK
-			fr = f_read(&file, debug_msg, sizeof(debug_msg), &bytesRead);
+			fr = f_read(&file, chunk, sizeof(chunk), &bytesRead);
 			if (fr != FR_OK) { // see FRESULT in ff.h
 					sprintf( debug_msg, "File read error %d\r\n", fr);
 					print_string( debug_msg );
@@ -335,75 +459,583 @@ void cli_type( int token_count, char tokens[][MAX_STRING_SIZE]){
 //--------------------------------------------------------------------+
 
 void cli_send_file( int token_count, char tokens[][MAX_STRING_SIZE]){
-	char *filename;
-	char ch;
-	FIL file;
-	FATFS fs;
-	FRESULT fr;     /* FatFs return code */
-	uint16_t size, readed;
+	// The file is sent by the background streamer (see pio_sd.c). We just
+	// display the progress while it is running.
+	char line[40];
+	uint32_t sent, size, last_sent;
+
+	if( token_count<2 ){
+		print_string("Missing filename!\r\n" );
+		return;
+	}
+
+	if( !stream_file_to_uart( tokens[1] ) ){
+		print_string( is_streaming() ? "Already sending a file!\r\n" : "Cannot send the file!\r\n" );
+		return;
+	}
+
+	print_string("\r\nSending...");
+	last_sent = 0;
+	while( is_streaming() ){
+		keybd_poll(); // keep the keyboard alive
+		sd_stream_task();
+		if( read_key()==ESC ){
+			stream_abort();
+			print_string( "\r\nUser abort!" );
+		}
+		stream_progress( &sent, &size );
+		if( sent-last_sent >= STREAM_BUFFER_SIZE ){
+			sprintf( line, "\r%lu / %lu sent!", sent, size );
+			print_string( line );
+			last_sent = sent;
+		}
+	}
+	stream_progress( &sent, &size );
+	sprintf( line, "\r%lu / %lu sent!\r\n", sent, size );
+	print_string( line );
+}
+
+//--------------------------------------------------------------------+
+//  cli_pacing
+//--------------------------------------------------------------------+
+
+void cli_pacing( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Display or set the pacing applied by send_file (and hotkeys).
+	// Use the config menu to save them into the flash.
+	if( token_count>=3 ){
+		config.char_delay = atoi( tokens[1] );
+		config.line_delay = atoi( tokens[2] );
+	}
+	if( has_flag( "-x", tokens ) )
+		config.flow_control = 1;
+	if( has_flag( "-n", tokens ) )
+		config.flow_control = 0;
 
+	sprintf( debug_msg, "char delay : %u us\r\n", config.char_delay );
+	print_string( debug_msg );
+	sprintf( debug_msg, "line delay : %u ms\r\n", config.line_delay );
+	print_string( debug_msg );
+	sprintf( debug_msg, "XON/XOFF   : %s\r\n", config.flow_control ? "yes" : "no" );
+	print_string( debug_msg );
+}
+
+//--------------------------------------------------------------------+
+//  cli_repeat
+//--------------------------------------------------------------------+
+
+void cli_repeat( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Display or set the keyboard repeat (applied at the next key down).
+	// Use the config menu to save them into the flash.
+	if( token_count>=3 ){
+		config.repeat_delay = atoi( tokens[1] );
+		config.repeat_interval = atoi( tokens[2] );
+	}
+	sprintf( debug_msg, "repeat delay    : %u ms\r\n", config.repeat_delay );
+	print_string( debug_msg );
+	sprintf( debug_msg, "repeat interval : %u ms%s\r\n", config.repeat_interval, config.repeat_interval==0 ? " (no repeat)" : "" );
+	print_string( debug_msg );
+}
+
+//--------------------------------------------------------------------+
+//  cli_hotkeys
+//--------------------------------------------------------------------+
+
+void cli_hotkeys( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Display the hotkey macros cached in RAM (and rescan the SD with -r)
+	hotkey_entry_t *entry;
+	hotkey_stats_t *stats = hotkey_stats();
+
+	if( has_flag( "-r", tokens ) ){
+		if( !is_sd_mount() ){
+			print_string( "SD mount error\r\n" );
+			return;
+		}
+		hotkey_scan();
+	}
+
+	for( uint8_t f_key=1; f_key<=HOTKEY_FKEYS; f_key++ )
+		for( int ctrl=0; ctrl<2; ctrl++ ){
+			entry = hotkey_entry( f_key, ctrl==1 );
+			if( entry->state==HOTKEY_NONE )
+				continue;
+			sprintf( debug_msg, "%s+F%-2d : ", ctrl==1 ? "Shift+Ctrl" : "Shift     ", f_key );
+			print_string( debug_msg );
+			if( entry->state==HOTKEY_RAM )
+				sprintf( debug_msg, "%5u bytes in RAM\r\n", entry->size );
+			else
+				sprintf( debug_msg, "on SD (too large)\r\n" );
+			print_string( debug_msg );
+		}
+
+	sprintf( debug_msg, "Arena    : %u / %u bytes, %u macros (%u on SD)\r\n", stats->used, HOTKEY_ARENA_SIZE, stats->loaded, stats->on_sd );
+	print_string( debug_msg );
+	sprintf( debug_msg, "Scan     : %lu ms\r\n", stats->scan_ms );
+	print_string( debug_msg );
+	sprintf( debug_msg, "Hits     : %lu (RAM) %lu (SD), %lu misses\r\n", stats->hits, stats->sd_reads, stats->misses );
+	print_string( debug_msg );
+}
+
+//--------------------------------------------------------------------+
+//  cli_sd_bench
+//--------------------------------------------------------------------+
+
+static void print_throughput( char *label, uint32_t size_kb, uint32_t elapsed_us ){
+	// KB/s and MB/s from the elapsed time
+	float kb_s = elapsed_us>0 ? (size_kb * 1000000.0f) / elapsed_us : 0;
+	sprintf( debug_msg, "%s : %7.1f KB/s (%5.2f MB/s) in %lu ms\r\n", label, kb_s, kb_s/1024, elapsed_us/1000 );
+	print_string( debug_msg );
+}
+
+void cli_sd_bench( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Sequential write then read of a temporary file (deleted afterward)
+	uint32_t size_kb = 256;
+	uint32_t write_us, read_us;
+
+	if( token_count>=2 )
+		size_kb = atoi( tokens[1] );
+	if( size_kb < SD_BENCH_CHUNK/1024 )
+		size_kb = SD_BENCH_CHUNK/1024;
+
+	sprintf( debug_msg, "Testing with %lu KB file...\r\n", size_kb );
+	print_string( debug_msg );
+	if( !sd_bench( size_kb, &write_us, &read_us ) ){
+		print_string( "SD bench failed!\r\n" );
+		return;
+	}
+	print_throughput( "Write", size_kb, write_us );
+	print_throughput( "Read ", size_kb, read_us );
+}
+
+//--------------------------------------------------------------------+
+//  cli_capture
+//--------------------------------------------------------------------+
+
+void cli_capture( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Start (with a filename) or stop (-s) the capture of the host stream.
+	// Displays the capture state & statistics.
+	capture_stats_t *stats = capture_stats();
+
+	if( has_flag( "-s", tokens ) )
+		capture_stop();
+	else if( token_count>=2 ){
+		if( !capture_start( tokens[1] ) ){
+			print_string( is_capturing() ? "Already capturing!\r\n" : "Cannot create the file!\r\n" );
+			return;
+		}
+	}
+
+	sprintf( debug_msg, "Capture  : %s %s\r\n", is_capturing() ? "running into" : "stopped, last file", capture_filename() );
+	print_string( debug_msg );
+	sprintf( debug_msg, "Received : %lu bytes\r\n", stats->received );
+	print_string( debug_msg );
+	sprintf( debug_msg, "Written  : %lu bytes in %lu writes (max %lu us)\r\n", stats->written, stats->flushes, stats->max_write_us );
+	print_string( debug_msg );
+	sprintf( debug_msg, "Dropped  : %lu bytes\r\n", stats->dropped );
+	print_string( debug_msg );
+}
+
+//--------------------------------------------------------------------+
+//  cli_replay
+//--------------------------------------------------------------------+
+
+#define REPLAY_CHUNK 512 // bytes given at once to the parser
+#define VIEW_CHUNK  4096 // bytes read at once by view
+
+static char ingest_buffer[VIEW_CHUNK]; // replay & view
+
+void cli_replay( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Feed a recorded host stream (eg: capture file) to the terminal parser,
+	// either at full speed either at the pace of a simulated baudrate.
+	// Only the time spent into the parser is used for the rates.
+	FIL file;
+	DWORD linkmap[SD_LINKMAP_SIZE];
+	FRESULT fr;
 	UINT bytesRead;
+	uint32_t rate = 0; // baud, 0 for unthrottled
+	uint32_t bytes = 0, chunk_us, parse_us = 0, worst_us = 0, overruns = 0;
+	char *value = flag_value( "-rate", tokens );
 
-	if( token_count<1 ){
+	if( token_count<2 ){
 		print_string("Missing filename!\r\n" );
 		return;
 	}
-	// file to open
-	filename = tokens[1];
+	if( value!=NULL )
+		rate = atoi( value );
 
-	// Mount SD_Card
-	//
-	fr = f_mount(&fs, "", 1);
+	if( !is_sd_mount() ){
+		print_string( "SD mount error\r\n" );
+		return;
+	}
+	fr = f_open( &file, tokens[1], FA_READ );
 	if (fr != FR_OK) { // see FRESULT in ff.h
-			sprintf( debug_msg, "SD mount error %d\r\n", fr);
+			sprintf( debug_msg, "File open error %d\r\n", fr);
 			print_string( debug_msg );
 			return;
 	}
+	sd_fast_seek( &file, linkmap, SD_LINKMAP_SIZE );
 
-	// Read the file
-	//
-	fr = f_open(&file, filename, FA_READ);
+	uint32_t scrolls = conio_config.scroll_count;
+	uint64_t start = time_us_64();
+	while( true ){
+		fr = f_read( &file, ingest_buffer, REPLAY_CHUNK, &bytesRead );
+		if( (fr != FR_OK) || (bytesRead==0) )
+			break;
+		if( rate>0 ){
+			// wait for the chunk to be "received" (10 bits per byte on the wire)
+			uint64_t arrival = start + ((uint64_t)(bytes+bytesRead) * 10000000) / rate;
+			while( time_us_64() < arrival )
+				keybd_poll(); // keep the keyboard alive
+		}
+		uint32_t t0 = time_us_32();
+		terminal_ingest( ingest_buffer, bytesRead );
+		chunk_us = time_us_32() - t0;
+
+		parse_us += chunk_us;
+		if( chunk_us > worst_us )
+			worst_us = chunk_us;
+		if( (rate>0) && ((uint64_t)chunk_us*rate > (uint64_t)bytesRead*10000000) )
+			overruns++; // parser slower than the wire for that chunk
+		bytes += bytesRead;
+		keybd_poll();
+		if( read_key()==ESC )
+			break; // user abort
+	}
+	uint32_t elapsed_ms = (time_us_64() - start) / 1000;
+	scrolls = conio_config.scroll_count - scrolls;
+	f_close( &file );
+	if (fr != FR_OK) {
+			sprintf( debug_msg, "\r\nFile read error %d", fr);
+			print_string( debug_msg );
+	}
+
+	print_string( "\r\n" );
+	sprintf( debug_msg, "Replayed : %lu bytes in %lu ms (%s)\r\n", bytes, elapsed_ms, rate>0 ? "throttled" : "max speed" );
+	print_string( debug_msg );
+	if( parse_us==0 )
+		return;
+	sprintf( debug_msg, "Parser   : %lu bytes/s, %lu scrolls/s (%lu scrolls)\r\n",
+		(uint32_t)(((uint64_t)bytes*1000000)/parse_us), (uint32_t)(((uint64_t)scrolls*1000000)/parse_us), scrolls );
+	print_string( debug_msg );
+	sprintf( debug_msg, "Chunk    : %lu us worst, %lu us average (%d bytes)\r\n",
+		worst_us, parse_us/((bytes+REPLAY_CHUNK-1)/REPLAY_CHUNK), REPLAY_CHUNK );
+	print_string( debug_msg );
+	if( rate>0 ){
+		sprintf( debug_msg, "Overruns : %lu chunks slower than %lu baud\r\n", overruns, rate );
+		print_string( debug_msg );
+	}
+}
+
+//--------------------------------------------------------------------+
+//  cli_view
+//--------------------------------------------------------------------+
+
+#define VIEW_SLICE 32   // bytes given at once to the parser with -rate
+
+void cli_view( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Display an ANSI / NupetSCII art file. The content goes straight to the
+	// terminal parser by chunks of 4 KB (no CR/LF rewriting like type). The
+	// parsing starts on a vertical blanking, so a small screen is rendered
+	// within a single video frame.
+	// -rate: paced at the given baudrate (demo playback).
+	// -fps : form feed separates the frames of an animation, each frame starts
+	//        on the vertical blanking following its due time.
+	FIL file;
+	DWORD linkmap[SD_LINKMAP_SIZE];
+	FRESULT fr;
+	UINT bytesRead;
+	uint32_t rate = 0, fps = 0;
+	uint32_t bytes = 0, frames = 1, parse_us = 0, worst_us = 0, t0;
+	bool abort = false;
+	char *value;
+
+	if( token_count<2 ){
+		print_string("Missing filename!\r\n" );
+		return;
+	}
+	if( (value = flag_value( "-rate", tokens ))!=NULL )
+		rate = atoi( value );
+	if( (value = flag_value( "-fps", tokens ))!=NULL )
+		fps = atoi( value );
+
+	if( !is_sd_mount() ){
+		print_string( "SD mount error\r\n" );
+		return;
+	}
+	fr = f_open( &file, tokens[1], FA_READ );
 	if (fr != FR_OK) { // see FRESULT in ff.h
 			sprintf( debug_msg, "File open error %d\r\n", fr);
 			print_string( debug_msg );
 			return;
 	}
+	sd_fast_seek( &file, linkmap, SD_LINKMAP_SIZE );
+
+	// first chunk read before synchronizing on the video
+	fr = f_read( &file, ingest_buffer, VIEW_CHUNK, &bytesRead );
+	uint64_t start = time_us_64();
+	uint64_t frame_due = start;
+	uint32_t frame_start = time_us_32();
+	scanvideo_wait_for_vblank();
+
+	while( (fr == FR_OK) && (bytesRead > 0) && !abort ){
+		UINT pos = 0;
+		while( (pos < bytesRead) && !abort ){
+			UINT len = bytesRead - pos;
+			bool new_frame = false;
+			if( fps>0 ){ // up to the next frame separator
+				char *ff = memchr( ingest_buffer+pos, FF, len );
+				if( ff!=NULL ){
+					len = ff - (ingest_buffer+pos);
+					new_frame = true;
+				}
+			}
+			if( (rate>0) && (len > VIEW_SLICE) )
+				len = VIEW_SLICE;
+			if( rate>0 ){
+				// wait for the slice to be "received" (10 bits per byte on the wire)
+				uint64_t arrival = start + ((uint64_t)(bytes+len) * 10000000) / rate;
+				while( time_us_64() < arrival )
+					keybd_poll(); // keep the keyboard alive
+			}
+			t0 = time_us_32();
+			terminal_ingest( ingest_buffer+pos, len );
+			parse_us += time_us_32() - t0;
+			pos += len;
+			bytes += len;
+
+			if( new_frame ){
+				pos++; // skip the form feed
+				bytes++;
+				if( (time_us_32() - frame_start) > worst_us )
+					worst_us = time_us_32() - frame_start;
+				frames++;
+				frame_due += 1000000 / fps;
+				while( time_us_64() < frame_due )
+					keybd_poll();
+				scanvideo_wait_for_vblank();
+				frame_start = time_us_32();
+			}
+			keybd_poll();
+			abort = (read_key()==ESC);
+		}
+		fr = f_read( &file, ingest_buffer, VIEW_CHUNK, &bytesRead );
+	}
+	if( (time_us_32() - frame_start) > worst_us )
+		worst_us = time_us_32() - frame_start;
+	uint32_t elapsed_ms = (time_us_64() - start) / 1000;
+	f_close( &file );
+	if (fr != FR_OK) {
+			sprintf( debug_msg, "\r\nFile read error %d", fr);
+			print_string( debug_msg );
+	}
+
+	print_string( "\r\n" );
+	sprintf( debug_msg, "%lu bytes, %lu frames, %lu ms, parser %lu us, worst frame %lu us%s\r\n",
+		bytes, frames, elapsed_ms, parse_us, worst_us, abort ? " (abort)" : "" );
+	print_string( debug_msg );
+}
+
+//--------------------------------------------------------------------+
+//  cli_bench
+//--------------------------------------------------------------------+
+
+#define BENCH_CSV "bench.csv"
 
-	// file size
-	size = f_size(&file);
+static bench_result_t bench_results[BENCH_MAX_RESULTS];
 
-	// using debug_msg buffer to read FIRST CHUNCK of file content
-	fr = f_read(&file, debug_msg, sizeof(debug_msg), &bytesRead);
+void cli_bench( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Run the micro benchmarks then display the results, also sent to the
+	// debug UART. -n: skip the SD card, -s: append the results to bench.csv
+	// (version;columns;name;value;unit) to compare the releases.
+	FIL file;
+	FRESULT fr;
+	UINT bw;
+
+	print_string( "Running... (screen cleared at the end)\r\n" );
+	uint8_t count = bench_run( bench_results, !has_flag( "-n", tokens ) );
+
+	sprintf( debug_msg, "PicoTerm %s, %d columns", CMAKE_PROJECT_VERSION, COLUMNS );
+	debug_print( debug_msg );
+	print_string( debug_msg );
+	print_string( "\r\n" );
+	for( int i=0; i<count; i++ ){
+		sprintf( debug_msg, "%-15s %10lu %s", bench_results[i].name, bench_results[i].value, bench_results[i].unit );
+		debug_print( debug_msg );
+		print_string( debug_msg );
+		print_string( "\r\n" );
+	}
+
+	if( !has_flag( "-s", tokens ) )
+		return;
+	if( !is_sd_mount() ){
+		print_string( "SD mount error\r\n" );
+		return;
+	}
+	fr = f_open( &file, BENCH_CSV, FA_WRITE | FA_OPEN_APPEND );
 	if (fr != FR_OK) { // see FRESULT in ff.h
-			sprintf( debug_msg, "File read error %d\r\n", fr);
+			sprintf( debug_msg, "File open error %d\r\n", fr);
 			print_string( debug_msg );
-			f_close(&file);
 			return;
 	}
+	for( int i=0; (i<count) && (fr==FR_OK); i++ ){
+		sprintf( debug_msg, "%s;%d;%s;%lu;%s\r\n", CMAKE_PROJECT_VERSION, COLUMNS, bench_results[i].name, bench_results[i].value, bench_results[i].unit );
+		fr = f_write( &file, debug_msg, strlen(debug_msg), &bw );
+	}
+	f_close( &file );
+	sprintf( debug_msg, fr==FR_OK ? "Appended to %s\r\n" : "Write error on %s\r\n", BENCH_CSV );
+	print_string( debug_msg );
+}
 
-	readed = 0;
-	char line[40];
-	print_string("\r\nSending...");
-	while( bytesRead > 0 ){
-		// send file CHUNCK over serial
-		for( int i=0; i<bytesRead; i++) {
-				uart_putc( UART_ID, debug_msg[i] );
-				sleep_ms( 1 );
-    }
-		// Chunck sent!
-		readed = readed + bytesRead;
-		sprintf( line, "\r%d / %d sent!", readed, size );
-		print_string( line );
-		// read next CHUNCK
-		fr = f_read(&file, debug_msg, sizeof(debug_msg), &bytesRead);
-		if (fr != FR_OK) { // see FRESULT in ff.h
-				sprintf( debug_msg, "\r\nFile read error %d\r\n", fr);
-				print_string( debug_msg );
-				f_close(&file);
-				return;
+//--------------------------------------------------------------------+
+//  cli_xmodem, cli_ymodem, cli_zmodem
+//--------------------------------------------------------------------+
+
+static bool xfer_show_progress( xfer_status_t *status ){
+	// Progress on the status row (last row of the screen). Returns false on ESC.
+	char bar[11];
+	uint32_t elapsed_ms = (time_us_64() - status->start_us) / 1000;
+	uint32_t rate = elapsed_ms>0 ? status->done / elapsed_ms : 0; // KB/s (bytes/ms)
+
+	if( status->size>0 ){
+		uint8_t percent = ((uint64_t)status->done * 100) / status->size;
+		for( int i=0; i<10; i++ )
+			bar[i] = (i < percent/10) ? '#' : '.';
+		bar[10] = 0;
+		snprintf( debug_msg, sizeof(debug_msg), "[%s] %3u%% %lu B %lu KB/s %u err %s", bar, percent, status->done, rate, status->errors, status->filename );
+	}
+	else
+		snprintf( debug_msg, sizeof(debug_msg), "%lu bytes %lu KB/s %u err %s", status->done, rate, status->errors, status->filename );
+	print_status( debug_msg );
+	return read_key()!=ESC;
+}
+
+static void xfer_prepare( char *msg ){
+	print_string( msg );
+	reserve_status_row();
+}
+
+static void xfer_show_result( bool ok, xfer_status_t *status ){
+	uint32_t elapsed_ms = (time_us_64() - status->start_us) / 1000;
+	print_status( NULL );
+	if( ok ){
+		sprintf( debug_msg, "%u file(s) transferred.\r\n", status->files );
+		print_string( debug_msg );
+		sprintf( debug_msg, "Last: %s, %lu bytes in %lu ms, %u errors\r\n", status->filename, status->done, elapsed_ms, status->errors );
+	}
+	else
+		sprintf( debug_msg, "Transfer failed: %s\r\n", status->error==NULL ? "?" : status->error );
+	print_string( debug_msg );
+}
+
+void cli_xmodem( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Receive a file from the host (or send it with -s, 1K blocks with -k)
+	xfer_status_t status;
+	bool ok;
+
+	if( token_count<2 ){
+		print_string("Missing filename!\r\n" );
+		return;
+	}
+	if( has_flag( "-s", tokens ) ){
+		xfer_prepare( "Start the XMODEM receiver on the host (ESC to cancel)\r\n" );
+		ok = xmodem_send( tokens[1], has_flag( "-k", tokens ), &status, xfer_show_progress );
+	}
+	else {
+		xfer_prepare( "Start the XMODEM sender on the host (ESC to cancel)\r\n" );
+		ok = xmodem_receive( tokens[1], &status, xfer_show_progress );
+	}
+	xfer_show_result( ok, &status );
+}
+
+void cli_ymodem( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Receive a batch of files from the host (or send one file with -s)
+	xfer_status_t status;
+	bool ok;
+
+	if( has_flag( "-s", tokens ) ){
+		if( token_count<2 ){
+			print_string("Missing filename!\r\n" );
+			return;
 		}
+		xfer_prepare( "Start the YMODEM receiver on the host (ESC to cancel)\r\n" );
+		ok = ymodem_send( tokens[1], &status, xfer_show_progress );
 	}
-	sprintf( line, "\r%d / %d sent!\r\n", size, size );
+	else {
+		xfer_prepare( "Start the YMODEM sender on the host (ESC to cancel)\r\n" );
+		ok = ymodem_receive( &status, xfer_show_progress );
+	}
+	xfer_show_result( ok, &status );
+}
+
+void cli_zmodem( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Receive a batch of files from the host (or send one file with -s)
+	xfer_status_t status;
+	bool ok;
+
+	if( has_flag( "-s", tokens ) ){
+		if( token_count<2 ){
+			print_string("Missing filename!\r\n" );
+			return;
+		}
+		xfer_prepare( "Start the ZMODEM receiver on the host (ESC to cancel)\r\n" );
+		ok = zmodem_send( tokens[1], &status, xfer_show_progress );
+	}
+	else {
+		xfer_prepare( "Start the ZMODEM sender on the host (ESC to cancel)\r\n" );
+		ok = zmodem_receive( &status, xfer_show_progress );
+	}
+	xfer_show_result( ok, &status );
+}
+
+//--------------------------------------------------------------------+
+//  cli_stats
+//--------------------------------------------------------------------+
 
-	f_close(&file);
+void cli_stats( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Display the performance counters (see picoterm_stats.h)
+	if( has_flag( "-r", tokens ) ){
+		stats_reset();
+		print_string( "Counters cleared.\r\n" );
+		return;
+	}
+	stats_print( print_string );
+}
+
+//--------------------------------------------------------------------+
+//  cli_boot
+//--------------------------------------------------------------------+
+
+void cli_boot( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Display the boot timeline (see picoterm_boot.h)
+	boot_print( print_string );
+}
+
+//--------------------------------------------------------------------+
+//  cli_timeline
+//--------------------------------------------------------------------+
+
+void cli_timeline( int token_count, char tokens[][MAX_STRING_SIZE]){
+	// Record the begin/end of the hot paths (see picoterm_timeline.h)
+	char msg[60];
+	if( has_flag( "-r", tokens ) ){
+		timeline_start();
+		print_string( "Recording (frozen on keyboard buffer overflow).\r\n" );
+		return;
+	}
+	if( has_flag( "-u", tokens ) ){
+		print_string( "Sending to the debug UART...\r\n" );
+		print_string( timeline_dump_uart() ? "Done.\r\n" : "Debug UART stalled!\r\n" );
+		return;
+	}
+	if( has_flag( "-s", tokens ) ){
+		char filename[16];
+		if( timeline_dump_sd( filename ) )
+			sprintf( msg, "Written to %s\r\n", filename );
+		else
+			sprintf( msg, "SD write error\r\n" );
+		print_string( msg );
+		return;
+	}
+	sprintf( msg, "%s, %lu events core 0, %lu events core 1\r\n", timeline_recording ? "Recording" : "Stopped",
+	         timeline_count(0), timeline_count(1) );
+	print_string( msg );
 }
@@ -4,7 +4,7 @@
 #define NUMBER_OF_STRING 10
 #define MAX_STRING_SIZE 25
 
-#define MAX_USER_FUNCTIONS 5
+#define MAX_USER_FUNCTIONS 19
 
 typedef void (*user_func)(int token_count, char tokens[][MAX_STRING_SIZE]);
 
@@ -24,5 +24,19 @@ void cli_sd_info(int token_count, char tokens[][MAX_STRING_SIZE]);
 void cli_dir(int token_count, char tokens[][MAX_STRING_SIZE]);
 void cli_type( int token_count, char tokens[][MAX_STRING_SIZE]);
 void cli_send_file( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_pacing( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_hotkeys( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_sd_bench( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_capture( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_replay( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_xmodem( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_ymodem( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_zmodem( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_stats( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_repeat( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_boot( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_timeline( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_view( int token_count, char tokens[][MAX_STRING_SIZE]);
+void cli_bench( int token_count, char tokens[][MAX_STRING_SIZE]);
 
 #endif /* USER_FUNCS_H */
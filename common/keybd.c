@@ -14,6 +14,12 @@
  * a zero idle rate (device only send reports if there is a change) when a HID
  * device is mounted.
  *
+ * Several keyboards (or keypads) can be used at once, behind a hub. Each one
+ * keeps the state of its 256 keys as a bitmap: a report is converted to a
+ * bitmap (boot report or NKRO bitmap report) then compared to the previous
+ * one word by word. The key changes of all the keyboards are stored with a
+ * timestamp into one event queue, delivered in order by keybd_task().
+ *
  * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
  * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
  * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
@@ -32,6 +38,11 @@
 #include "keybd.h"
 #include "pmhid.h"
 #include "picoterm_debug.h"
+#include "picoterm_trace.h"
+#include "picoterm_timeline.h"
+#include "picoterm_stats.h"
+#include "picoterm_config.h"
+#include "pico/time.h" // alarms
 
 // New TinyUSB stuff
 enum {
@@ -47,6 +58,48 @@ enum {
 };
 
 
+ #define MAX_REPORT  4
+ #define KEYS_WORDS  8 // 256 keys bitmap
+
+ #define MAX_KEY_FIELDS 4
+
+ // Keyboard page (0x07) input field of a report, from the report descriptor
+ typedef struct KeybdField {
+     uint16_t bit_offset; // after the report ID
+     uint8_t size;        // bits per item
+     uint8_t count;
+     uint8_t usage_min;
+     int32_t logical_min; // array: value of usage_min
+     bool variable;       // bitmap (one bit per usage) or array of key codes
+ } keybd_field_t;
+
+ // One entry per keyboard HID interface (several keyboards behind a hub)
+ typedef struct KeybdDevice {
+     uint8_t dev_addr; // UNDEFINED_ADDR when free
+     uint8_t instance;
+     uint8_t modifier; // last modifier byte
+     uint8_t report_count; // generic (report protocol) interface
+     tuh_hid_report_info_t report_info[MAX_REPORT];
+     uint8_t key_report_id; // report carrying the key fields
+     uint8_t key_field_count; // 0: layout unknown
+     keybd_field_t key_fields[MAX_KEY_FIELDS];
+     uint32_t keys[KEYS_WORDS]; // keys down
+ } keybd_device_t;
+
+ static keybd_device_t keybd_devices[KEYBD_MAX_DEVICES];
+
+ // Key changes of all the keyboards, in the order received
+ typedef struct KeybdEvent {
+     uint64_t time_us; // report reception
+     uint8_t scancode;
+     bool down;
+     int modifiers;    // WITH_xxx when the report was received
+ } keybd_event_t;
+
+ static keybd_event_t keybd_events[KEYBD_EVENT_QUEUE];
+ static uint8_t event_head = 0; // next free slot
+ static uint8_t event_tail = 0; // next event to deliver
+
  // A buffer for characters coming in from UART. It's of limited value as things stand
  // but will come into its own if and when we switch to interrupts for UART
  struct KeyboardBuffer {
@@ -58,8 +111,14 @@ enum {
 
  struct KeyboardBuffer keybuffer1 = {0};
 
+ // keys typed while a menu is open, the host bytes stay in keybuffer1
+ static char menu_keys[MENU_KEY_BUFFER];
+ static uint8_t menu_take = 0;
+ static uint8_t menu_insert = 0;
+
  void keybd_init( key_change_cb_t key_down_callback, key_change_cb_t key_up_callback ){
-     keybd_dev_addr = UNDEFINED_ADDR;
+     for( int i=0; i<KEYBD_MAX_DEVICES; i++ )
+       keybd_devices[i].dev_addr = UNDEFINED_ADDR;
 
      key_down_cb = key_down_callback; // callbacks NULL accepted
      key_up_cb = key_up_callback;
@@ -71,42 +130,53 @@ enum {
 
 static void default_key_down(int scancode, int keysym, int modifiers);
 
-static bool capslock_key_down_in_last_report = false;
-static bool capslock_key_down_in_this_report = false;
 static bool capslock_on = false;
 
 // --- Keyboard repeat feature ----------------------------
+// The repeat is timed by a hardware alarm (config.repeat_delay, then every
+// config.repeat_interval ms). The alarm IRQ only flags the event, it is
+// delivered by key_repeat_task(). When the main loop is late, the events
+// are merged into one instead of being sent in a burst.
 static int __last_key_down_scancode = 0; // NULL
 static int __last_key_down_modifier = 0;
-static uint32_t __last_key_down = 0;        // time of the last key down
-static uint32_t __last_key_down_resent = 0; // time of the last keydown resent
+static alarm_id_t repeat_alarm = 0;      // 0 = no repeat scheduled
+static volatile bool repeat_pending = false;
 
-static int keydown_start_repeat_delay = 500; // Start repeat a character after x ms
-static int keydown_resent_delay = 50; // interval between multiple repeat in ms
+/* picoterm_config.c */
+extern picoterm_config_t config;
 
-void set_last_key_down( int scancode, int keysym, int modifiers );
+void set_last_key_down( int scancode, int keysym, int modifiers, uint64_t time_us );
 void clear_last_key_down( int scancode, int keysym, int modifiers );
 
-bool keyboard_attached(){
-  return keybd_dev_addr != UNDEFINED_ADDR;
-}
-
  //--------------------------------------------------------------------+
  // USB HID
  //--------------------------------------------------------------------+
 
- #define MAX_REPORT  4
+ static void process_kbd_report(keybd_device_t *dev, hid_keyboard_report_t const *report);
+ static void process_nkro_report(keybd_device_t *dev, uint8_t const *report, uint16_t len);
+ static void process_keys(keybd_device_t *dev, uint32_t *keys, uint8_t modifier);
+ //static void process_mouse_report(hid_mouse_report_t const * report);
+ static void parse_key_layout(keybd_device_t *dev, uint8_t const *desc, uint16_t desc_len);
+ static void process_generic_report(keybd_device_t *dev, uint8_t const* report, uint16_t len);
 
- // Each HID instance can has multiple reports
- static struct
- {
-     uint8_t report_count;
-     tuh_hid_report_info_t report_info[MAX_REPORT];
- }hid_info[CFG_TUH_HID];
+bool keyboard_attached(){
+  return keyboard_count() > 0;
+}
 
- static void process_kbd_report(hid_keyboard_report_t const *report);
- //static void process_mouse_report(hid_mouse_report_t const * report);
- static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len);
+uint8_t keyboard_count(){
+  uint8_t count = 0;
+  for( int i=0; i<KEYBD_MAX_DEVICES; i++ )
+    if( keybd_devices[i].dev_addr != UNDEFINED_ADDR )
+      count++;
+  return count;
+}
+
+static keybd_device_t *find_device( uint8_t dev_addr, uint8_t instance ){
+  for( int i=0; i<KEYBD_MAX_DEVICES; i++ )
+    if( (keybd_devices[i].dev_addr == dev_addr) && (keybd_devices[i].instance == instance) )
+      return &keybd_devices[i];
+  return NULL;
+}
 
 
 //--------------------------------------------------------------------+
@@ -114,8 +184,18 @@ bool keyboard_attached(){
 //--------------------------------------------------------------------+
 
 void insert_key_into_buffer(unsigned char ch){
-   keybuffer1.buff[keybuffer1.insert++]=ch;
-   if(keybuffer1.insert==keybuffer1.length)keybuffer1.insert=0;
+   int next = keybuffer1.insert+1;
+   if(next==keybuffer1.length)next=0;
+   if(next==keybuffer1.take){ // full: drop the char (overwriting would empty the buffer)
+     STATS_INC( keybuf_overflow );
+     timeline_freeze(); // keep the events that led to the overflow
+     return;
+   }
+   keybuffer1.buff[keybuffer1.insert]=ch;
+   keybuffer1.insert=next;
+   int level = keybuffer1.insert-keybuffer1.take;
+   if(level<0)level+=keybuffer1.length;
+   stats_high_water( &stats_core[get_core_num()].keybuf_high, level );
 }
 
 bool key_ready(){
@@ -133,30 +213,73 @@ void clear_key_buffer(){
       read_key_from_buffer();
 }
 
-void key_repeat_task(){
-    // Check if key is maintained down too enough to start repeating
-    // Must be called from the main loop()
-    if( (__last_key_down_scancode != 0) && ((board_millis()-__last_key_down)>=keydown_start_repeat_delay) )
-      if( (board_millis() - __last_key_down_resent)>keydown_resent_delay ) {
-        //sprintf( debug_msg, "keydown repeat for %i", __last_key_down_scancode );
-        //debug_print( debug_msg );
-        __last_key_down_resent = board_millis();
-        if( key_down_cb != NULL)
-          key_down_cb( __last_key_down_scancode, 0, __last_key_down_modifier );
-      }
+void insert_key_into_menu_buffer(unsigned char ch){
+   // filled & read from the main loop (keybd_task, menus)
+   uint8_t next = (menu_insert+1) % MENU_KEY_BUFFER;
+   if( next==menu_take ) // full: drop the key
+     return;
+   menu_keys[menu_insert] = ch;
+   menu_insert = next;
+}
+
+bool menu_key_ready(){
+   return menu_take!=menu_insert;
+}
+
+unsigned char read_key_from_menu_buffer(){
+   unsigned char ch = menu_keys[menu_take];
+   menu_take = (menu_take+1) % MENU_KEY_BUFFER;
+   return ch;
+}
 
+void clear_menu_key_buffer(){
+   menu_take = menu_insert;
+}
+
+static int64_t key_repeat_alarm( alarm_id_t id, void *user_data ){
+    // Hardware alarm IRQ: flag a repeat event, merged with the previous one
+    // when it was not delivered yet.
+    if( repeat_pending )
+      STATS_INC( key_repeat_merged );
+    repeat_pending = true;
+    // negative: next alarm relative to this one's target time (no drift)
+    return -((int64_t)config.repeat_interval * 1000);
+}
+
+static void stop_key_repeat(){
+    if( repeat_alarm != 0 )
+      cancel_alarm( repeat_alarm );
+    repeat_alarm = 0;
+    repeat_pending = false;
+}
+
+void keybd_poll(){
+    // USB + key events + key repeat, for the loops waiting outside of the
+    // main loop (get_string, CLI commands, file transfers)
+    tuh_task();
+    keybd_task();
+    key_repeat_task();
+}
+
+void key_repeat_task(){
+    // Deliver the repeat event flagged by the alarm (if any).
+    // Must be called from the main loop() or keybd_poll()
+    if( repeat_pending ){
+      repeat_pending = false;
+      if( (__last_key_down_scancode != 0) && (key_down_cb != NULL) )
+        key_down_cb( __last_key_down_scancode, 0, __last_key_down_modifier );
+    }
 }
 
 //--------------------------------------------------------------------+
 // TinyUSB Callbacks - Generic report
 //--------------------------------------------------------------------+
 // called by tiny USB when receiving an USB Report
-static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len) {
-     (void) dev_addr;
-
-     uint8_t const rpt_count = hid_info[instance].report_count;
-     tuh_hid_report_info_t* rpt_info_arr = hid_info[instance].report_info;
+static void process_generic_report(keybd_device_t *dev, uint8_t const* report, uint16_t len) {
+     uint8_t const rpt_count = dev->report_count;
+     tuh_hid_report_info_t* rpt_info_arr = dev->report_info;
      tuh_hid_report_info_t* rpt_info = NULL;
+     uint8_t rpt_id = 0;
 
      if ( rpt_count == 1 && rpt_info_arr[0].report_id == 0)
      {
@@ -165,7 +288,7 @@ static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t c
      }
      else {
          // Composite report, 1st byte is report ID, data starts from 2nd byte
-         uint8_t const rpt_id = report[0];
+         rpt_id = report[0];
 
          // Find report id in the arrray
          for(uint8_t i=0; i<rpt_count; i++)
@@ -182,8 +305,7 @@ static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t c
      }
 
      if (!rpt_info) {
-         sprintf( debug_msg, "Couldn't find the report info for this report !");
-         debug_print( debug_msg );
+         TRACE( TR_HID_NO_REPORT_INFO, rpt_id, 0 );
          return;
      }
 
@@ -199,9 +321,14 @@ static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t c
          switch (rpt_info->usage)
          {
              case HID_USAGE_DESKTOP_KEYBOARD:
+             case HID_USAGE_DESKTOP_KEYPAD:
                  TU_LOG1("HID receive keyboard report\r\n");
-                 // Assume keyboard follow boot report layout
-                 process_kbd_report( (hid_keyboard_report_t const*) report );
+                 if( dev->key_field_count > 0 ){
+                   if( rpt_id == dev->key_report_id )
+                     process_nkro_report( dev, report, len );
+                 }
+                 else if( len == sizeof(hid_keyboard_report_t) ) // layout unknown: boot report
+                   process_kbd_report( dev, (hid_keyboard_report_t const*) report );
                  break;
 
              default: break;
@@ -220,67 +347,83 @@ static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t c
 // Note: if report descriptor length > CFG_TUH_ENUMERATION_BUFSIZE, it will be skipped
 // therefore report_desc = NULL, desc_len = 0
 void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_report, uint16_t desc_len) {
-    sprintf( debug_msg, "HID device address = %d, instance = %d is mounted", dev_addr, instance );
-    debug_print( debug_msg );
+    TRACE( TR_HID_MOUNT, dev_addr, instance );
 
     // Interface protocol (hid_interface_protocol_enum_t)
-    const char* protocol_str[] = { "None", "Keyboard", "Mouse" };
     uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
-    sprintf( debug_msg, "HID Interface Protocol = %s", protocol_str[itf_protocol] );
-    debug_print( debug_msg );
-
-    if( itf_protocol == 1 ) { // Did we attached a keyboard? Only pump report for keyboards
-      keybd_dev_addr = dev_addr;
-
-	   // printf("%d USB: device %d connected, protocol %s\n", time_us_32() - t0 , dev_addr, protocol_str[itf_protocol]);
-
-	    // By default host stack will use activate boot protocol on supported interface.
-	    // Therefore for this simple example, we only need to parse generic report descriptor (with built-in parser)
-	    if ( itf_protocol == HID_ITF_PROTOCOL_NONE ) {
-	        hid_info[instance].report_count = tuh_hid_parse_report_descriptor(hid_info[instance].report_info, MAX_REPORT, desc_report, desc_len);
-	        sprintf( debug_msg, "HID has %u reports \r\n", hid_info[instance].report_count );
-	       debug_print( debug_msg );
-	    }
+    TRACE( TR_HID_PROTOCOL, itf_protocol, 0 );
+
+    if( itf_protocol == HID_ITF_PROTOCOL_MOUSE ) // Only pump report for keyboards (see Issue #43)
+      return;
+
+    keybd_device_t *dev = NULL;
+    for( int i=0; (dev==NULL) && (i<KEYBD_MAX_DEVICES); i++ )
+      if( keybd_devices[i].dev_addr == UNDEFINED_ADDR )
+        dev = &keybd_devices[i];
+    if( dev == NULL ){
+      TRACE( TR_HID_TOO_MANY, dev_addr, instance );
+      return;
+    }
+    memset( dev, 0, sizeof(keybd_device_t) );
+    dev->dev_addr = UNDEFINED_ADDR; // until known as a keyboard
+
+    // By default host stack will use activate boot protocol on supported interface.
+    // The other interfaces (keypads, NKRO) are described by their report descriptor.
+    if ( itf_protocol == HID_ITF_PROTOCOL_NONE ) {
+        dev->report_count = tuh_hid_parse_report_descriptor(dev->report_info, MAX_REPORT, desc_report, desc_len);
+        TRACE( TR_HID_REPORTS, dev->report_count, 0 );
+        bool is_keyboard = false;
+        for( int i=0; i<dev->report_count; i++ )
+          if( (dev->report_info[i].usage_page == HID_USAGE_PAGE_DESKTOP) &&
+              ((dev->report_info[i].usage == HID_USAGE_DESKTOP_KEYBOARD) || (dev->report_info[i].usage == HID_USAGE_DESKTOP_KEYPAD)) )
+            is_keyboard = true;
+        if( !is_keyboard )
+          return;
+        parse_key_layout( dev, desc_report, desc_len );
+        TRACE( TR_HID_LAYOUT, dev->key_report_id, dev->key_field_count );
+    }
+    dev->dev_addr = dev_addr;
+    dev->instance = instance;
+    TRACE( TR_HID_ATTACHED, keyboard_count(), 0 );
 
-	    // request to receive report tuh_hid_report_received_cb() will be invoked when report is available
-	    if ( !tuh_hid_receive_report(dev_addr, instance) ) {
-	        debug_print("HID Error: cannot request to receive report");
-	    }
-		}
+    // request to receive report tuh_hid_report_received_cb() will be invoked when report is available
+    if ( !tuh_hid_receive_report(dev_addr, instance) ) {
+        TRACE( TR_HID_RECEIVE_ERROR, dev_addr, instance );
+    }
 }
 
 // Invoked when device with hid interface is un-mounted
 void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance) {
-    sprintf( debug_msg, "HID device address = %d, instance = %d is unmounted", dev_addr, instance);
-    debug_print( debug_msg );
-
-    if( dev_addr == keybd_dev_addr ) // did we disconnect the detected Keyboard?
-      keybd_dev_addr = UNDEFINED_ADDR;
+    TRACE( TR_HID_UNMOUNT, dev_addr, instance );
+
+    keybd_device_t *dev = find_device( dev_addr, instance );
+    if( dev == NULL ) // not a keyboard
+      return;
+    // release the keys still down (stops the repeat)
+    uint32_t none[KEYS_WORDS] = {0};
+    process_keys( dev, none, 0 );
+    dev->dev_addr = UNDEFINED_ADDR;
 }
 
 // Invoked when received report from device via interrupt endpoint
 void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len)
 {
-    uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
-
-    switch (itf_protocol)
-    {
-        case HID_ITF_PROTOCOL_KEYBOARD:
-            TU_LOG2("HID receive boot keyboard report");
-            process_kbd_report( (hid_keyboard_report_t const*) report );
-            break;
-
-
-        default:
-            // Generic report requires matching ReportID and contents with previous parsed report info
-            process_generic_report(dev_addr, instance, report, len);
-            break;
+    STATS_INC( hid_reports );
+    keybd_device_t *dev = find_device( dev_addr, instance );
+    if( dev != NULL ){
+      if( tuh_hid_interface_protocol(dev_addr, instance) == HID_ITF_PROTOCOL_KEYBOARD ){
+        TU_LOG2("HID receive boot keyboard report");
+        process_kbd_report( dev, (hid_keyboard_report_t const*) report );
+      }
+      else
+        // Generic report requires matching ReportID and contents with previous parsed report info
+        process_generic_report( dev, report, len );
     }
 
     // continue to request to receive report
     if ( !tuh_hid_receive_report(dev_addr, instance) )
     {
-        debug_print("Error: cannot request to receive report");
+        TRACE( TR_HID_RECEIVE_ERROR, dev_addr, instance );
     }
 }
 
@@ -290,118 +433,218 @@ void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t cons
 //--------------------------------------------------------------------+
 static void default_key_down(int scancode, int keysym, int modifiers);
 
-void set_last_key_down( int scancode, int keysym, int modifiers ){
+void set_last_key_down( int scancode, int keysym, int modifiers, uint64_t time_us ){
+   // the last key pressed is the one repeating, the delay starts when the
+   // report was received (not when the event is delivered)
+   stop_key_repeat();
    __last_key_down_scancode = scancode;
    __last_key_down_modifier = modifiers;
-   __last_key_down = board_millis();
-   __last_key_down_resent = 0;
+   if( config.repeat_interval > 0 ){
+     int64_t delay_us = (int64_t)config.repeat_delay*1000 - (int64_t)(time_us_64() - time_us);
+     repeat_alarm = add_alarm_in_us( delay_us>0 ? delay_us : 0, key_repeat_alarm, NULL, true );
+   }
+   if( repeat_alarm < 0 ) // no alarm slot available
+     repeat_alarm = 0;
 }
 
 void clear_last_key_down( int scancode, int keysym, int modifiers ){
+  // releasing another key does not stop the repeat
+  if( scancode != __last_key_down_scancode )
+    return;
+  stop_key_repeat();
   __last_key_down_scancode = 0; // NULL
   __last_key_down_modifier = 0;
 }
 
-// look up new key in previous keys
-static inline bool find_key_in_report(hid_keyboard_report_t const *report, uint8_t keycode) {
-    for(uint8_t i=0; i<6; i++) {
-        if (report->keycode[i] == keycode)
-          return true;
+static int current_modifiers(){
+    // modifiers of all the keyboards (eg: Shift on the keyboard + key on a keypad)
+    uint8_t modifier = 0;
+    for( int i=0; i<KEYBD_MAX_DEVICES; i++ )
+      if( keybd_devices[i].dev_addr != UNDEFINED_ADDR )
+        modifier |= keybd_devices[i].modifier;
+
+    int modifiers = 0;
+    modifiers |= (modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT)) ? WITH_SHIFT : 0;
+    modifiers |= (modifier & KEYBOARD_MODIFIER_RIGHTALT) ? WITH_ALTGR : 0;
+    modifiers |= (modifier & (KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_RIGHTCTRL)) ? WITH_CTRL : 0;
+    modifiers |= capslock_on ? WITH_CAPSLOCK : 0;
+    return modifiers;
+}
+
+static void push_event( uint8_t scancode, bool down, uint64_t time_us ){
+    uint8_t next = (event_head+1) % KEYBD_EVENT_QUEUE;
+    if( next == event_tail ){
+      STATS_INC( key_events_lost );
+      return;
     }
-    return false;
+    keybd_event_t *event = &keybd_events[event_head];
+    event->time_us = time_us;
+    event->scancode = scancode;
+    event->down = down;
+    event->modifiers = current_modifiers();
+    event_head = next;
+}
+
+static void process_keys( keybd_device_t *dev, uint32_t *keys, uint8_t modifier ){
+    // Diff the new key bitmap with the previous one, 32 keys at once.
+    // The releases are queued before the presses (the last key pressed repeats).
+    uint64_t now = time_us_64();
+    dev->modifier = modifier;
+    keys[KEYS_WORDS-1] &= ~0xFF; // 0xE0..0xE7 modifiers come with the modifier byte
+    keys[0] &= ~0x0F;                 // 0x00..0x03 are not keys
+
+    for( int pass=0; pass<2; pass++ ){
+      bool down = (pass==1);
+      for( int w=0; w<KEYS_WORDS; w++ ){
+        uint32_t changed = (keys[w] ^ dev->keys[w]) & (down ? keys[w] : dev->keys[w]);
+        while( changed ){
+          int bit = __builtin_ctz( changed );
+          changed &= changed-1;
+          uint8_t scancode = w*32 + bit;
+          if( down && (scancode == HID_KEY_CAPS_LOCK) )
+            capslock_on = !capslock_on;
+          push_event( scancode, down, now );
+        }
+      }
+    }
+    memcpy( dev->keys, keys, sizeof(dev->keys) );
 }
 
+static void process_kbd_report(keybd_device_t *dev, hid_keyboard_report_t const *report) {
+    // boot report: up to 6 keys down
+    uint32_t keys[KEYS_WORDS] = {0};
+    for(uint8_t i=0; i<6; i++) {
+        uint8_t keycode = report->keycode[i];
+        if( keycode == 0x01 ) // ErrorRollOver: too many keys down, keep the previous state
+          return;
+        keys[keycode>>5] |= 1u << (keycode&31);
+    }
+    process_keys( dev, keys, report->modifier );
+}
 
-static void process_kbd_report(hid_keyboard_report_t const *report) {
-    static hid_keyboard_report_t prev_report = { 0, 0, {0} }; // previous report to check key released
+static uint32_t report_bits( uint8_t const *report, uint16_t len, uint16_t offset, uint8_t size ){
+    // little endian bit field (size <= 8), 0 past the end of the report
+    uint32_t value = 0;
+    for( uint8_t b=0; b<size; b++ ){
+      uint16_t bit = offset + b;
+      if( (bit>>3) < len )
+        value |= ((report[bit>>3] >> (bit&7)) & 1u) << b;
+    }
+    return value;
+}
 
-    //------------- example code ignore control (non-printable) key affects -------------//
-    for(uint8_t i=0; i<6; i++)
-    {
-        if ( report->keycode[i] )
-        {
-
-
-            capslock_key_down_in_this_report = false;
-            for(uint8_t i=0; i<6; i++){
-                if ( find_key_in_report(report, HID_KEY_CAPS_LOCK)){
-                capslock_key_down_in_this_report = true;
-                }
-            }
-            if(capslock_key_down_in_this_report==true && capslock_key_down_in_last_report==false){
-                // toggle the value
-                capslock_on = !capslock_on;
-            }
-
-
-            if ( find_key_in_report(&prev_report, report->keycode[i]) )
-            {
-                // exist in previous report means the current key is holding
-                // Domeu note: Append when keeping "a" pressed & pressing releasing another key.
-                // Domeu note: When holding only the "a" pressed... then nothing happens.
-                //debug_print( "Key Holding");
-            }else
-            {
-                // not existed in previous report means the current key is pressed
-                bool const is_shift = report->modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
-                bool const is_altgr = report->modifier & (KEYBOARD_MODIFIER_RIGHTALT);
-                bool const is_ctrl = report->modifier & (KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_RIGHTCTRL);
-                // capslock_on
-
-                int modifier = 0;
-                modifier = modifier | (is_shift ? WITH_SHIFT : 0);
-                modifier = modifier | (is_altgr ? WITH_ALTGR : 0);
-                modifier = modifier | (is_ctrl ? WITH_CTRL : 0);
-                modifier = modifier | (capslock_on ? WITH_CAPSLOCK : 0);
-
-                //pico_key_down(report->keycode[i], 0, modifier);
-                set_last_key_down( report->keycode[i], 0, modifier );
-                if( key_down_cb != NULL )
-                  key_down_cb( report->keycode[i], 0, modifier );
-                else
-                  default_key_down( report->keycode[i], 0, modifier ); // just add it to caracter buffer
-            }
+static void process_nkro_report(keybd_device_t *dev, uint8_t const *report, uint16_t len) {
+    // Report protocol: key fields located by the report descriptor (bitmaps
+    // and/or arrays of key codes, the modifiers being the usages 0xE0..0xE7)
+    uint32_t keys[KEYS_WORDS] = {0};
+    for( uint8_t f=0; f<dev->key_field_count; f++ ){
+      keybd_field_t *field = &dev->key_fields[f];
+      for( uint8_t i=0; i<field->count; i++ ){
+        uint32_t value = report_bits( report, len, field->bit_offset + i*field->size, field->size );
+        uint32_t usage;
+        if( field->variable ){
+          if( value == 0 )
+            continue;
+          usage = field->usage_min + i;
         }
-        // Check for key depresses (i.e. was present in prev report but not here)
-        if (prev_report.keycode[i]) {
-            // If not present in the current report then depressed
-            if (!find_key_in_report(report, prev_report.keycode[i]))
-            {
-                bool const is_shift = report->modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
-                bool const is_altgr = report->modifier & (KEYBOARD_MODIFIER_RIGHTALT);
-                bool const is_ctrl = report->modifier & (KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_RIGHTCTRL);
-                // capslock_on
-
-                int modifier = 0;
-                modifier = modifier | (is_shift ? WITH_SHIFT : 0);
-                modifier = modifier | (is_altgr ? WITH_ALTGR : 0);
-                modifier = modifier | (is_ctrl ? WITH_CTRL : 0);
-                modifier = modifier | (capslock_on ? WITH_CAPSLOCK : 0);
-
-                //pico_key_up(prev_report.keycode[i], 0, modifier);
-                clear_last_key_down( prev_report.keycode[i], 0, modifier );
-                if( key_up_cb != NULL )
-                  key_up_cb( prev_report.keycode[i], 0, modifier );
-            }
+        else {
+          usage = field->usage_min + (int32_t)value - field->logical_min;
+          if( usage == 0x01 ) // ErrorRollOver: too many keys down, keep the previous state
+            return;
         }
+        if( usage < KEYS_WORDS*32 )
+          keys[usage>>5] |= 1u << (usage&31);
+      }
     }
+    uint8_t modifier = keys[KEYS_WORDS-1] & 0xFF; // 0xE0..0xE7
+    process_keys( dev, keys, modifier );
+}
 
-    /*
-    // synthesize events for modifier keys
-    static const uint8_t mods[] = {
-            KEYBOARD_MODIFIER_LEFTCTRL, SDL_SCANCODE_LCTRL,
-            KEYBOARD_MODIFIER_RIGHTCTRL, SDL_SCANCODE_RCTRL,
-            KEYBOARD_MODIFIER_LEFTALT, SDL_SCANCODE_LALT,
-            KEYBOARD_MODIFIER_RIGHTALT, SDL_SCANCODE_RALT,
-            KEYBOARD_MODIFIER_LEFTSHIFT, SDL_SCANCODE_LSHIFT,
-            KEYBOARD_MODIFIER_RIGHTSHIFT, SDL_SCANCODE_RSHIFT,
-    };
-    for(int i=0;i<count_of(mods); i+= 2) {
-        check_mod(report->modifier, prev_report.modifier, mods[i], mods[i+1]);
+static void parse_key_layout( keybd_device_t *dev, uint8_t const *desc, uint16_t desc_len ){
+    // Locate the Keyboard page input fields of the first report declaring
+    // some (short items only, global state without push/pop).
+    uint16_t usage_page = 0;
+    uint8_t report_size = 0, report_count = 0, report_id = 0;
+    int32_t logical_min = 0;
+    uint16_t usage_min = 0;
+    uint16_t bit_offset = 0; // in the current report
+    dev->key_field_count = 0;
+
+    uint16_t pos = 0;
+    while( pos < desc_len ){
+      uint8_t prefix = desc[pos];
+      if( prefix == 0xFE ){ // long item
+        if( pos+1 >= desc_len )
+          break;
+        pos += 3 + desc[pos+1];
+        continue;
+      }
+      uint8_t size = prefix & 3;
+      if( size == 3 )
+        size = 4;
+      if( pos+1+size > desc_len )
+        break;
+      uint32_t data = 0;
+      for( uint8_t b=0; b<size; b++ )
+        data |= (uint32_t)desc[pos+1+b] << (8*b);
+      int32_t sdata = data; // sign extended (logical minimum)
+      if( (size>0) && (size<4) && (data & (1u << (8*size-1))) )
+        sdata = data - (1 << (8*size));
+      pos += 1 + size;
+
+      switch( prefix & 0xFC ){
+        case 0x04: usage_page = data; break;   // Usage Page
+        case 0x14: logical_min = sdata; break; // Logical Minimum
+        case 0x74: report_size = data; break;  // Report Size
+        case 0x94: report_count = data; break; // Report Count
+        case 0x84:                             // Report ID
+          if( dev->key_field_count > 0 ) // key fields of the previous report: done
+            return;
+          report_id = data;
+          bit_offset = 0;
+          break;
+        case 0x18: usage_min = data; break;    // Usage Minimum
+        case 0x80:                             // Input
+          if( (usage_page == HID_USAGE_PAGE_KEYBOARD) && !(data & 0x01) &&
+              (report_size>0) && (report_size<=8) && (dev->key_field_count < MAX_KEY_FIELDS) ){
+            keybd_field_t *field = &dev->key_fields[dev->key_field_count++];
+            field->bit_offset = bit_offset;
+            field->size = report_size;
+            field->count = report_count;
+            field->usage_min = usage_min;
+            field->logical_min = logical_min;
+            field->variable = (data & 0x02) != 0;
+            dev->key_report_id = report_id;
+          }
+          bit_offset += report_size * report_count;
+          usage_min = 0;
+          break;
+        case 0x90: case 0xB0: case 0xA0: case 0xC0: // Output, Feature, Collections
+          usage_min = 0;
+          break;
+      }
     }
-    */
+}
 
-    prev_report = *report;
+void keybd_task(){
+    // Deliver the key events (all keyboards) in the order they were received.
+    // Must be called from the main loop()
+    while( event_tail != event_head ){
+      keybd_event_t *event = &keybd_events[event_tail];
+      if( event->down ){
+        set_last_key_down( event->scancode, 0, event->modifiers, event->time_us );
+        if( key_down_cb != NULL )
+          key_down_cb( event->scancode, 0, event->modifiers );
+        else
+          default_key_down( event->scancode, 0, event->modifiers ); // just add it to caracter buffer
+      }
+      else {
+        clear_last_key_down( event->scancode, 0, event->modifiers );
+        if( key_up_cb != NULL )
+          key_up_cb( event->scancode, 0, event->modifiers );
+      }
+      event_tail = (event_tail+1) % KEYBD_EVENT_QUEUE;
+    }
 }
 
 bool scancode_is_mod(int scancode) {
@@ -13,7 +13,8 @@
 
 // Keyboard device USB address
 #define UNDEFINED_ADDR  0xFF
-static uint8_t keybd_dev_addr = UNDEFINED_ADDR;
+#define KEYBD_MAX_DEVICES 4   // keyboards & keypads HID interfaces
+#define KEYBD_EVENT_QUEUE 32  // key down/up events waiting for keybd_task()
 
 // Conversion ScanCode -> Ascii
 static uint8_t const keycode2ascii[128][3] =  { PM_KEYCODE_TO_ASCII };
@@ -31,11 +32,20 @@ static key_change_cb_t key_up_cb = NULL;
 // Exported function
 void keybd_init( key_change_cb_t key_down_callback, key_change_cb_t key_up_callback );
 bool keyboard_attached();
+uint8_t keyboard_count();
+void keybd_task();      // deliver the key events, call it from the main loop
 void key_repeat_task();
+void keybd_poll(); // tuh_task + keybd_task + key_repeat_task, for blocking loops
 
 void insert_key_into_buffer(unsigned char ch);
 bool key_ready();
 unsigned char read_key_from_buffer();
 void clear_key_buffer();
 
+#define MENU_KEY_BUFFER 32
+void insert_key_into_menu_buffer(unsigned char ch); // keys for the menus (80 columns)
+bool menu_key_ready();
+unsigned char read_key_from_menu_buffer();
+void clear_menu_key_buffer();
+
 #endif
@@ -5,6 +5,8 @@
 #include <stdbool.h>
 #include "pca9536.h"
 #include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "../common/picoterm_i2c.h" // reg_write & reg_read
 
 #include <stdio.h>
@@ -16,9 +18,112 @@
 #define REG_POLARITY 2
 #define REG_CONFIG   3
 
+/* ==========================================================================
+        Asynchronous output writes
+   --------------------------------------------------------------------------
+   Output changes are queued as complete REG_OUTPUT values. Each write is two
+   bytes (register + value with STOP) pushed into the I2C TX FIFO; the
+   STOP_DET / TX_ABRT interrupt starts the next queued value. The caller never
+   waits on the bus.
+   ========================================================================== */
+
+#define ASYNC_QUEUE_SIZE 8 // power of 2
+
+static i2c_inst_t *async_i2c = NULL;
+static uint8_t output_shadow = 0; // last value queued for REG_OUTPUT
+static uint8_t async_queue[ASYNC_QUEUE_SIZE];
+static volatile uint8_t async_head = 0; // next value to send
+static volatile uint8_t async_tail = 0; // next free slot
+static volatile bool async_busy = false;
+static volatile uint32_t async_errors = 0;
+
+static void async_start_next(){
+  // called with the IRQ masked (or from the IRQ handler)
+  if( async_busy || (async_head == async_tail) )
+    return;
+  i2c_hw_t *hw = i2c_get_hw( async_i2c );
+  uint8_t value = async_queue[async_head];
+  async_head = (async_head + 1) & (ASYNC_QUEUE_SIZE-1);
+  async_busy = true;
+  hw->enable = 0;
+  hw->tar = PCA9536_ADDR;
+  hw->enable = 1;
+  hw->data_cmd = REG_OUTPUT;
+  hw->data_cmd = value | I2C_IC_DATA_CMD_STOP_BITS;
+}
+
+static void async_irq_handler(){
+  i2c_hw_t *hw = i2c_get_hw( async_i2c );
+  uint32_t status = hw->intr_stat;
+  if( status & I2C_IC_INTR_STAT_R_TX_ABRT_BITS ){
+    async_errors++;
+    hw->clr_tx_abrt; // read to clear
+  }
+  if( status & I2C_IC_INTR_STAT_R_STOP_DET_BITS ){
+    hw->clr_stop_det; // read to clear
+    async_busy = false;
+    async_start_next();
+  }
+}
+
+void pca9536_async_init( i2c_inst_t *i2c ){
+  uint8_t data[2];
+  reg_read( i2c, PCA9536_ADDR, REG_OUTPUT, data, 1 );
+  output_shadow = data[0];
+  async_head = async_tail = 0;
+  async_busy = false;
+  async_i2c = i2c;
+
+  uint irq = I2C0_IRQ + i2c_hw_index( i2c );
+  i2c_get_hw( i2c )->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+  irq_set_exclusive_handler( irq, async_irq_handler );
+  irq_set_enabled( irq, true );
+}
+
+void pca9536_async_wait(){
+  // the blocking SDK calls must not interleave with a queued write
+  if( async_i2c == NULL )
+    return;
+  while( async_busy || (async_head != async_tail) )
+    tight_loop_contents();
+}
+
+bool pca9536_output_io_async( uint8_t io, bool value ){
+  if( (io>IO_3) || (async_i2c == NULL) )
+    return false;
+
+  uint32_t irq_state = save_and_disable_interrupts();
+  uint8_t gpio_state = value ? (output_shadow | (1 << io)) : (output_shadow & ~(1 << io));
+  bool queued = true;
+  if( gpio_state != output_shadow ){
+    uint8_t next = (async_tail + 1) & (ASYNC_QUEUE_SIZE-1);
+    uint8_t last = (async_tail - 1) & (ASYNC_QUEUE_SIZE-1);
+    if( async_head != async_tail )
+      // previous value not sent yet: the newest state replaces it
+      async_queue[last] = gpio_state;
+    else if( next != async_head ){
+      async_queue[async_tail] = gpio_state;
+      async_tail = next;
+    }
+    else
+      queued = false;
+    if( queued ){
+      output_shadow = gpio_state;
+      async_start_next();
+    }
+  }
+  restore_interrupts( irq_state );
+  return queued;
+}
+
+uint32_t pca9536_async_errors(){
+  return async_errors;
+}
+
 bool has_pca9536( i2c_inst_t *i2c ){
   // try to read configuration of the PC9536 on the I2C bus. Check for immuable
   // configuration bits
+  pca9536_async_wait(); // the bus must be idle for the blocking transfers
   uint8_t data[6];
   int nb_bytes = reg_read_timeout( i2c, PCA9536_ADDR, REG_INPUT, data, 4, 20000 ); // 20mS
   if(nb_bytes <= 0){
@@ -38,6 +143,7 @@ bool pca9536_setup_io( i2c_inst_t *i2c, uint8_t io, uint8_t io_mode ){
   if( io>IO_3 )
     return false;
 
+  pca9536_async_wait();
   uint8_t data[2];
   reg_read( i2c, PCA9536_ADDR, REG_CONFIG, data, 1 );
 
@@ -60,6 +166,7 @@ bool pca9536_output_io( i2c_inst_t *i2c, uint8_t io, bool value ){
   if( io>IO_3 )
     return false;
 
+  pca9536_async_wait();
   uint8_t data[2];
   reg_read( i2c, PCA9536_ADDR, REG_OUTPUT, data, 1 );
 
@@ -71,11 +178,13 @@ bool pca9536_output_io( i2c_inst_t *i2c, uint8_t io, bool value ){
 
   data[0] = gpio_state;
   reg_write( i2c, PCA9536_ADDR, REG_OUTPUT, data, 1 );
+  output_shadow = gpio_state;
   return true;
 }
 
 bool pca9536_output_reset( i2c_inst_t *i2c, uint8_t mask ){
   /* 4 lower bits of mask indicates which of the output pins should be resetted */
+  pca9536_async_wait();
   uint8_t data[2];
   reg_read( i2c, PCA9536_ADDR, REG_OUTPUT, data, 1 );
 
@@ -87,6 +196,7 @@ bool pca9536_output_reset( i2c_inst_t *i2c, uint8_t mask ){
 
   data[0] = gpio_state;
   reg_write( i2c, PCA9536_ADDR, REG_OUTPUT, data, 1 );
+  output_shadow = gpio_state;
   return true;
 }
 
@@ -95,6 +205,7 @@ bool pca9536_input_io( i2c_inst_t *i2c, uint8_t io ) {
   if( io>IO_3 )
     return false;
 
+  pca9536_async_wait();
   uint8_t data[2];
   reg_read( i2c, PCA9536_ADDR, REG_INPUT, data, 1 );
 
@@ -23,4 +23,9 @@ bool pca9536_output_io( i2c_inst_t *i2c, uint8_t io, bool value ); // set gpio o
 bool pca9536_output_reset( i2c_inst_t *i2c, uint8_t mask ); // reset state of several gpio @ once
 bool pca9536_input_io( i2c_inst_t *i2c, uint8_t io ); // read state an input gpio
 
+void pca9536_async_init( i2c_inst_t *i2c ); // start the IRQ driven output queue (after setup)
+bool pca9536_output_io_async( uint8_t io, bool value ); // queue an output change, never waits on the bus
+void pca9536_async_wait(); // wait for the queued writes to complete
+uint32_t pca9536_async_errors(); // aborted asynchronous writes
+
 #endif
@@ -0,0 +1,142 @@
+/* ==========================================================================
+    Bell & tones (see picoterm_bell.h)
+   ========================================================================== */
+
+#include "picoterm_bell.h"
+#include "picoterm_harddef.h"
+#include "picoterm_stats.h"
+#include "picoterm_boot.h"
+#include "picoterm_i2c.h"
+#include "pca9536.h"
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+#include "hardware/clocks.h"
+
+/* picoterm_i2c.c */
+extern bool i2c_bus_available; // gp26 & gp27 are used as I2C (otherwise as simple GPIO)
+
+typedef struct {
+	uint16_t freq;        // Hz, 0 for a silent note
+	uint8_t  volume;      // 0..7
+	uint16_t duration_ms;
+} bell_note_t;
+
+// DECPS notes 1..25: C5 to C7, equal temperament
+static const uint16_t note_freq[BELL_MAX_NOTE] = {
+	523, 554, 587, 622, 659, 698, 740, 784, 831, 880, 932, 988,
+	1047, 1109, 1175, 1245, 1319, 1397, 1480, 1568, 1661, 1760, 1865, 1976,
+	2093 };
+
+static bell_note_t notes[BELL_NOTES_QUEUE];
+static uint8_t notes_head = 0;
+static uint8_t notes_tail = 0;
+
+static bool bell_pending = false;  // a BEL waits for the buzzer
+enum { BELL_IDLE, BELL_BEEP, BELL_GAP, BELL_NOTE };
+static uint8_t bell_step = BELL_IDLE;
+static uint32_t bell_until_us = 0; // end of the current step
+static bool pwm_active = false;
+
+static bool reached( uint32_t until_us ){
+	return (int32_t)(time_us_32() - until_us) >= 0;
+}
+
+void bell_ring(){
+	// Called by the parser, the buzzer is driven from bell_task()
+	if( bell_pending || (bell_step == BELL_BEEP) || (bell_step == BELL_GAP) ){
+		STATS_INC( bell_merged );
+		return;
+	}
+	bell_pending = true;
+}
+
+void bell_play_note( uint8_t volume, uint8_t duration, uint8_t note ){
+	uint8_t next = (notes_tail + 1) & (BELL_NOTES_QUEUE-1);
+	if( next == notes_head ){
+		STATS_INC( bell_merged ); // queue full, note dropped
+		return;
+	}
+	if( volume > 7 )
+		volume = 7;
+	notes[notes_tail].freq = ((note == 0) || (note > BELL_MAX_NOTE)) ? 0 : note_freq[note-1];
+	notes[notes_tail].volume = volume;
+	notes[notes_tail].duration_ms = ((uint16_t)duration * 1000) / 32;
+	notes_tail = next;
+}
+
+static void buzzer_on( uint16_t freq, uint8_t volume ){
+	if( i2c_bus_available ){
+		pca9536_output_io_async( IO_1, true ); // BuZZER wired on the IO_1 of PCA9536
+		return;
+	}
+	if( freq == 0 ){
+		gpio_put( BUZZER_GPIO, true ); // buzzer Wired directly on GPIO
+		return;
+	}
+	// Square wave, the volume is the duty cycle (7 = 50%)
+	uint32_t div = clock_get_hz( clk_sys ) / ((uint32_t)freq * 65536) + 1;
+	uint32_t wrap = clock_get_hz( clk_sys ) / (div * freq) - 1;
+	uint slice = pwm_gpio_to_slice_num( BUZZER_GPIO );
+	pwm_config config = pwm_get_default_config();
+	pwm_config_set_clkdiv( &config, (float)div );
+	pwm_config_set_wrap( &config, (uint16_t)wrap );
+	pwm_init( slice, &config, false );
+	pwm_set_gpio_level( BUZZER_GPIO, (uint16_t)(((wrap + 1) * volume) / 14) );
+	gpio_set_function( BUZZER_GPIO, GPIO_FUNC_PWM );
+	pwm_set_enabled( slice, true );
+	pwm_active = true;
+}
+
+static void buzzer_off(){
+	if( i2c_bus_available ){
+		pca9536_output_io_async( IO_1, false );
+		return;
+	}
+	if( pwm_active ){
+		pwm_set_enabled( pwm_gpio_to_slice_num( BUZZER_GPIO ), false );
+		gpio_set_function( BUZZER_GPIO, GPIO_FUNC_SIO );
+		pwm_active = false;
+	}
+	gpio_put( BUZZER_GPIO, false );
+}
+
+void bell_task(){
+	if( !boot_io_ready() ) // BUZZER output not configured yet
+		return;
+
+	switch( bell_step ){
+		case BELL_BEEP:
+		case BELL_NOTE:
+			if( !reached( bell_until_us ) )
+				return;
+			buzzer_off();
+			if( bell_step == BELL_BEEP ){
+				bell_step = BELL_GAP;
+				bell_until_us = time_us_32() + BELL_GAP_MS*1000;
+				return;
+			}
+			bell_step = BELL_IDLE;
+			break;
+		case BELL_GAP:
+			if( !reached( bell_until_us ) )
+				return;
+			bell_step = BELL_IDLE;
+			break;
+	}
+
+	// BELL_IDLE: the notes first, in the order received
+	if( notes_head != notes_tail ){
+		bell_note_t *n = &notes[notes_head];
+		notes_head = (notes_head + 1) & (BELL_NOTES_QUEUE-1);
+		if( (n->freq != 0) && (n->volume != 0) )
+			buzzer_on( n->freq, n->volume );
+		bell_step = BELL_NOTE;
+		bell_until_us = time_us_32() + (uint32_t)n->duration_ms*1000;
+	}
+	else if( bell_pending ){
+		bell_pending = false;
+		buzzer_on( 0, 7 );
+		bell_step = BELL_BEEP;
+		bell_until_us = time_us_32() + BELL_BEEP_MS*1000;
+	}
+}
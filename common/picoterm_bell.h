@@ -0,0 +1,32 @@
+/* ==========================================================================
+    Bell & tones (BEL and DECPS)
+
+		The buzzer is either wired on the IO_1 of the PCA9536 (I2C) or
+		directly on BUZZER_GPIO. All the output changes are done from
+		bell_task(), the parser only queues the request:
+		  * BEL : a beep of BELL_BEEP_MS. The BEL received while a beep is
+		    pending, sounding or within BELL_GAP_MS after it are merged into
+		    a single beep (a host flooding BEL never stalls the terminal).
+		  * DECPS (CSI Pvol;Pdur;Pnote;... ,~) : the notes are queued and
+		    played one after the other. The tone is a PWM signal when the
+		    buzzer is on the GPIO; through the PCA9536 only on/off is
+		    possible, so the notes are played as beeps of the same duration.
+   ========================================================================== */
+
+#ifndef _PICOTERM_BELL_H
+#define _PICOTERM_BELL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+#define BELL_BEEP_MS     100 // duration of a BEL
+#define BELL_GAP_MS      100 // silence before the next BEL can start
+#define BELL_NOTES_QUEUE 16  // DECPS notes waiting to be played (power of 2)
+#define BELL_MAX_NOTE    25  // DECPS note 1 = C5 ... 25 = C7, 0 = silent
+
+void bell_ring(); // BEL received
+void bell_play_note( uint8_t volume, uint8_t duration, uint8_t note ); // DECPS, duration in 1/32 s
+void bell_task(); // to be called at each main loop iteration
+
+#endif
@@ -0,0 +1,109 @@
+/* ==========================================================================
+    Built-in micro benchmarks (see the bench CLI command)
+
+		The parser benchmarks feed synthetic streams to terminal_ingest(), so
+		the screen content is lost. The screen is cleared at the end.
+   ========================================================================== */
+
+#include "picoterm_bench.h"
+#include "picoterm_core.h"  // terminal_ingest
+#include "picoterm_conio.h" // clrscr, shuffle_down
+#include "pio_sd.h"
+#include "pca9536.h"
+#include "picoterm_harddef.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <string.h>
+
+/* picoterm_i2c.c */
+extern i2c_inst_t *i2c_bus;
+extern bool i2c_bus_available;
+
+static char bench_stream[BENCH_STREAM_SIZE];
+static uint8_t count;
+
+static void bench_add( bench_result_t *results, const char *name, uint32_t value, const char *unit ){
+	if( count==BENCH_MAX_RESULTS )
+		return;
+	strncpy( results[count].name, name, sizeof(results[count].name)-1 );
+	results[count].name[sizeof(results[count].name)-1] = 0;
+	results[count].value = value;
+	results[count].unit = unit;
+	count++;
+}
+
+static uint16_t bench_fill( const char *pattern ){
+	// repeat the pattern into bench_stream (whole patterns only)
+	uint16_t len = strlen( pattern ), size = 0;
+	while( size+len <= BENCH_STREAM_SIZE ){
+		memcpy( bench_stream+size, pattern, len );
+		size += len;
+	}
+	return size;
+}
+
+static uint32_t bench_parser( const char *pattern ){
+	// bytes/s processed by the escape parser
+	uint16_t size = bench_fill( pattern );
+	uint32_t start = time_us_32();
+	for( int i=0; i<BENCH_STREAM_LOOPS; i++ )
+		terminal_ingest( bench_stream, size );
+	uint32_t elapsed = time_us_32() - start;
+	return elapsed>0 ? ((uint64_t)size*BENCH_STREAM_LOOPS*1000000)/elapsed : 0;
+}
+
+uint8_t bench_run( bench_result_t *results, bool with_sd ){
+	uint32_t start, elapsed, us[8];
+	char name[16];
+	count = 0;
+
+	// Escape parser (text with line feeds, attributes, cursor positioning)
+	bench_add( results, "parser text", bench_parser( "The quick brown fox jumps over the lazy dog 0123456789\r\n" ), "bytes/s" );
+	bench_add( results, "parser sgr", bench_parser( "\x1b[1;7mBold\x1b[0m \x1b[5mBlink\x1b[0m \x1b[4mLine\x1b[0m\r\n" ), "bytes/s" );
+	bench_add( results, "parser csi", bench_parser( "\x1b[10;20H*\x1b[5A\x1b[3C#\x1b[K\x1b[2B\x1b[7D+" ), "bytes/s" );
+	terminal_ingest( "\x1b[0m", 4 );
+
+	// Screen operations
+	start = time_us_32();
+	for( int i=0; i<BENCH_SCROLLS; i++ )
+		shuffle_down();
+	elapsed = time_us_32() - start;
+	bench_add( results, "scroll", elapsed>0 ? ((uint64_t)BENCH_SCROLLS*1000000)/elapsed : 0, "scrolls/s" );
+
+	start = time_us_32();
+	for( int i=0; i<BENCH_CLRSCR; i++ )
+		clrscr();
+	bench_add( results, "clrscr", (time_us_32() - start)/BENCH_CLRSCR, "us" );
+
+	// Rendering
+	uint8_t fonts = bench_fonts( us, 8 );
+	for( int i=0; i<fonts; i++ ){
+		sprintf( name, "build_font %d", i );
+		bench_add( results, name, us[i], "us" );
+	}
+	bench_add( results, "scanline", bench_scanline(), "cycles" );
+
+	// Bell (buzzer on the PCA9536 or directly on a GPIO)
+	start = time_us_32();
+	for( int i=0; i<BENCH_BELL; i++ ){
+		if( i2c_bus_available ){
+			pca9536_output_io( i2c_bus, IO_1, true );
+			pca9536_output_io( i2c_bus, IO_1, false );
+		}
+		else {
+			gpio_put( BUZZER_GPIO, true );
+			gpio_put( BUZZER_GPIO, false );
+		}
+	}
+	bench_add( results, i2c_bus_available ? "bell i2c" : "bell gpio", (time_us_32() - start)/(BENCH_BELL*2), "us" );
+
+	// SD card sequential transfers
+	if( with_sd && sd_bench( BENCH_SD_KB, &us[0], &us[1] ) ){
+		bench_add( results, "sd write", us[0]>0 ? ((uint64_t)BENCH_SD_KB*1000000)/us[0] : 0, "KB/s" );
+		bench_add( results, "sd read", us[1]>0 ? ((uint64_t)BENCH_SD_KB*1000000)/us[1] : 0, "KB/s" );
+	}
+
+	clrscr();
+	move_cursor_home();
+	return count;
+}
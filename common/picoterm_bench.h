@@ -0,0 +1,37 @@
+/* ==========================================================================
+    Built-in micro benchmarks (see the bench CLI command)
+
+		Each benchmark produces one or more results (name, value, unit) so the
+		figures can be compared from one release to the other.
+
+		The font & scanline benchmarks are target specific (see main.c).
+   ========================================================================== */
+
+#ifndef _PICOTERM_BENCH_H
+#define _PICOTERM_BENCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BENCH_MAX_RESULTS  16
+#define BENCH_STREAM_SIZE  2048 // synthetic host stream given to the parser
+#define BENCH_STREAM_LOOPS 8    // the stream is parsed 8 times
+#define BENCH_SCROLLS      200
+#define BENCH_CLRSCR       20
+#define BENCH_SCANLINES    480
+#define BENCH_BELL         20
+#define BENCH_SD_KB        256
+
+typedef struct BenchResult {
+	char name[16];
+	uint32_t value;
+	const char *unit;
+} bench_result_t;
+
+uint8_t bench_run( bench_result_t *results, bool with_sd ); // BENCH_MAX_RESULTS entries, returns the count
+
+// Implemented by the target (main.c)
+uint8_t bench_fonts( uint32_t *us, uint8_t max ); // build_font() time per font, returns the font count
+uint32_t bench_scanline(); // clk_sys cycles to render a scanline (average)
+
+#endif
@@ -0,0 +1,119 @@
+/* ==========================================================================
+    Boot sequence & timeline (see picoterm_boot.h)
+   ========================================================================== */
+
+#include "picoterm_boot.h"
+#include "picoterm_harddef.h"
+#include "picoterm_debug.h"
+#include "picoterm_i2c.h"
+#include "pca9536.h"
+#include "pio_sd.h"
+#include "pico/scanvideo.h"
+#include <stdio.h>
+
+/* picoterm_i2c.c */
+extern bool i2c_bus_available; // gp26 & gp27 are used as I2C (otherwise as simple GPIO)
+extern i2c_inst_t *i2c_bus;
+
+typedef struct {
+	const char *phase;
+	uint32_t time_us; // since reset
+} boot_mark_t;
+
+static boot_mark_t boot_marks[BOOT_MAX_MARKS];
+static uint8_t boot_mark_count = 0;
+
+enum { BOOT_FIRST_FRAME, BOOT_IO_PROBE, BOOT_SD_MOUNT, BOOT_DONE };
+static uint8_t boot_step = BOOT_FIRST_FRAME;
+
+void boot_mark( const char *phase ){
+	if( boot_mark_count >= BOOT_MAX_MARKS )
+		return;
+	boot_marks[boot_mark_count].phase = phase;
+	boot_marks[boot_mark_count].time_us = time_us_32();
+	boot_mark_count++;
+}
+
+static void probe_io_expander(){
+  // Checking GP26 & GP27 will be handled as GPIO or I2C bus (with PCA9536 see issue #21)
+  // Then initialize the IO for USB_POWER &
+  i2c_bus_available = false;
+  debug_print( "Check I2C capability on GP26, GP27" );
+  init_i2c_bus(); // try to initialize the PicoTerm I2C bus
+  if( has_pca9536( i2c_bus ) ){
+    debug_print( "pca9536 detected!" );
+    i2c_bus_available = true;
+    pca9536_output_reset( i2c_bus, 0b0011 ); // preinitialize output at LOW
+    pca9536_setup_io( i2c_bus, IO_0, IO_MODE_OUT ); // USB_POWER
+    pca9536_setup_io( i2c_bus, IO_1, IO_MODE_OUT ); // BUZZER
+    pca9536_setup_io( i2c_bus, IO_2, IO_MODE_IN ); // not used yet
+    pca9536_setup_io( i2c_bus, IO_3, IO_MODE_IN ); // not used yet
+    pca9536_async_init( i2c_bus ); // bell & USB power writes no longer wait on the bus
+  }
+  // check other I2C GPIO expander here!
+
+  if( i2c_bus_available )
+    debug_print( "I2C bus detected on GP26, GP27" );
+
+  if( !i2c_bus_available ){
+    debug_print( "Using GPIO capability on GP26, GP27" );
+    deinit_i2c_bus();
+
+    gpio_init(USB_POWER_GPIO); // GPIO 26
+    gpio_set_dir(USB_POWER_GPIO, GPIO_OUT);
+    gpio_put(USB_POWER_GPIO,false);
+
+    gpio_init(BUZZER_GPIO);
+    gpio_set_dir(BUZZER_GPIO, GPIO_OUT);
+    gpio_put(BUZZER_GPIO,false);
+  }
+}
+
+void boot_task(){
+	switch( boot_step ){
+		case BOOT_FIRST_FRAME:
+			// a frame completed since the video started
+			if( scanvideo_frame_number( scanvideo_get_next_scanline_id() ) == 0 )
+				return;
+			boot_mark( "first frame" );
+			boot_step = BOOT_IO_PROBE;
+			break;
+		case BOOT_IO_PROBE:
+			probe_io_expander(); // up to 20 ms without PCA9536
+			boot_mark( i2c_bus_available ? "I/O probe (I2C)" : "I/O probe (GPIO)" );
+			boot_step = BOOT_SD_MOUNT;
+			break;
+		case BOOT_SD_MOUNT:
+			if( !sd_powered_up() ) // card power up delay after spi_sd_init()
+				return;
+			boot_mark( sd_mount() ? "SD mount" : "SD mount (failed)" );
+			boot_step = BOOT_DONE;
+			for( int i=0; i<boot_mark_count; i++ ){
+				sprintf( debug_msg, "boot: %s at %lu us", boot_marks[i].phase, boot_marks[i].time_us );
+				debug_print( debug_msg );
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+bool boot_io_ready(){
+	return boot_step > BOOT_IO_PROBE;
+}
+
+bool boot_done(){
+	return boot_step == BOOT_DONE;
+}
+
+void boot_print( void (*print)( char str[] ) ){
+	char msg[60];
+	uint32_t last = 0;
+	for( int i=0; i<boot_mark_count; i++ ){
+		sprintf( msg, "%-18s : %8lu us (+%lu)\r\n", boot_marks[i].phase, boot_marks[i].time_us, boot_marks[i].time_us - last );
+		print( msg );
+		last = boot_marks[i].time_us;
+	}
+	if( !boot_done() )
+		print( "(boot in progress)\r\n" );
+}
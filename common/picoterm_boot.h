@@ -0,0 +1,30 @@
+/* ==========================================================================
+    Boot sequence & timeline (see the boot CLI command)
+
+		main() only brings up what is needed to show the host output: config,
+		UART, terminal and video. The slow probes run afterwards from the main
+		loop (boot_task), one step per iteration:
+		  * wait the first frame (display on screen)
+		  * probe the PCA9536 expander on GP26 & GP27 (otherwise simple GPIO)
+		  * mount the SD card once powered up (and load the hotkeys)
+
+		Each phase is closed by boot_mark(), the time since the reset is
+		recorded in microseconds.
+   ========================================================================== */
+
+#ifndef _PICOTERM_BOOT_H
+#define _PICOTERM_BOOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+#define BOOT_MAX_MARKS 16
+
+void boot_mark( const char *phase ); // end of a phase of the boot
+void boot_task(); // background probes, to be called at each main loop iteration
+bool boot_io_ready(); // USB_POWER & BUZZER outputs configured (I2C or GPIO)
+bool boot_done();
+void boot_print( void (*print)( char str[] ) ); // timeline, one phase per line
+
+#endif
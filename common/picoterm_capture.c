@@ -0,0 +1,206 @@
+/* ==========================================================================
+    Capture of the host stream to the SD card.
+
+		The UART RX IRQ (see main.c::on_uart_rx) calls capture_byte() for each
+		received byte. The bytes are stored into the "fill" buffer; once full,
+		the IRQ switches to the other buffer and capture_task() writes the full
+		one to the file. A partial buffer is also written when the host stays
+		silent for CAPTURE_IDLE_MS (so the file is up to date on idle).
+
+		The buffers are always written in the order they were filled (write_idx).
+   ========================================================================== */
+
+#include "picoterm_capture.h"
+#include "pio_sd.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include <stdio.h>
+#include <string.h>
+#include "../pio_fatfs/ff.h"
+#include "picoterm_debug.h"
+#include "picoterm_trace.h"
+
+static FIL capture_file;
+static char capture_name[CAPTURE_NAME_SIZE];
+static char capture_buffer[2][CAPTURE_BUFFER_SIZE];
+static volatile uint16_t capture_len[2];  // bytes stored into each buffer
+static volatile bool capture_full[2];     // waiting to be written to the SD
+static volatile uint8_t fill_idx = 0;     // buffer filled by the IRQ
+static uint8_t write_idx = 0;             // next buffer to write (oldest one)
+static volatile bool capturing = false;
+static uint32_t idle_received = 0;        // stats.received at the last check
+static uint32_t idle_since = 0;           // ms
+static capture_stats_t stats;
+static volatile uint8_t pending_request = CAPTURE_REQ_NONE;
+
+void capture_byte( char ch ){
+	// Called from the UART RX IRQ, must stay short.
+	if( !capturing )
+		return;
+	uint8_t idx = fill_idx;
+	if( capture_full[idx] ){
+		stats.dropped++; // the SD did not keep up
+		return;
+	}
+	capture_buffer[idx][capture_len[idx]++] = ch;
+	stats.received++;
+	if( capture_len[idx] == CAPTURE_BUFFER_SIZE ){
+		capture_full[idx] = true;
+		fill_idx = 1-idx;
+	}
+}
+
+static bool capture_write( uint8_t idx ){
+	// write the buffer idx to the file then give it back to the IRQ
+	UINT bw;
+	uint32_t start = time_us_32();
+	FRESULT fr = f_write( &capture_file, capture_buffer[idx], capture_len[idx], &bw );
+	uint32_t elapsed = time_us_32() - start;
+
+	if( elapsed > stats.max_write_us )
+		stats.max_write_us = elapsed;
+	stats.flushes++;
+	stats.written += bw;
+	capture_len[idx] = 0;
+	capture_full[idx] = false;
+	write_idx = 1-idx;
+	if( (fr != FR_OK) || (bw == 0) ){ // see FRESULT in ff.h
+			TRACE( TR_CAPTURE_WRITE_ERROR, fr, 0 );
+			return false;
+	}
+	return true;
+}
+
+static void capture_release_fill(){
+	// hand over the partially filled buffer to the writer
+	uint32_t status = save_and_disable_interrupts();
+	uint8_t idx = fill_idx;
+	if( (idx == write_idx) && !capture_full[idx] && (capture_len[idx] > 0) ){
+		capture_full[idx] = true;
+		fill_idx = 1-idx;
+	}
+	restore_interrupts( status );
+}
+
+bool capture_start( char *filename ){
+	// Open the file (append mode) and start recording the received bytes.
+	FRESULT fr;
+
+	if( capturing ){
+		debug_print( "capture: already running" );
+		return false;
+	}
+	if( !is_sd_mount() ) // will attempt to remount
+		return false;
+
+	if( filename==NULL ){
+		if( !sd_next_name( capture_name, "cap", "log" ) ){
+			debug_print( "capture: no free capNNN.log name" );
+			return false;
+		}
+	}
+	else {
+		strncpy( capture_name, filename, CAPTURE_NAME_SIZE-1 );
+		capture_name[CAPTURE_NAME_SIZE-1] = 0;
+	}
+
+	fr = f_open( &capture_file, capture_name, FA_WRITE | FA_OPEN_APPEND );
+	if (fr != FR_OK) { // see FRESULT in ff.h
+			sprintf( debug_msg, "capture: open error %d on %s", fr, capture_name );
+			debug_print( debug_msg );
+			return false;
+	}
+
+	memset( &stats, 0, sizeof(stats) );
+	capture_len[0] = 0;
+	capture_len[1] = 0;
+	capture_full[0] = false;
+	capture_full[1] = false;
+	fill_idx = 0;
+	write_idx = 0;
+	idle_received = 0;
+	idle_since = to_ms_since_boot( get_absolute_time() );
+	capturing = true;
+
+	sprintf( debug_msg, "capture: started into %s", capture_name );
+	debug_print( debug_msg );
+	return true;
+}
+
+void capture_stop(){
+	if( !capturing )
+		return;
+	capturing = false; // the IRQ stops filling
+
+	// write the pending buffers in order, including the partial one
+	for( int i=0; i<2; i++ ){
+		capture_release_fill();
+		if( capture_full[write_idx] )
+			capture_write( write_idx );
+	}
+	f_close( &capture_file );
+
+	sprintf( debug_msg, "capture: %lu bytes written to %s, %lu dropped", stats.written, capture_name, stats.dropped );
+	debug_print( debug_msg );
+}
+
+void capture_request( uint8_t request ){
+	// only raise the request, can be called from the parser or the USB stack
+	pending_request = request;
+}
+
+bool is_capturing(){
+	return capturing;
+}
+
+void capture_task(){
+	// start/stop requested by the hotkey or the host (see capture_request)
+	uint8_t request = pending_request;
+	if( request != CAPTURE_REQ_NONE ){
+		pending_request = CAPTURE_REQ_NONE;
+		if( (request==CAPTURE_REQ_START) || ((request==CAPTURE_REQ_TOGGLE) && !capturing) )
+			capture_start( NULL ); // next free capNNN.log
+		else
+			capture_stop();
+		return;
+	}
+
+	if( !capturing )
+		return;
+
+	// release the partial buffer when the host is silent
+	uint32_t now = to_ms_since_boot( get_absolute_time() );
+	uint32_t received = stats.received;
+	if( received != idle_received ){
+		idle_received = received;
+		idle_since = now;
+	}
+	else if( (now - idle_since) >= CAPTURE_IDLE_MS ){
+		capture_release_fill();
+		idle_since = now;
+		if( capture_full[write_idx] ){
+			if( capture_write( write_idx ) )
+				f_sync( &capture_file ); // file consistent while idle
+			else {
+				capture_stop();
+				sd_unmount(); // card removed? force a remount on next access
+			}
+		}
+		return;
+	}
+
+	// one buffer per call, keep the main loop responsive
+	if( capture_full[write_idx] )
+		if( !capture_write( write_idx ) ){
+			capture_stop();
+			sd_unmount();
+		}
+}
+
+char *capture_filename(){
+	return capture_name;
+}
+
+capture_stats_t *capture_stats(){
+	return &stats;
+}
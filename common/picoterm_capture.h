@@ -0,0 +1,46 @@
+/* ==========================================================================
+    Capture of the host stream to the SD card.
+
+		Every byte received on the UART is copied (from the RX IRQ) into two
+		RAM buffers used in ping-pong. capture_task() writes the full buffers
+		to the SD card from the main loop, so the parser never waits on the
+		card. When both buffers are full, the bytes are dropped and counted.
+
+		The parser and the USB callbacks only post a request (capture_request)
+		since starting and stopping access the card.
+   ========================================================================== */
+
+#ifndef _PICOTERM_CAPTURE_H
+#define _PICOTERM_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CAPTURE_BUFFER_SIZE  2048 // size of each of the 2 RAM buffers (4 sectors)
+#define CAPTURE_IDLE_MS      1000 // flush a partial buffer when the host is silent
+#define CAPTURE_NAME_SIZE    16
+#define CAPTURE_PRIVATE_MODE 7730 // ESC [ ? 7730 h : start, ESC [ ? 7730 l : stop
+
+typedef struct CaptureStats {
+	uint32_t received;     // bytes stored into the RAM buffers
+	uint32_t written;      // bytes written to the SD card
+	uint32_t dropped;      // bytes lost (both buffers full)
+	uint32_t flushes;      // count of f_write()
+	uint32_t max_write_us; // slowest f_write()
+} capture_stats_t;
+
+bool capture_start( char *filename ); // NULL for the next free capNNN.log
+void capture_stop();    // flush the buffers and close the file
+#define CAPTURE_REQ_NONE   0
+#define CAPTURE_REQ_START  1
+#define CAPTURE_REQ_STOP   2
+#define CAPTURE_REQ_TOGGLE 3
+
+void capture_request( uint8_t request ); // hotkey & escape sequence, performed by capture_task()
+bool is_capturing();
+void capture_task();    // to be called from the main loop
+void capture_byte( char ch ); // called from the UART RX IRQ
+char *capture_filename();
+capture_stats_t *capture_stats();
+
+#endif
@@ -2,11 +2,47 @@
 #include "picoterm_debug.h"
 #include "string.h"
 #include <stdio.h>
+#include <stddef.h>
+#include <assert.h>
 #include "picoterm_stddef.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+
+/* ==========================================================================
+     Configuration log
+   ==========================================================================
+   The config is appended as one record per flash page in a log spread over
+   CONFIG_LOG_SECTORS sectors. The record with the highest sequence number
+   and a valid CRC is the current config. A save programs a single page; a
+   sector is only erased when the log wraps into it (its records are older
+   than the ones of the previous sectors). A write interrupted by a power
+   loss leaves a bad CRC and the previous record is used.
+   Formerly, the config was stored as is at the start of the first sector
+   (see is_legacy_config): it is still read until the first save. */
+
+#define CONFIG_LOG_MAGIC 0x474C4350 // "PCLG"
+#define CONFIG_LOG_SLOTS_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define CONFIG_LOG_SLOTS (CONFIG_LOG_SECTORS * CONFIG_LOG_SLOTS_PER_SECTOR)
+#define CONFIG_LOG_DATA_SIZE (FLASH_PAGE_SIZE - 16)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;   // incremented at each save
+  uint16_t size;  // sizeof(picoterm_config_t) when written
+  uint16_t reserved;
+  uint8_t data[CONFIG_LOG_DATA_SIZE];
+  uint32_t crc;   // crc32 of the record up to this field
+} config_record_t;
+
+static_assert( sizeof(config_record_t) == FLASH_PAGE_SIZE, "config record must fill one flash page" );
+static_assert( sizeof(picoterm_config_t) <= CONFIG_LOG_DATA_SIZE, "config too big for a record" );
 
 // once written, we can access our data at flash_target_contents
 const uint8_t *flash_target_contents = (const uint8_t *) (XIP_BASE + FLASH_TARGET_OFFSET);
 
+static int log_last_slot = -1;  // slot of the current config (-1 = none)
+static uint32_t log_last_seq = 0;
+
 picoterm_config_t config; // Issue #13, awesome contribution of Spock64
 
 void debug_print_config( struct PicotermConfig *c );
@@ -46,7 +82,13 @@ void set_default_config( struct PicotermConfig *c ){
 	c->font_id = FONT_ASCII; // current font to use
 	// version 4
 	c->graph_id = FONT_NUPETSCII_MONO8; // prefered graphical font.
-
+	// version 5
+	c->char_delay = 1000; // same throughput as the former 1ms/char pacing
+	c->line_delay = 0;
+	c->flow_control = 0;
+	// version 6
+	c->repeat_delay = 500;
+	c->repeat_interval = 50;
 }
 
 void upgrade_config( struct PicotermConfig *c ){
@@ -70,6 +112,19 @@ void upgrade_config( struct PicotermConfig *c ){
     // Ok for version 4
     c->version  = 4;
   }
+	if( c->version == 4 ){ // Upgrade to version 5 with defaults
+		c->char_delay = 1000;
+		c->line_delay = 0;
+		c->flow_control = 0;
+		// Ok for version 5
+		c->version  = 5;
+	}
+	if( c->version == 5 ){ // Upgrade to version 6 with defaults
+		c->repeat_delay = 500;
+		c->repeat_interval = 50;
+		// Ok for version 6
+		c->version  = 6;
+	}
 	// Small sanity check
 	// if graphical ANSI font activated (in saved data), just override it with
 	// the currently graphical ANSI font selected by the user.
@@ -77,22 +132,89 @@ void upgrade_config( struct PicotermConfig *c ){
 		c->font_id = c->graph_id;
 
   /*
-  if( c->version == 4 ){ // Upgrade to version 5 with defaults
+  if( c->version == 6 ){ // Upgrade to version 7 with defaults
     // blabla
-    c->version  = 5;
+    c->version  = 7;
   }
   */
 }
 
+static uint32_t crc32( const uint8_t *data, size_t len ){
+  uint32_t crc = 0xFFFFFFFF;
+  for( size_t i=0; i<len; i++ ){
+    crc ^= data[i];
+    for( int bit=0; bit<8; bit++ )
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static const config_record_t *log_record( int slot ){
+  return (const config_record_t *)(flash_target_contents + slot*FLASH_PAGE_SIZE);
+}
+
+static bool is_record_valid( const config_record_t *r ){
+  return (r->magic == CONFIG_LOG_MAGIC) && (r->size <= CONFIG_LOG_DATA_SIZE) &&
+         (r->crc == crc32( (const uint8_t *)r, offsetof(config_record_t, crc) ));
+}
+
+static bool is_slot_blank( int slot ){
+  const uint32_t *p = (const uint32_t *)log_record( slot );
+  for( int i=0; i<FLASH_PAGE_SIZE/4; i++ )
+    if( p[i] != 0xFFFFFFFF )
+      return false;
+  return true;
+}
+
+static void scan_config_log(){
+  /* locate the newest valid record of the log */
+  log_last_slot = -1;
+  log_last_seq = 0;
+  for( int slot=0; slot<CONFIG_LOG_SLOTS; slot++ ){
+    const config_record_t *r = log_record( slot );
+    if( is_record_valid(r) && ((log_last_slot<0) || (r->seq > log_last_seq)) ){
+      log_last_slot = slot;
+      log_last_seq = r->seq;
+    }
+  }
+}
+
+static bool is_legacy_config(){
+  /* config written as is at the start of the first sector (before the log) */
+  return strncmp( (const char *)flash_target_contents, MAGIC_KEY, sizeof(MAGIC_KEY) )==0;
+}
+
+static void flash_op( bool erase, uint32_t offset, const uint8_t *data ){
+  /* Core 1 runs from the XIP flash too: it is parked in RAM by the multicore
+     lockout (when rendering) while the flash is not readable. */
+  bool lockout = multicore_lockout_victim_is_initialized( 1 );
+  if( lockout )
+    multicore_lockout_start_blocking();
+  uint32_t ints = save_and_disable_interrupts();
+  if( erase )
+    flash_range_erase( offset, FLASH_SECTOR_SIZE );
+  else
+    flash_range_program( offset, data, FLASH_PAGE_SIZE );
+  restore_interrupts( ints );
+  if( lockout )
+    multicore_lockout_end_blocking();
+}
+
 bool is_config_in_flash(){
-  /* Check if the magic key is present in flash */
-  struct PicotermConfig _c;
-  read_config_from_flash( &_c );
-  return strncmp( _c.magic_key, MAGIC_KEY, sizeof(MAGIC_KEY) )==0;
+  /* Check if a config record (or the former config) is present in flash */
+  scan_config_log();
+  return (log_last_slot >= 0) || is_legacy_config();
 }
 
 void read_config_from_flash( struct PicotermConfig *c ){
-    memcpy( c, flash_target_contents, sizeof(struct PicotermConfig) );
+    if( log_last_slot >= 0 ){
+      const config_record_t *r = log_record( log_last_slot );
+      // a record written by a former version is shorter: upgrade_config() fills the new fields
+      memset( c, 0, sizeof(struct PicotermConfig) );
+      memcpy( c, r->data, r->size < sizeof(struct PicotermConfig) ? r->size : sizeof(struct PicotermConfig) );
+    }
+    else
+      memcpy( c, flash_target_contents, sizeof(struct PicotermConfig) );
     upgrade_config( c );
 }
 
@@ -115,18 +237,44 @@ void debug_print_config( struct PicotermConfig *c ){
 	sprintf( debug_msg, "  font_id=%u", c->font_id );
   debug_print( debug_msg );
 	sprintf( debug_msg, "  graph_id=%u", c->graph_id );
+  debug_print( debug_msg );
+	sprintf( debug_msg, "  char_delay=%u us, line_delay=%u ms, flow_control=%u", c->char_delay, c->line_delay, c->flow_control );
+  debug_print( debug_msg );
+	sprintf( debug_msg, "  repeat_delay=%u ms, repeat_interval=%u ms", c->repeat_delay, c->repeat_interval );
   debug_print( debug_msg );
 }
 
 void write_config_to_flash( struct PicotermConfig *c ){
-   /* unsafe if you have two cores concurrently executing from flash
-     https://raspberrypi.github.io/pico-sdk-doxygen/group__hardware__flash.html */
     debug_print("write_config_to_flash()");
     debug_print_config( c );
-    uint8_t data_to_write[FLASH_PAGE_SIZE];
-    memcpy( data_to_write, c, sizeof(struct PicotermConfig) );
+    scan_config_log(); // the config may be saved without being loaded (boot buttons)
+    config_record_t record;
+    memset( &record, 0xFF, sizeof(record) );
+    record.magic = CONFIG_LOG_MAGIC;
+    record.seq = log_last_seq + 1;
+    record.size = sizeof(struct PicotermConfig);
+    record.reserved = 0;
+    memcpy( record.data, c, sizeof(struct PicotermConfig) );
+    record.crc = crc32( (const uint8_t *)&record, offsetof(config_record_t, crc) );
 
-    flash_range_erase(FLASH_TARGET_OFFSET, FLASH_SECTOR_SIZE);
-    flash_range_program(FLASH_TARGET_OFFSET, data_to_write, FLASH_PAGE_SIZE);
+    // append after the current record. Entering a sector recycles it (erase),
+    // a dirty slot (interrupted write, former config) is skipped.
+    int slot = (log_last_slot + 1) % CONFIG_LOG_SLOTS;
+    while( (slot % CONFIG_LOG_SLOTS_PER_SECTOR != 0) && !is_slot_blank(slot) )
+      slot = (slot + 1) % CONFIG_LOG_SLOTS;
+    if( slot % CONFIG_LOG_SLOTS_PER_SECTOR == 0 ){
+      sprintf( debug_msg, "  erase config sector %u", slot / CONFIG_LOG_SLOTS_PER_SECTOR );
+      debug_print( debug_msg );
+      flash_op( true, FLASH_TARGET_OFFSET + slot*FLASH_PAGE_SIZE, NULL );
+    }
+    flash_op( false, FLASH_TARGET_OFFSET + slot*FLASH_PAGE_SIZE, (const uint8_t *)&record );
 
+    if( is_record_valid( log_record(slot) ) ){
+      log_last_slot = slot;
+      log_last_seq = record.seq;
+      sprintf( debug_msg, "  config record %lu written in slot %u", record.seq, slot );
+    }
+    else
+      sprintf( debug_msg, "  config record %lu verify error in slot %u", record.seq, slot );
+    debug_print( debug_msg );
 }
@@ -11,8 +11,9 @@
 #include "hardware/uart.h"
 
 #define FLASH_TARGET_OFFSET (256 * 1024)  // from start of flash
+#define CONFIG_LOG_SECTORS 4 // config records appended over 4 sectors (wear levelling)
 #define MAGIC_KEY "PTCFG\0"
-#define CONFIG_VERSION 4
+#define CONFIG_VERSION 6
 
 #define WHITE 0
 #define LIGHTAMBER 1
@@ -43,6 +44,15 @@ typedef struct PicotermConfig {
 	uint8_t font_id;
 	// version 4
 	uint8_t graph_id;  // ANSI Font_ID to use when switching to graphical ANSI font.
+	// version 5
+	//    Pacing of the file streamed to the host (send_file, hotkeys).
+	uint16_t char_delay;  // micro-seconds between two chars sent (0 = none)
+	uint16_t line_delay;  // milli-seconds after each end-of-line sent (0 = none)
+	uint8_t flow_control; // 1 = honor XON/XOFF sent back by the host
+	// version 6
+	//    Keyboard repeat (timed by a hardware alarm, see keybd.c)
+	uint16_t repeat_delay;    // ms before a key held down starts repeating
+	uint16_t repeat_interval; // ms between two repeats (0 = no repeat)
 } picoterm_config_t; // Issue #13, conversion to typedef required, awesome contribution of Spock64
 
 void load_config(); // try to load config otherwise init with defaults
@@ -16,6 +16,7 @@ typedef struct picoterm_conio_config {
   uint8_t dec_mode; // current DEC mode (ligne drawing single/double/none)
   uint8_t ansi_font_id; // ID of the ANSI Graphical font to use
   cursor_term_t cursor; // full definition of a terminal cursor
+  uint32_t scroll_count; // count of screen scroll since boot
 } picoterm_conio_config_t;
 
 
@@ -1,24 +1,145 @@
 #include "picoterm_harddef.h" // Hardware definition
 #include "picoterm_debug.h"
+#include "pio_sd.h" // SD_DMA_VIDEO_MASK
 #include "uart_tx.pio.h"
+#include "hardware/dma.h"
+#include "pico/sync.h"
 #include <stdio.h>
+#include <string.h>
 #include <stdarg.h>
 
 static PIO pio = pio1;
 static uint sm = 0;
 static uint offset = (uint)NULL;
 
+static int dma_chan = -1; // -1: no channel, blocking output
+static critical_section_t debug_cs; // writers on both cores & IRQs
+static uint8_t debug_ring[DEBUG_RING_SIZE];
+static volatile uint32_t ring_head = 0; // bytes written (free running)
+static volatile uint32_t ring_tail = 0; // bytes sent
+static uint32_t dma_count = 0;          // bytes of the running transfer
+static uint32_t lost = 0;
+static debug_monitor_t monitor = NULL; // copy of the text messages
+
+static void debug_kick(){
+	/* With debug_cs held: account the finished transfer, start the next one
+	   from the tail up to the head or the end of the ring. */
+	if( dma_channel_is_busy(dma_chan) )
+		return;
+	ring_tail += dma_count;
+	dma_count = 0;
+	uint32_t pending = ring_head - ring_tail;
+	if( pending == 0 )
+		return;
+	uint32_t pos = ring_tail & (DEBUG_RING_SIZE-1);
+	dma_count = pending < DEBUG_RING_SIZE-pos ? pending : DEBUG_RING_SIZE-pos;
+	dma_channel_transfer_from_buffer_now( dma_chan, &debug_ring[pos], dma_count );
+}
+
+static bool debug_put( const uint8_t *data, uint32_t size ){
+	// copy all the bytes into the ring or none
+	if( dma_chan < 0 ){
+		for( uint32_t i=0; i<size; i++ )
+			uart_tx_program_putc( pio, sm, data[i] );
+		return true;
+	}
+	critical_section_enter_blocking( &debug_cs );
+	bool ok = (DEBUG_RING_SIZE - (ring_head - ring_tail)) >= size;
+	if( ok ){
+		for( uint32_t i=0; i<size; i++ )
+			debug_ring[(ring_head+i) & (DEBUG_RING_SIZE-1)] = data[i];
+		ring_head += size;
+		debug_kick();
+	}
+	else
+		lost++;
+	critical_section_exit( &debug_cs );
+	return ok;
+}
+
 void debug_init(){
 	offset = pio_add_program(pio, &uart_tx_program);
 	uart_tx_program_init(pio, sm, offset, DEBUG_TX, DEBUG_BAUD);
 	uart_tx_program_puts(pio, sm, "\r\n\r\nPicoTerm Debug UART initialized\r\n");
+
+	// scanvideo claims fixed channels when the video starts: keep them free
+	// (same as spi_sd_init)
+	uint32_t reserved = 0;
+	for( uint ch=0; ch<NUM_DMA_CHANNELS; ch++ )
+		if( (SD_DMA_VIDEO_MASK & (1u<<ch)) && !dma_channel_is_claimed(ch) )
+			reserved |= (1u<<ch);
+	dma_claim_mask( reserved );
+	dma_chan = dma_claim_unused_channel( false );
+	for( uint ch=0; ch<NUM_DMA_CHANNELS; ch++ )
+		if( reserved & (1u<<ch) )
+			dma_channel_unclaim( ch );
+	if( dma_chan < 0 ){
+		uart_tx_program_puts(pio, sm, "Debug: no DMA channel, blocking output\r\n");
+		return;
+	}
+	critical_section_init( &debug_cs );
+	dma_channel_config c = dma_channel_get_default_config( dma_chan );
+	channel_config_set_transfer_data_size( &c, DMA_SIZE_8 ); // replicated on the 32 bits of the FIFO
+	channel_config_set_read_increment( &c, true );
+	channel_config_set_write_increment( &c, false );
+	channel_config_set_dreq( &c, pio_get_dreq(pio, sm, true) );
+	dma_channel_configure( dma_chan, &c, &pio->txf[sm], debug_ring, 0, false );
 }
 
 void debug_print( const char *s ){
-	uart_tx_program_puts(pio, sm, s );
-	uart_tx_program_puts(pio, sm, "\r\n");
+	// message and CR/LF are kept together
+	char line[sizeof(debug_msg)+2];
+	size_t len = strlen( s );
+	if( len > sizeof(debug_msg) ){
+		if( monitor != NULL ){
+			monitor( (const uint8_t *)s, len );
+			monitor( (const uint8_t *)"\r\n", 2 );
+		}
+		debug_put( (const uint8_t *)s, len );
+		debug_put( (const uint8_t *)"\r\n", 2 );
+		return;
+	}
+	memcpy( line, s, len );
+	memcpy( line+len, "\r\n", 2 );
+	if( monitor != NULL )
+		monitor( (const uint8_t *)line, len+2 );
+	debug_put( (const uint8_t *)line, len+2 );
 }
 
 void debug_write( const char *s ){
-	uart_tx_program_puts(pio, sm, s );
+	if( monitor != NULL )
+		monitor( (const uint8_t *)s, strlen(s) );
+	debug_put( (const uint8_t *)s, strlen(s) );
+}
+
+void debug_set_monitor( debug_monitor_t callback ){
+	monitor = callback;
+}
+
+bool debug_write_frame( const uint8_t *data, uint8_t size ){
+	uint8_t frame[1+DEBUG_FRAME_MAX];
+	if( size > DEBUG_FRAME_MAX )
+		return false;
+	frame[0] = DEBUG_FRAME_MARK;
+	memcpy( frame+1, data, size );
+	return debug_put( frame, size+1 );
+}
+
+void debug_task(){
+	// the last transfer may be finished since the last write
+	if( (dma_chan < 0) || (ring_head == ring_tail + dma_count) )
+		return;
+	critical_section_enter_blocking( &debug_cs );
+	debug_kick();
+	critical_section_exit( &debug_cs );
+}
+
+uint32_t debug_free(){
+	if( dma_chan < 0 ) // blocking output
+		return DEBUG_RING_SIZE;
+	return DEBUG_RING_SIZE - (ring_head - ring_tail);
+}
+
+uint32_t debug_lost(){
+	return lost;
 }
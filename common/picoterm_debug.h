@@ -1,12 +1,36 @@
+/* ==========================================================================
+    Debug output on the PIO UART (see DEBUG_TX in picoterm_harddef.h)
+
+		The messages are copied into a RAM ring and sent by DMA in the
+		background: debug_print() does not wait for the 115200 bauds UART.
+		When the ring is full the message is dropped (see debug_lost).
+
+		Trace records (picoterm_trace.h) are written in the same stream as
+		binary frames starting with DEBUG_FRAME_MARK, decoded on the host by
+		trace-suite/trace_decode.py .
+   ========================================================================== */
 #ifndef _PICOTERM_DEBUG_H_
 #define _PICOTERM_DEBUG_H_
 
+#include <stdint.h>
+#include <stdbool.h>
 #include "hardware/pio.h"
 
+#define DEBUG_RING_SIZE 2048 // bytes waiting for the debug UART (power of 2)
+#define DEBUG_FRAME_MARK 0x1E // ASCII Record Separator, starts a binary frame
+#define DEBUG_FRAME_MAX 32    // bytes after the mark
+
 static char debug_msg[100];
 
+typedef void (*debug_monitor_t)( const uint8_t *data, uint32_t size );
+
 void debug_init();
 void debug_print( const char *s ); // ends message with CR/LF
 void debug_write( const char *s ); // just write the bytes
+bool debug_write_frame( const uint8_t *data, uint8_t size ); // binary frame (all or none)
+void debug_task(); // restart the DMA, to be called from the main loop
+uint32_t debug_lost(); // messages & frames dropped, ring full
+uint32_t debug_free(); // bytes that can be written without loss
+void debug_set_monitor( debug_monitor_t callback ); // also receives the text (not the trace frames)
 
 #endif // _PICOTERM_DEBUG_H_
@@ -0,0 +1,154 @@
+/* ==========================================================================
+    Hotkey macro cache.
+
+		The "hotkey" folder is scanned once when the SD card is mounted. The
+		`f<n>-s.dat` (Shift+Fn) and `f<n>-sc.dat` (Shift+Ctrl+Fn) files are
+		packed into a RAM arena and indexed by key and modifier. The macro is
+		then sent by the background streamer (see pio_sd.c) straight from RAM.
+
+		Macros not fitting into the arena are still sent from the SD card.
+   ========================================================================== */
+
+#include "picoterm_hotkey.h"
+#include "pio_sd.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../pio_fatfs/ff.h"
+#include "picoterm_debug.h"
+
+static char hotkey_arena[HOTKEY_ARENA_SIZE];
+static hotkey_entry_t hotkeys[HOTKEY_FKEYS][2]; // [f_key-1][0=Shift, 1=Shift+Ctrl]
+static hotkey_stats_t stats;
+
+static int parse_hotkey_name( const char *fname, bool *with_ctrl ){
+	// decode "f<n>-s.dat" or "f<n>-sc.dat" (case insensitive).
+	// Returns the f_key (1..12) or 0 when not a hotkey file.
+	char name[16];
+	int i;
+
+	if( strlen(fname) >= sizeof(name) )
+		return 0;
+	for( i=0; fname[i]!=0; i++ )
+		name[i] = tolower( fname[i] );
+	name[i] = 0;
+
+	if( name[0]!='f' )
+		return 0;
+	int f_key = atoi( name+1 );
+	if( (f_key<1) || (f_key>HOTKEY_FKEYS) )
+		return 0;
+	char *modifier = strchr( name, '-' );
+	if( modifier==NULL )
+		return 0;
+	if( strcmp( modifier, "-s.dat" )==0 )
+		*with_ctrl = false;
+	else if( strcmp( modifier, "-sc.dat" )==0 )
+		*with_ctrl = true;
+	else
+		return 0;
+	return f_key;
+}
+
+static void hotkey_path( char *path, uint8_t f_key, bool with_ctrl ){
+	sprintf( path, "%s/f%d-%s.dat", HOTKEY_DIR, f_key, with_ctrl ? "sc" : "s" );
+}
+
+void hotkey_scan(){
+	DIR dir;
+	FILINFO fno;
+	FIL file;
+	FRESULT fr;
+	UINT bytesRead;
+	char path[32];
+	bool with_ctrl;
+
+	// The arena may be under transmission
+	if( is_streaming() )
+		stream_abort();
+
+	uint32_t start = to_ms_since_boot( get_absolute_time() );
+	memset( hotkeys, 0, sizeof(hotkeys) );
+	stats.loaded = 0;
+	stats.on_sd  = 0;
+	stats.used   = 0;
+
+	fr = f_opendir( &dir, HOTKEY_DIR );
+	if (fr != FR_OK) { // see FRESULT in ff.h
+			sprintf( debug_msg, "hotkey: no %s folder (%d)", HOTKEY_DIR, fr );
+			debug_print( debug_msg );
+			return;
+	}
+
+	while( (f_readdir( &dir, &fno )==FR_OK) && (fno.fname[0]!=0) ){
+		if( fno.fattrib & AM_DIR )
+			continue;
+		int f_key = parse_hotkey_name( fno.fname, &with_ctrl );
+		if( f_key==0 )
+			continue;
+		hotkey_entry_t *entry = &hotkeys[f_key-1][with_ctrl ? 1 : 0];
+
+		if( fno.fsize > (HOTKEY_ARENA_SIZE - stats.used) ){
+			// too large, will be streamed from the SD
+			entry->state = HOTKEY_SD;
+			entry->size  = 0;
+			stats.on_sd++;
+			continue;
+		}
+
+		hotkey_path( path, f_key, with_ctrl );
+		fr = f_open( &file, path, FA_READ );
+		if (fr != FR_OK)
+			continue;
+		fr = f_read( &file, hotkey_arena+stats.used, fno.fsize, &bytesRead );
+		f_close( &file );
+		if (fr != FR_OK) {
+				sprintf( debug_msg, "hotkey: read error %d on %s", fr, path );
+				debug_print( debug_msg );
+				continue;
+		}
+		entry->state  = HOTKEY_RAM;
+		entry->offset = stats.used;
+		entry->size   = bytesRead;
+		stats.used   += bytesRead;
+		stats.loaded++;
+	}
+	f_closedir( &dir );
+
+	stats.scan_ms = to_ms_since_boot( get_absolute_time() ) - start;
+	sprintf( debug_msg, "hotkey: %d in RAM (%d bytes), %d on SD, %lu ms", stats.loaded, stats.used, stats.on_sd, stats.scan_ms );
+	debug_print( debug_msg );
+}
+
+hotkey_entry_t *hotkey_entry( uint8_t f_key, bool with_ctrl ){
+	if( (f_key<1) || (f_key>HOTKEY_FKEYS) )
+		return NULL;
+	return &hotkeys[f_key-1][with_ctrl ? 1 : 0];
+}
+
+hotkey_stats_t *hotkey_stats(){
+	return &stats;
+}
+
+bool hotkey_send( uint8_t f_key, bool with_ctrl ){
+	// send the macro to the host (background transmission)
+	char path[32];
+	hotkey_entry_t *entry = hotkey_entry( f_key, with_ctrl );
+	if( entry==NULL )
+		return false;
+
+	switch( entry->state ){
+		case HOTKEY_RAM:
+			stats.hits++;
+			return stream_ram_to_uart( hotkey_arena+entry->offset, entry->size );
+		case HOTKEY_SD:
+			stats.sd_reads++;
+			hotkey_path( path, f_key, with_ctrl );
+			return send_file_to_uart( path );
+		default:
+			stats.misses++;
+			return false;
+	}
+}
@@ -0,0 +1,43 @@
+/* ==========================================================================
+    Hotkey macro cache.
+
+		The files of the "hotkey" folder are loaded into a RAM arena when the
+		SD card is mounted (or rescanned). A hotkey press then costs no SD access.
+   ========================================================================== */
+
+#ifndef _PICOTERM_HOTKEY_H
+#define _PICOTERM_HOTKEY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HOTKEY_DIR        "hotkey"
+#define HOTKEY_FKEYS      12    // F1..F12
+#define HOTKEY_ARENA_SIZE 8192  // RAM used to store all the macros
+
+#define HOTKEY_NONE  0 // no macro for that key
+#define HOTKEY_RAM   1 // macro loaded into the arena
+#define HOTKEY_SD    2 // macro too large for the arena, streamed from the SD
+
+typedef struct HotkeyEntry {
+	uint16_t offset; // position into the arena
+	uint16_t size;
+	uint8_t  state;  // HOTKEY_NONE, HOTKEY_RAM, HOTKEY_SD
+} hotkey_entry_t;
+
+typedef struct HotkeyStats {
+	uint8_t  loaded;    // macros in RAM
+	uint8_t  on_sd;     // macros left on the SD (too large)
+	uint16_t used;      // bytes used into the arena
+	uint32_t scan_ms;   // duration of the last scan
+	uint32_t hits;      // hotkey served from RAM
+	uint32_t sd_reads;  // hotkey served from the SD
+	uint32_t misses;    // hotkey pressed without macro
+} hotkey_stats_t;
+
+void hotkey_scan();    // (re)load the macros from the SD card
+bool hotkey_send( uint8_t f_key, bool with_ctrl ); // f_key 1..12, false when nothing sent
+hotkey_entry_t *hotkey_entry( uint8_t f_key, bool with_ctrl );
+hotkey_stats_t *hotkey_stats();
+
+#endif
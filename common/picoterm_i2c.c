@@ -36,6 +36,23 @@ void deinit_i2c_bus(){
 	i2c_deinit( i2c_bus );
 }
 
+// The SDK blocking transfers poll (and clear) STOP_DET & TX_ABRT themselves:
+// the interrupts of the asynchronous PCA9536 writes are masked meanwhile,
+// otherwise the handler would clear the flags the SDK is waiting for.
+static uint32_t irq_mask_save( i2c_inst_t *i2c ){
+    i2c_hw_t *hw = i2c_get_hw( i2c );
+    uint32_t mask = hw->intr_mask;
+    hw->intr_mask = 0;
+    return mask;
+}
+
+static void irq_mask_restore( i2c_inst_t *i2c, uint32_t mask ){
+    i2c_hw_t *hw = i2c_get_hw( i2c );
+    hw->clr_stop_det; // read to clear, left by the blocking transfer
+    hw->clr_tx_abrt;
+    hw->intr_mask = mask;
+}
+
 // Write 1 byte to the specified register
 int reg_write(  i2c_inst_t *i2c,
                 const uint addr,
@@ -58,7 +75,9 @@ int reg_write(  i2c_inst_t *i2c,
     }
 
     // Write data to register(s) over I2C
+    uint32_t mask = irq_mask_save( i2c );
     num_bytes_write = i2c_write_blocking(i2c, addr, msg, (nbytes + 1), false);
+    irq_mask_restore( i2c, mask );
 
     return num_bytes_write;
 }
@@ -79,8 +98,10 @@ int reg_read(  i2c_inst_t *i2c,
     }
 
     // Read data from register(s) over I2C
+    uint32_t mask = irq_mask_save( i2c );
     i2c_write_blocking(i2c, addr, &reg, 1, true);
     num_bytes_read = i2c_read_blocking(i2c, addr, buf, nbytes, false);
+    irq_mask_restore( i2c, mask );
 
     return num_bytes_read;
 }
@@ -102,8 +123,10 @@ int reg_read_timeout(  i2c_inst_t *i2c,
     }
 
     // Read data from register(s) over I2C
+    uint32_t mask = irq_mask_save( i2c );
     i2c_write_timeout_us(i2c, addr, &reg, 1, true, timeout_us ); // 20ms = 20 000 us
     num_bytes_read = i2c_read_timeout_us(i2c, addr, buf, nbytes, false, timeout_us);
+    irq_mask_restore( i2c, mask );
 
     return num_bytes_read;
 }
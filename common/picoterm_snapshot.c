@@ -0,0 +1,106 @@
+/* ==========================================================================
+    Screen snapshot exported to the SD card.
+
+		snapshot_request() only raises a flag (it can be called from the escape
+		sequence parser). The next snapshot_task() copies the screen into the
+		staging area (see snapshot_stage) and opens the file. The following
+		calls render and write one part (eg: a text row) each.
+   ========================================================================== */
+
+#include "picoterm_snapshot.h"
+#include "pio_sd.h"
+#include "pico/stdlib.h"
+#include <stdio.h>
+#include "../pio_fatfs/ff.h"
+#include "picoterm_debug.h"
+
+#define SNAPSHOT_IDLE      0
+#define SNAPSHOT_REQUESTED 1
+#define SNAPSHOT_WRITING   2
+
+static uint8_t state = SNAPSHOT_IDLE;
+static FIL snapshot_file;
+static char snapshot_name[SNAPSHOT_NAME_SIZE];
+static char snapshot_buffer[SNAPSHOT_CHUNK_SIZE];
+static uint16_t snapshot_part;
+static uint32_t snapshot_start;
+static snapshot_stats_t stats;
+
+void snapshot_request(){
+	if( state==SNAPSHOT_IDLE )
+		state = SNAPSHOT_REQUESTED;
+}
+
+static void snapshot_start_file(){
+	// stage the screen then create the file
+	FRESULT fr;
+	uint32_t start = time_us_32();
+	const char *ext = snapshot_stage();
+	stats.stage_us = time_us_32() - start;
+
+	state = SNAPSHOT_IDLE;
+	if( !is_sd_mount() ) // will attempt to remount
+		return;
+	if( !sd_next_name( snapshot_name, "snap", ext ) ){
+		debug_print( "snapshot: no free file name" );
+		return;
+	}
+	fr = f_open( &snapshot_file, snapshot_name, FA_WRITE | FA_CREATE_NEW );
+	if (fr != FR_OK) { // see FRESULT in ff.h
+			sprintf( debug_msg, "snapshot: open error %d on %s", fr, snapshot_name );
+			debug_print( debug_msg );
+			return;
+	}
+	stats.bytes = 0;
+	snapshot_part = 0;
+	snapshot_start = to_ms_since_boot( get_absolute_time() );
+	state = SNAPSHOT_WRITING;
+}
+
+void snapshot_task(){
+	UINT bw;
+	FRESULT fr;
+
+	switch( state ){
+		case SNAPSHOT_REQUESTED:
+			snapshot_start_file();
+			return;
+		case SNAPSHOT_WRITING:
+			break;
+		default:
+			return;
+	}
+
+	// one part per call
+	uint16_t len = snapshot_render( snapshot_part++, snapshot_buffer );
+	if( len==0 ){
+		f_close( &snapshot_file );
+		state = SNAPSHOT_IDLE;
+		stats.count++;
+		stats.write_ms = to_ms_since_boot( get_absolute_time() ) - snapshot_start;
+		sprintf( debug_msg, "snapshot: %s, %lu bytes, staged in %lu us, written in %lu ms", snapshot_name, stats.bytes, stats.stage_us, stats.write_ms );
+		debug_print( debug_msg );
+		return;
+	}
+	fr = f_write( &snapshot_file, snapshot_buffer, len, &bw );
+	stats.bytes += bw;
+	if( (fr != FR_OK) || (bw != len) ){
+			sprintf( debug_msg, "snapshot: write error %d", fr );
+			debug_print( debug_msg );
+			f_close( &snapshot_file );
+			state = SNAPSHOT_IDLE;
+			sd_unmount(); // card removed? force a remount on next access
+	}
+}
+
+bool is_snapshot_busy(){
+	return state!=SNAPSHOT_IDLE;
+}
+
+char *snapshot_filename(){
+	return snapshot_name;
+}
+
+snapshot_stats_t *snapshot_stats(){
+	return &stats;
+}
@@ -0,0 +1,39 @@
+/* ==========================================================================
+    Screen snapshot exported to the SD card.
+
+		The screen is copied into a RAM staging area at once, then rendered
+		and written to the SD card part by part by snapshot_task(), so the
+		terminal keeps parsing the host stream during the export.
+
+		The staging & rendering are target specific (see picoterm_conio.c):
+		  * 80 columns: text with ANSI attributes (snapNNN.ans)
+		  * 40 columns: framebuffer staged as 8x8 cells, PPM image (snapNNN.ppm)
+   ========================================================================== */
+
+#ifndef _PICOTERM_SNAPSHOT_H
+#define _PICOTERM_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SNAPSHOT_CHUNK_SIZE 1024 // largest part rendered at once
+#define SNAPSHOT_NAME_SIZE  16
+
+typedef struct SnapshotStats {
+	uint32_t count;      // snapshots written
+	uint32_t bytes;      // size of the last snapshot
+	uint32_t stage_us;   // time to copy the screen into the staging area
+	uint32_t write_ms;   // time to write the file (in the background)
+} snapshot_stats_t;
+
+void snapshot_request();  // hotkey & CSI i, taken by the next snapshot_task()
+void snapshot_task();     // to be called from the main loop
+bool is_snapshot_busy();
+char *snapshot_filename();
+snapshot_stats_t *snapshot_stats();
+
+// Implemented by the target (picoterm_conio.c)
+const char *snapshot_stage(); // copy the visible screen, returns the file extension
+uint16_t snapshot_render( uint16_t part, char *buf ); // part 0..n into buf, 0 when done
+
+#endif
@@ -0,0 +1,123 @@
+/* ==========================================================================
+    Live performance counters (see picoterm_stats.h)
+   ========================================================================== */
+
+#include "picoterm_stats.h"
+#include "picoterm_conio_config.h"
+#include <stdio.h>
+#include <string.h>
+
+/* picoterm_conio_config.c */
+extern picoterm_conio_config_t conio_config;
+
+picoterm_stats_t stats_core[2];
+
+static uint32_t last_loop_us = 0;   // start of the current main loop iteration
+static uint32_t second_start_us = 0;
+static uint32_t second_parsed = 0;  // stats.parsed at the start of the second
+static uint32_t parsed_per_sec = 0;
+static uint32_t scroll_start = 0;   // conio_config.scroll_count at reset
+
+void stats_loop( bool measure ){
+	// Time the previous iteration. Under menu (measure=false) the loop
+	// waits on the CLI or the keyboard, that time is not recorded.
+	uint32_t now = time_us_32();
+	picoterm_stats_t *stats = &stats_core[0];
+	if( measure && (last_loop_us!=0) ){
+		uint32_t elapsed = now - last_loop_us;
+		if( elapsed > stats->loop_max_us )
+			stats->loop_max_us = elapsed;
+		stats->loop_total_us += elapsed;
+		stats->loop_count++;
+	}
+	last_loop_us = now;
+
+	if( now - second_start_us >= 1000000 ){
+		parsed_per_sec = stats->parsed - second_parsed;
+		second_parsed = stats->parsed;
+		second_start_us = now;
+	}
+}
+
+void stats_high_water( uint32_t *high, uint32_t level ){
+	if( level > *high )
+		*high = level;
+}
+
+void stats_read( picoterm_stats_t *stats ){
+	// 32 bits reads are atomic, the sum is good enough for display
+	memset( stats, 0, sizeof(picoterm_stats_t) );
+	for( int core=0; core<2; core++ ){
+		picoterm_stats_t *c = &stats_core[core];
+		stats->uart_rx += c->uart_rx;
+		stats->keybuf_overflow += c->keybuf_overflow;
+		stats->parsed += c->parsed;
+		stats->esc_csi += c->esc_csi;
+		stats->esc_charset += c->esc_charset;
+		stats->esc_single += c->esc_single;
+		stats->loop_count += c->loop_count;
+		stats->loop_total_us += c->loop_total_us;
+		stats->late_scanlines += c->late_scanlines;
+		stats->hid_reports += c->hid_reports;
+		stats->key_repeat_merged += c->key_repeat_merged;
+		stats->key_events_lost += c->key_events_lost;
+		stats->tx_dropped += c->tx_dropped;
+		stats->bell_merged += c->bell_merged;
+		stats_high_water( &stats->keybuf_high, c->keybuf_high );
+		stats_high_water( &stats->loop_max_us, c->loop_max_us );
+	}
+}
+
+uint32_t stats_parsed_per_sec(){
+	return parsed_per_sec;
+}
+
+void stats_reset(){
+	memset( stats_core, 0, sizeof(stats_core) );
+	last_loop_us = 0;
+	second_parsed = 0;
+	parsed_per_sec = 0;
+	scroll_start = conio_config.scroll_count;
+}
+
+void stats_print( void (*print)( char str[] ) ){
+	// Shared by the statistics screen and the stats CLI command
+	picoterm_stats_t stats;
+	char msg[60];
+
+	stats_read( &stats );
+	sprintf( msg, "UART RX bytes      : %lu\r\n", stats.uart_rx );
+	print( msg );
+	sprintf( msg, "Buffer high water  : %lu\r\n", stats.keybuf_high );
+	print( msg );
+	sprintf( msg, "Buffer overflows   : %lu\r\n", stats.keybuf_overflow );
+	print( msg );
+	sprintf( msg, "Parsed bytes       : %lu\r\n", stats.parsed );
+	print( msg );
+	sprintf( msg, "Parsed bytes/s     : %lu\r\n", stats_parsed_per_sec() );
+	print( msg );
+	sprintf( msg, "Scrolls            : %lu\r\n", conio_config.scroll_count - scroll_start );
+	print( msg );
+	sprintf( msg, "ESC [ (CSI)        : %lu\r\n", stats.esc_csi );
+	print( msg );
+	sprintf( msg, "ESC ( (charset)    : %lu\r\n", stats.esc_charset );
+	print( msg );
+	sprintf( msg, "ESC x (single)     : %lu\r\n", stats.esc_single );
+	print( msg );
+	sprintf( msg, "Main loop max us   : %lu\r\n", stats.loop_max_us );
+	print( msg );
+	sprintf( msg, "Main loop avg us   : %lu\r\n", stats.loop_count>0 ? (uint32_t)(stats.loop_total_us/stats.loop_count) : 0 );
+	print( msg );
+	sprintf( msg, "Late scanlines     : %lu\r\n", stats.late_scanlines );
+	print( msg );
+	sprintf( msg, "USB HID reports    : %lu\r\n", stats.hid_reports );
+	print( msg );
+	sprintf( msg, "Key repeats merged : %lu\r\n", stats.key_repeat_merged );
+	print( msg );
+	sprintf( msg, "Key events lost    : %lu\r\n", stats.key_events_lost );
+	print( msg );
+	sprintf( msg, "Keys/replies lost  : %lu\r\n", stats.tx_dropped );
+	print( msg );
+	sprintf( msg, "Bells merged       : %lu\r\n", stats.bell_merged );
+	print( msg );
+}
@@ -0,0 +1,49 @@
+/* ==========================================================================
+    Live performance counters (see the stats CLI command & Ctrl+Shift+S)
+
+		Each core increments its own copy of the counters (STATS_INC), so an
+		increment is a plain load/add/store, without lock nor atomic. The two
+		copies are summed when the counters are read (stats_read).
+
+		The UART IRQ, the parser, the USB stack and the main loop run on core
+		0, the scanline rendering runs on core 1.
+   ========================================================================== */
+
+#ifndef _PICOTERM_STATS_H
+#define _PICOTERM_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+typedef struct PicotermStats {
+	uint32_t uart_rx;        // bytes received from the host
+	uint32_t keybuf_high;    // highest fill of the keyboard buffer (bytes)
+	uint32_t keybuf_overflow;// bytes lost, keyboard buffer full
+	uint32_t parsed;         // bytes given to the parser
+	uint32_t esc_csi;        // ESC [ ... sequences
+	uint32_t esc_charset;    // ESC ( x sequences
+	uint32_t esc_single;     // ESC x sequences (VT100 & VT52)
+	uint32_t loop_count;     // main loop iterations (menus excluded)
+	uint32_t loop_max_us;    // longest main loop iteration
+	uint64_t loop_total_us;
+	uint32_t late_scanlines; // scanlines rendered after their display time
+	uint32_t hid_reports;    // USB HID reports received
+	uint32_t key_repeat_merged; // key repeats merged (main loop late)
+	uint32_t key_events_lost;// key events dropped, event queue full
+	uint32_t tx_dropped;     // keys or replies dropped, UART TX queue full
+	uint32_t bell_merged;    // BEL merged into the pending beep, DECPS notes dropped
+} picoterm_stats_t;
+
+extern picoterm_stats_t stats_core[2];
+
+#define STATS_INC( field ) (stats_core[get_core_num()].field++)
+
+void stats_loop( bool measure ); // to be called at each main loop iteration
+void stats_high_water( uint32_t *high, uint32_t level ); // keep the highest level
+void stats_read( picoterm_stats_t *stats ); // sum of the cores
+uint32_t stats_parsed_per_sec(); // over the last full second
+void stats_reset();
+void stats_print( void (*print)( char str[] ) ); // one counter per line
+
+#endif
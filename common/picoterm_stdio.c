@@ -5,16 +5,30 @@
 		Relies on the Picoterm_cooio.c to interact with screen
    ========================================================================== */
 
+#include "picoterm_stdio.h"
 #include "picoterm_core.h" // handle_new_character
 #include "picoterm_conio_config.h"
 #include "picoterm_conio.h" // readkey
 #include "../common/picoterm_debug.h"
+#include "../common/pio_sd.h" // sd_stream_task
+#include "../common/picoterm_capture.h" // capture_task
 
-#include "tusb.h"
+#include "keybd.h" // keybd_poll
 
 /* picoterm_conio.c */
 extern picoterm_conio_config_t conio_config;
 
+static completion_t completion = NULL;
+static idle_task_t idle_task = NULL;
+
+void set_completion( completion_t fn ){
+	completion = fn;
+}
+
+void set_idle_task( idle_task_t fn ){
+	idle_task = fn;
+}
+
 
 void print_string(char str[] ){
 	// Would it be more appropruate to use the put_char() and move the cursor?
@@ -27,12 +41,41 @@ void print_char( char c ){
 	handle_new_character( c );
 }
 
+void print_status( char str[] ){
+	// Write the text in reverse on the last visible row (truncated to the
+	// screen width) without moving the cursor. Used as a status row by long
+	// running commands, see reserve_status_row().
+	bool rvs = conio_config.rvs;
+	bool blk = conio_config.blk;
+	bool just_wrapped = conio_config.just_wrapped;
+	int len = (str==NULL) ? 0 : strlen(str);
+	conio_config.rvs = (str!=NULL);
+	conio_config.blk = false;
+	for( int x=0; x<COLUMNS; x++ )
+		put_char( ((x<len) ? str[x] : ' ')-32, x, VISIBLEROWS-1 );
+	conio_config.rvs = rvs;
+	conio_config.blk = blk;
+	conio_config.just_wrapped = just_wrapped;
+}
+
+void reserve_status_row(){
+	// the cursor must not be on the status row (scroll one line otherwise)
+	if( conio_config.cursor.pos.y >= VISIBLEROWS-1 ){
+		print_string( "\r\n" );
+		move_cursor_up( 1 );
+	}
+}
+
 char get_key( bool ascii ){
 	// BLOCKING read_key with option to ascii only char
 	char ch;
 	while( true ){
-		tuh_task(); // allow keyboard input to get into the input buffer
+		keybd_poll(); // allow keyboard input to get into the input buffer
 		csr_blinking_task();
+		sd_stream_task(); // keep sending file in background
+		capture_task();
+		if( idle_task!=NULL )
+			idle_task();
 		ch = read_key();
 		if( ((ch >= 32) && ascii) || ((ch>0) && !(ascii)) )
 			return ch;
@@ -48,8 +91,12 @@ void get_string(char *str, int max_size){
 
 	char ch = 0;
 	while( ch != 13 ){
-		tuh_task(); // allow keyboard input to get into the input buffer
+		keybd_poll(); // allow keyboard input to get into the input buffer
 		csr_blinking_task();
+		sd_stream_task(); // keep sending file in background
+		capture_task();
+		if( idle_task!=NULL )
+			idle_task();
 		ch = read_key(); // get last key-pressed from the buffer
 		if( (ch != 0) && (ch < 32)){
 			switch (ch) {
@@ -64,6 +111,17 @@ void get_string(char *str, int max_size){
 							cursor_visible( true );
 						}
 			      break;
+					case HT: // complete the input (eg: CLI command)
+						if( completion!=NULL ){
+							int len = completion( str, pos, max_size );
+							cursor_visible( false );
+							for( ; pos<len; pos++ ){
+								put_char( str[pos]-32, conio_config.cursor.pos.x, conio_config.cursor.pos.y );
+								conio_config.cursor.pos.x++;
+							}
+							cursor_visible( true );
+						}
+						break;
 			} // eof switch(ch)
 		}
 		else if( (ch != 0) && (ch >= 32)){
@@ -8,9 +8,19 @@
 #ifndef _PICOTERM_STDIO_H_
 #define _PICOTERM_STDIO_H_
 
+#include <stdbool.h>
+
 void print_string(char str[] );
 void print_char( char c );
 char get_key( bool ascii ); // BLOCKING read_key with option to ascii only char
 void get_string(char *str, int max_size);
+void print_status( char str[] ); // on the last visible row, the cursor does not move. NULL clears it
+void reserve_status_row(); // keep the cursor above the status row
+
+typedef int (*completion_t)( char *str, int pos, int max_size ); // returns the new length of str
+void set_completion( completion_t fn ); // called by get_string() on TAB key
+
+typedef void (*idle_task_t)();
+void set_idle_task( idle_task_t fn ); // called by get_key() & get_string() while waiting (eg: host output)
 
 #endif // _PICOTERM_STDIO_H_
@@ -0,0 +1,74 @@
+/* ==========================================================================
+    Timeline of the hot paths (see picoterm_timeline.h)
+   ========================================================================== */
+
+#include "picoterm_timeline.h"
+#include "picoterm_trace.h"
+#include "picoterm_debug.h"
+#include "pio_sd.h"
+#include "../pio_fatfs/ff.h"
+#include <string.h>
+
+#define TIMELINE_MAGIC "PTTL" // SD file: magic, count core 0, count core 1, events
+
+volatile bool timeline_recording = false;
+uint32_t timeline_events[2][TIMELINE_EVENTS];
+uint32_t timeline_head[2];
+
+void timeline_start(){
+	timeline_recording = false;
+	timeline_head[0] = 0;
+	timeline_head[1] = 0;
+	timeline_recording = true;
+}
+
+void timeline_freeze(){
+	timeline_recording = false;
+}
+
+uint32_t timeline_count( uint core ){
+	return timeline_head[core] < TIMELINE_EVENTS ? timeline_head[core] : TIMELINE_EVENTS;
+}
+
+static uint32_t timeline_get( uint core, uint32_t i ){
+	// i-th kept event of the core, oldest first
+	uint32_t first = timeline_head[core] - timeline_count( core );
+	return timeline_events[core][(first + i) & (TIMELINE_EVENTS-1)];
+}
+
+bool timeline_dump_uart(){
+	// ~2.5 s for 2x1024 events at 115200 bauds: wait for room in the debug ring
+	timeline_freeze();
+	for( uint core=0; core<2; core++ )
+		for( uint32_t i=0; i<timeline_count(core); i++ ){
+			uint32_t start = time_us_32();
+			while( debug_free() <= TRACE_RECORD_SIZE ){
+				debug_task();
+				if( time_us_32() - start > 100000 )
+					return false; // debug UART stalled
+			}
+			trace_record( TR_TIMELINE_EVENT, core, timeline_get(core,i) );
+		}
+	return true;
+}
+
+bool timeline_dump_sd( char *filename ){
+	FIL file;
+	UINT bw;
+	timeline_freeze();
+	if( !is_sd_mount() || !sd_next_name( filename, "tl", "bin" ) )
+		return false;
+	if( f_open( &file, filename, FA_WRITE | FA_CREATE_NEW ) != FR_OK )
+		return false;
+	uint32_t header[3];
+	memcpy( header, TIMELINE_MAGIC, 4 );
+	header[1] = timeline_count( 0 );
+	header[2] = timeline_count( 1 );
+	bool ok = (f_write( &file, header, sizeof(header), &bw ) == FR_OK) && (bw == sizeof(header));
+	for( uint core=0; ok && (core<2); core++ )
+		for( uint32_t i=0; ok && (i<timeline_count(core)); i++ ){
+			uint32_t event = timeline_get( core, i );
+			ok = (f_write( &file, &event, sizeof(event), &bw ) == FR_OK) && (bw == sizeof(event));
+		}
+	return (f_close( &file ) == FR_OK) && ok;
+}
@@ -0,0 +1,70 @@
+/* ==========================================================================
+    Timeline of the hot paths (see the timeline CLI command)
+
+		TIMELINE_BEGIN / TIMELINE_END record the begin & end of a work (UART
+		IRQ, tuh_task, parser, scanline rendering) with the 1 MHz timer. Each
+		core writes its own ring of events: no lock between the cores, the
+		interrupts are only masked for the 2 instructions of the write.
+
+		An event is 32 bits: time_us (26 bits, wraps after 67 s), point (5
+		bits) and end flag. The rings keep the last TIMELINE_EVENTS events of
+		each core. Recording is frozen when the keyboard buffer overflows, so
+		the events leading to the dropped chars are kept.
+
+		The events are dumped to the debug UART (as TR_TIMELINE_EVENT trace
+		records) or to the SD card, then converted to the Chrome trace format
+		by trace-suite/timeline_chrome.py (chrome://tracing, ui.perfetto.dev).
+   ========================================================================== */
+
+#ifndef _PICOTERM_TIMELINE_H
+#define _PICOTERM_TIMELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#ifndef TIMELINE_ENABLED
+#define TIMELINE_ENABLED 1 // 0 removes the trace points at compile time
+#endif
+
+#define TIMELINE_EVENTS 1024 // per core (4 KB), power of 2
+
+// Trace points, also listed in trace-suite/timeline_chrome.py
+#define TL_UART_IRQ       0
+#define TL_TUH_TASK       1
+#define TL_KEYBOARD_INPUT 2 // handle_keyboard_input(): parser
+#define TL_RENDER         3 // render_scanline() on core 1
+
+#define TL_TIME_MASK 0x03FFFFFF
+#define TL_END       0x80000000
+
+extern volatile bool timeline_recording;
+extern uint32_t timeline_events[2][TIMELINE_EVENTS];
+extern uint32_t timeline_head[2]; // events written (free running)
+
+static inline void timeline_event( uint8_t point, uint32_t end ){
+	if( !timeline_recording )
+		return;
+	uint core = get_core_num();
+	uint32_t event = (time_us_32() & TL_TIME_MASK) | ((uint32_t)point << 26) | end;
+	uint32_t ints = save_and_disable_interrupts(); // IRQ of the same core
+	timeline_events[core][timeline_head[core]++ & (TIMELINE_EVENTS-1)] = event;
+	restore_interrupts( ints );
+}
+
+#if TIMELINE_ENABLED
+#define TIMELINE_BEGIN( point ) timeline_event( point, 0 )
+#define TIMELINE_END( point )   timeline_event( point, TL_END )
+#else
+#define TIMELINE_BEGIN( point )
+#define TIMELINE_END( point )
+#endif
+
+void timeline_start(); // clear & record
+void timeline_freeze(); // stop recording, keep the events
+uint32_t timeline_count( uint core ); // events kept for the core
+bool timeline_dump_uart(); // as trace records on the debug UART
+bool timeline_dump_sd( char *filename ); // tlNNN.bin, return the name
+
+#endif
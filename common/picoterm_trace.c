@@ -0,0 +1,21 @@
+/* ==========================================================================
+    Binary trace records (see picoterm_trace.h)
+   ========================================================================== */
+
+#include "picoterm_trace.h"
+#include "picoterm_debug.h"
+#include "pico/stdlib.h"
+
+static inline void put_u32( uint8_t *p, uint32_t v ){
+	// little endian, whatever the alignment
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+void trace_record( trace_id_t id, uint32_t a, uint32_t b ){
+	uint8_t record[TRACE_RECORD_SIZE];
+	record[0] = id;
+	put_u32( record+1, time_us_32() );
+	put_u32( record+5, a );
+	put_u32( record+9, b );
+	debug_write_frame( record, TRACE_RECORD_SIZE ); // dropped when the ring is full
+}
@@ -0,0 +1,51 @@
+/* ==========================================================================
+    Binary trace records (see picoterm_trace_ids.h for the trace points)
+
+		TRACE( id, a, b ) writes a 13 bytes record (id, time_us, a, b) in the
+		debug output ring (picoterm_debug.c) instead of formatting a message:
+		no sprintf, no wait on the debug UART, usable from the IRQ and core 1.
+		The records are formatted on the host by trace-suite/trace_decode.py .
+
+		The trace points above TRACE_LEVEL are removed at compile time (set
+		TRACE_LEVEL in CMakeLists.txt with add_compile_definitions).
+   ========================================================================== */
+
+#ifndef _PICOTERM_TRACE_H
+#define _PICOTERM_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACE_OFF   0
+#define TRACE_ERROR 1
+#define TRACE_WARN  2
+#define TRACE_INFO  3
+#define TRACE_DEBUG 4
+
+#define TRACE_RECORD_SIZE 13 // id, time_us, a, b
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_INFO
+#endif
+
+#define TRACE_ID( name, level, format ) name,
+typedef enum {
+#include "picoterm_trace_ids.h"
+	TRACE_ID_COUNT
+} trace_id_t;
+#undef TRACE_ID
+
+#define TRACE_ID( name, level, format ) name##_LEVEL = level,
+enum {
+#include "picoterm_trace_ids.h"
+};
+#undef TRACE_ID
+
+#define TRACE( id, a, b ) do { \
+		if( id##_LEVEL <= TRACE_LEVEL ) \
+			trace_record( id, (uint32_t)(a), (uint32_t)(b) ); \
+	} while(0)
+
+void trace_record( trace_id_t id, uint32_t a, uint32_t b );
+
+#endif
@@ -0,0 +1,24 @@
+/* ==========================================================================
+    Trace points: TRACE_ID( name, level, format )
+
+		Included by picoterm_trace.h and parsed by trace-suite/trace_decode.py
+		(one TRACE_ID per line). The format is only applied by the decoder,
+		with the 2 arguments of the record: %u %d %x %c.
+		Append new entries at the end (the record stores the index).
+   ========================================================================== */
+
+TRACE_ID( TR_HID_MOUNT,          TRACE_INFO,  "HID device address = %u, instance = %u is mounted" )
+TRACE_ID( TR_HID_PROTOCOL,       TRACE_DEBUG, "HID Interface Protocol = %u (0 None, 1 Keyboard, 2 Mouse)" )
+TRACE_ID( TR_HID_REPORTS,        TRACE_DEBUG, "HID has %u reports" )
+TRACE_ID( TR_HID_TOO_MANY,       TRACE_ERROR, "HID Error: too many keyboards (address %u, instance %u)" )
+TRACE_ID( TR_HID_ATTACHED,       TRACE_INFO,  "%u keyboard(s) attached" )
+TRACE_ID( TR_HID_RECEIVE_ERROR,  TRACE_ERROR, "HID Error: cannot request to receive report (address %u, instance %u)" )
+TRACE_ID( TR_HID_UNMOUNT,        TRACE_INFO,  "HID device address = %u, instance = %u is unmounted" )
+TRACE_ID( TR_HID_NO_REPORT_INFO, TRACE_WARN,  "HID: no report info for report id %u" )
+TRACE_ID( TR_ESC_NOT_IMPLEMENTED,TRACE_WARN,  "esc_sequence_received(): ESC [ ? %u %c to be implemented" )
+TRACE_ID( TR_ESC_CHARSET,        TRACE_DEBUG, "handle_new_character(): ESC %c" )
+TRACE_ID( TR_CAPTURE_WRITE_ERROR,TRACE_ERROR, "capture: write error %d" )
+TRACE_ID( TR_XFER_WRITE_ERROR,   TRACE_ERROR, "xfer: write error %d" )
+TRACE_ID( TR_XFER_READ_ERROR,    TRACE_ERROR, "xfer: read error %d" )
+TRACE_ID( TR_TIMELINE_EVENT,     TRACE_INFO,  "timeline: core %u event 0x%x" )
+TRACE_ID( TR_HID_LAYOUT,         TRACE_DEBUG, "HID keyboard report id %u: %u key fields" )
@@ -0,0 +1,157 @@
+/* ==========================================================================
+    Interrupt driven transmission of data to the host UART.
+
+		The main loop only writes into the ring buffers. The UART IRQ handler
+		(see main.c::on_uart_irq) calls on_uart_tx() which push the pending bytes
+		as soon as the UART accept them. The TX interrupt is only enabled while
+		there is something to send.
+
+		Each byte of the data queue has a bit in tx_split telling if a reply
+		may be sent after it. uart_tx_unit() only sets it on its last byte.
+   ========================================================================== */
+
+#include "picoterm_uart.h"
+#include "picoterm_harddef.h" // UART_ID
+#include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "picoterm_stats.h"
+
+#define UART_TX_MASK   (UART_TX_BUFFER_SIZE-1)
+#define UART_PRIO_MASK (UART_TX_PRIO_SIZE-1)
+
+static char tx_buffer[UART_TX_BUFFER_SIZE];
+static uint8_t tx_split[UART_TX_BUFFER_SIZE/8]; // 1 bit per byte: a reply can follow it
+static volatile uint16_t tx_head = 0; // next free slot (written by main loop)
+static volatile uint16_t tx_tail = 0; // next byte to send (written by IRQ)
+static bool tx_at_split = true;       // last byte sent ends a unit
+
+static char prio_buffer[UART_TX_PRIO_SIZE];
+static volatile uint16_t prio_head = 0;
+static volatile uint16_t prio_tail = 0;
+
+void uart_tx_init(){
+	hw_clear_bits( &uart_get_hw(UART_ID)->imsc, UART_UARTIMSC_TXIM_BITS );
+	tx_head = 0;
+	tx_tail = 0;
+	tx_at_split = true;
+	prio_head = 0;
+	prio_tail = 0;
+}
+
+static inline void set_split( uint16_t pos, bool split ){
+	if( split )
+		tx_split[pos>>3] |= (1<<(pos&7));
+	else
+		tx_split[pos>>3] &= ~(1<<(pos&7));
+}
+
+void on_uart_tx(){
+	// Push as many bytes as the UART can accept, replies first (when the data
+	// queue is between two units). Also called outside of the IRQ (with
+	// interrupts disabled) to kick the transmission.
+	while( uart_is_writable(UART_ID) ){
+		if( tx_at_split && (prio_tail != prio_head) ){
+			uart_get_hw(UART_ID)->dr = prio_buffer[prio_tail];
+			prio_tail = (prio_tail+1) & UART_PRIO_MASK;
+		}
+		else if( tx_tail != tx_head ){
+			uart_get_hw(UART_ID)->dr = tx_buffer[tx_tail];
+			tx_at_split = (tx_split[tx_tail>>3] & (1<<(tx_tail&7))) != 0;
+			tx_tail = (tx_tail+1) & UART_TX_MASK;
+		}
+		else
+			break;
+	}
+	if( (tx_tail == tx_head) && (prio_tail == prio_head) )
+		hw_clear_bits( &uart_get_hw(UART_ID)->imsc, UART_UARTIMSC_TXIM_BITS );
+	else
+		hw_set_bits( &uart_get_hw(UART_ID)->imsc, UART_UARTIMSC_TXIM_BITS );
+}
+
+static void uart_tx_kick(){
+	// start the transmission (the IRQ will keep it running)
+	uint32_t status = save_and_disable_interrupts();
+	on_uart_tx();
+	restore_interrupts( status );
+}
+
+uint uart_tx_free(){
+	return UART_TX_MASK - ((tx_head - tx_tail) & UART_TX_MASK);
+}
+
+bool uart_tx_empty(){
+	return (tx_tail == tx_head) && (prio_tail == prio_head) && !(uart_get_hw(UART_ID)->fr & UART_UARTFR_BUSY_BITS);
+}
+
+bool uart_tx_put( char ch ){
+	uint16_t next = (tx_head+1) & UART_TX_MASK;
+	if( next == tx_tail )
+		return false; // queue is full
+	tx_buffer[tx_head] = ch;
+	set_split( tx_head, true );
+	tx_head = next;
+	uart_tx_kick();
+	return true;
+}
+
+static void tx_copy( const char *buf, uint len, bool split_each ){
+	// the head moves once all the bytes (and split bits) are written
+	uint16_t head = tx_head;
+	for( uint i=0; i<len; i++ ){
+		tx_buffer[head] = buf[i];
+		set_split( head, split_each || (i==len-1) );
+		head = (head+1) & UART_TX_MASK;
+	}
+	tx_head = head;
+}
+
+uint uart_tx_write( const char *buf, uint len ){
+	uint count = uart_tx_free();
+	if( len < count )
+		count = len;
+	if( count>0 ){
+		tx_copy( buf, count, true );
+		uart_tx_kick();
+	}
+	return count;
+}
+
+bool uart_tx_unit( const char *buf, uint len ){
+	// Key (or key escape sequence): never waits, dropped when there is no room
+	if( len > uart_tx_free() ){
+		STATS_INC( tx_dropped );
+		return false;
+	}
+	tx_copy( buf, len, false );
+	uart_tx_kick();
+	return true;
+}
+
+bool uart_tx_reply( const char *buf, uint len ){
+	// Terminal reply (called by the parser): never waits, dropped when the
+	// replies queue is full (the host is not reading them anyway)
+	uint free = UART_PRIO_MASK - ((prio_head - prio_tail) & UART_PRIO_MASK);
+	if( len > free ){
+		STATS_INC( tx_dropped );
+		return false;
+	}
+	uint16_t head = prio_head;
+	for( uint i=0; i<len; i++ ){
+		prio_buffer[head] = buf[i];
+		head = (head+1) & UART_PRIO_MASK;
+	}
+	prio_head = head;
+	uart_tx_kick();
+	return true;
+}
+
+void uart_tx_send( const char *buf, uint len ){
+	// Every byte sent to the host goes through the queue so the keys and the
+	// terminal replies keep their order with the data already queued.
+	while( len>0 ){
+		uint count = uart_tx_write( buf, len );
+		buf += count;
+		len -= count;
+	}
+}
@@ -0,0 +1,33 @@
+/* ==========================================================================
+    Interrupt driven transmission of data to the host UART.
+
+		Data is queued into a ring buffer and pushed to the UART from the
+		UART IRQ (TX holding register empty). Nothing waits on the wire.
+
+		The terminal replies (DA, DSR, CPR) have their own small queue, sent
+		before the pending data as soon as the byte on the wire ends a unit
+		(a key or its escape sequence is never split by a reply).
+   ========================================================================== */
+
+#ifndef _PICOTERM_UART_H
+#define _PICOTERM_UART_H
+
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+#define UART_TX_BUFFER_SIZE 1024 // must be a power of 2
+#define UART_TX_RESERVE     64   // room left by the bulk senders (file streaming) for the keyboard
+#define UART_TX_PRIO_SIZE   64   // terminal replies queue, must be a power of 2
+
+void uart_tx_init();   // reset the queue (call after uart_init)
+bool uart_tx_put( char ch ); // queue one char, false when the queue is full
+uint uart_tx_write( const char *buf, uint len ); // queue as much as possible, return the count of queued bytes
+void uart_tx_send( const char *buf, uint len ); // queue all the bytes (waits only when the queue is full)
+bool uart_tx_unit( const char *buf, uint len ); // queue all the bytes or none, never split by a reply
+bool uart_tx_reply( const char *buf, uint len ); // priority queue, all the bytes or none
+uint uart_tx_free();   // room left in the queue
+bool uart_tx_empty();  // queues empty AND last byte left the holding register
+
+void on_uart_tx();     // must be called from the UART IRQ handler
+
+#endif
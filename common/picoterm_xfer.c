@@ -0,0 +1,1429 @@
+/* ==========================================================================
+    XMODEM / YMODEM / ZMODEM file transfers between the host and the SD card.
+
+		Receive: XMODEM-CRC & XMODEM-1K (128 and 1024 bytes blocks), YMODEM batch,
+		         ZMODEM batch (streaming, CRC-16 or CRC-32).
+		Send   : XMODEM (checksum or CRC), XMODEM-1K, YMODEM (single file batch),
+		         ZMODEM (single file, windowed streaming).
+
+		The UART RX IRQ (see main.c::on_uart_rx) hands the received bytes to
+		xfer_rx_byte() while a transfer is running, so they never reach the
+		terminal parser. The bytes are sent through the interrupt driven queue
+		of picoterm_uart.c.
+
+		The SD card is accessed with two 4 KB buffers. When receiving, a block
+		is acknowledged as soon as it is checked; a full buffer is written to
+		the SD while the host is sending the next block. When sending, the next
+		buffer is read while the current block is on the wire. ZMODEM does not
+		wait for the acknowledges: the subpackets are streamed into the same
+		buffers and a ZRPOS rewinds the transfer after an error.
+   ========================================================================== */
+
+#include "picoterm_xfer.h"
+#include "picoterm_uart.h"
+#include "pio_sd.h"
+#include "pico/stdlib.h"
+#include "keybd.h" // keybd_poll
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../pio_fatfs/ff.h"
+#include "picoterm_debug.h"
+#include "picoterm_trace.h"
+
+#define SOH    0x01
+#define STX    0x02
+#define EOT    0x04
+#define ACK    0x06
+#define NAK    0x15
+#define CAN    0x18
+#define CPMEOF 0x1A
+#define CRC_REQUEST 'C'
+
+// xfer_read_block() & xfer_getc() results
+#define BLOCK_EOT     0
+#define BLOCK_ERROR  -1  // timeout, bad header or CRC
+#define BLOCK_CANCEL -2  // cancelled by the host
+#define BLOCK_ABORT  -3  // cancelled by the user
+
+#define XFER_START_MS     3000  // 'C' repeated until the sender starts
+#define XFER_START_TRIES  20    // so one minute to start the other side
+#define XFER_BLOCK_MS     10000 // response to a block
+#define XFER_CHAR_MS      1000  // between the bytes of a block
+#define XFER_PURGE_MS     500   // line silence before a NAK
+#define XFER_PROGRESS_MS  250   // progress callback while waiting
+
+#define RX_MASK (XFER_RX_BUFFER_SIZE-1)
+
+static char rx_buffer[XFER_RX_BUFFER_SIZE];
+static volatile uint16_t rx_head = 0; // written by the IRQ
+static volatile uint16_t rx_tail = 0;
+static volatile bool transferring = false;
+
+static uint8_t block_data[1024+1]; // +1 to terminate the YMODEM header
+static uint8_t sd_buffer[2][XFER_SD_BUFFER_SIZE];
+static uint16_t sd_len[2];  // bytes into each buffer
+static bool sd_ready[2];    // receive: full, to be written. send: loaded from the file
+static uint8_t sd_active;   // buffer being filled (receive) or sent (send)
+static bool sd_sending;     // direction of the SD buffers
+static bool sd_eof;
+static bool sd_error;
+static FIL xfer_file;
+static DWORD xfer_linkmap[SD_LINKMAP_SIZE];
+
+static xfer_status_t *st;
+static xfer_progress_t progress_cb;
+static bool user_abort;
+static uint64_t last_progress_us;
+
+bool xfer_rx_byte( char ch ){
+	// Called from the UART RX IRQ.
+	if( !transferring )
+		return false;
+	uint16_t next = (rx_head+1) & RX_MASK;
+	if( next != rx_tail ){
+		rx_buffer[rx_head] = ch;
+		rx_head = next;
+	}
+	// else overflow: the CRC will fail and the block is sent again
+	return true;
+}
+
+bool is_transferring(){
+	return transferring;
+}
+
+static uint16_t crc16_update( uint16_t crc, uint8_t data ){
+	// CRC-16/XMODEM (polynomial 0x1021, initial value 0)
+	crc ^= (uint16_t)data << 8;
+	for( int i=0; i<8; i++ )
+		crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+	return crc;
+}
+
+static uint16_t crc16( const uint8_t *data, uint len ){
+	uint16_t crc = 0;
+	while( len-- )
+		crc = crc16_update( crc, *data++ );
+	return crc;
+}
+
+static uint32_t crc32_update( uint32_t crc, uint8_t data ){
+	// CRC-32 (reflected polynomial 0xEDB88320), start with 0xFFFFFFFF
+	crc ^= data;
+	for( int i=0; i<8; i++ )
+		crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+	return crc;
+}
+
+//---------------------------------------------------------------------------
+//  SD buffers
+//---------------------------------------------------------------------------
+
+static void sd_reset( bool sending ){
+	sd_len[0] = 0;
+	sd_len[1] = 0;
+	sd_ready[0] = false;
+	sd_ready[1] = false;
+	sd_active = 0;
+	sd_sending = sending;
+	sd_eof = false;
+	sd_error = false;
+}
+
+static bool sd_write( uint8_t idx ){
+	UINT bw;
+	FRESULT fr = f_write( &xfer_file, sd_buffer[idx], sd_len[idx], &bw );
+	if( (fr != FR_OK) || (bw != sd_len[idx]) ){ // see FRESULT in ff.h
+			TRACE( TR_XFER_WRITE_ERROR, fr, 0 );
+			st->error = "SD write error";
+			sd_error = true;
+	}
+	sd_len[idx] = 0;
+	sd_ready[idx] = false;
+	return !sd_error;
+}
+
+static bool sd_read( uint8_t idx ){
+	UINT br;
+	FRESULT fr = f_read( &xfer_file, sd_buffer[idx], XFER_SD_BUFFER_SIZE, &br );
+	if (fr != FR_OK) { // see FRESULT in ff.h
+			TRACE( TR_XFER_READ_ERROR, fr, 0 );
+			st->error = "SD read error";
+			sd_error = true;
+			br = 0;
+	}
+	sd_len[idx] = br;
+	sd_ready[idx] = true;
+	if( br < XFER_SD_BUFFER_SIZE )
+		sd_eof = true;
+	return !sd_error;
+}
+
+static void sd_background(){
+	// SD access performed while waiting for the host
+	uint8_t idle = 1-sd_active;
+	if( sd_error )
+		return;
+	if( sd_sending ){
+		if( !sd_ready[idle] && !sd_eof && sd_ready[sd_active] )
+			sd_read( idle ); // prefetch the next chunk of the file
+	}
+	else if( sd_ready[idle] )
+		sd_write( idle );
+}
+
+static bool sd_store( const uint8_t *data, uint len ){
+	// append received data to the active buffer
+	while( len>0 ){
+		uint count = XFER_SD_BUFFER_SIZE - sd_len[sd_active];
+		if( count > len )
+			count = len;
+		memcpy( sd_buffer[sd_active]+sd_len[sd_active], data, count );
+		sd_len[sd_active] += count;
+		data += count;
+		len -= count;
+		if( sd_len[sd_active] == XFER_SD_BUFFER_SIZE ){
+			uint8_t idle = 1-sd_active;
+			if( sd_ready[idle] )
+				sd_write( idle ); // not yet written in the background
+			sd_ready[sd_active] = true;
+			sd_active = idle;
+		}
+	}
+	return !sd_error;
+}
+
+static bool sd_flush(){
+	uint8_t idle = 1-sd_active;
+	if( sd_ready[idle] )
+		sd_write( idle );
+	if( sd_len[sd_active] > 0 )
+		sd_write( sd_active );
+	return !sd_error;
+}
+
+//---------------------------------------------------------------------------
+//  Serial line
+//---------------------------------------------------------------------------
+
+static bool xfer_progress(){
+	last_progress_us = time_us_64();
+	if( !progress_cb( st ) )
+		user_abort = true;
+	return !user_abort;
+}
+
+static bool xfer_keepalive(){
+	// keyboard, SD and progress while waiting for the host
+	keybd_poll();
+	sd_background();
+	if( time_us_64() - last_progress_us >= XFER_PROGRESS_MS*1000 )
+		xfer_progress();
+	return !user_abort;
+}
+
+static int xfer_getc( uint32_t timeout_ms ){
+	uint64_t limit = time_us_64() + (uint64_t)timeout_ms*1000;
+	while( rx_tail == rx_head ){
+		if( !xfer_keepalive() )
+			return BLOCK_ABORT;
+		if( time_us_64() > limit )
+			return BLOCK_ERROR;
+	}
+	uint8_t ch = rx_buffer[rx_tail];
+	rx_tail = (rx_tail+1) & RX_MASK;
+	return ch;
+}
+
+static void xfer_write( const uint8_t *buf, uint len ){
+	// queue everything, waiting for room into the UART queue
+	while( len>0 ){
+		uint count = uart_tx_write( (const char *)buf, len );
+		buf += count;
+		len -= count;
+		if( len>0 )
+			keybd_poll();
+	}
+}
+
+static void xfer_putc( uint8_t ch ){
+	xfer_write( &ch, 1 );
+}
+
+static void xfer_cancel(){
+	static const uint8_t cancel[] = { CAN, CAN, CAN, CAN, CAN };
+	xfer_write( cancel, sizeof(cancel) );
+}
+
+static void xfer_purge(){
+	// wait for the line to be silent (rest of a damaged block)
+	while( xfer_getc( XFER_PURGE_MS ) >= 0 );
+}
+
+//---------------------------------------------------------------------------
+//  Session
+//---------------------------------------------------------------------------
+
+static bool xfer_begin( xfer_status_t *status, xfer_progress_t progress ){
+	memset( status, 0, sizeof(xfer_status_t) );
+	st = status;
+	progress_cb = progress;
+	user_abort = false;
+	if( is_streaming() ){
+		st->error = "UART busy (send_file)";
+		return false;
+	}
+	if( !is_sd_mount() ){ // will attempt to remount
+		st->error = "SD mount error";
+		return false;
+	}
+	rx_tail = rx_head;
+	last_progress_us = time_us_64();
+	transferring = true;
+	return true;
+}
+
+static bool xfer_end( bool ok ){
+	transferring = false;
+	sprintf( debug_msg, "xfer: %s %lu bytes, %u errors, %s", st->filename, st->done, st->errors, ok ? "ok" : st->error );
+	debug_print( debug_msg );
+	return ok;
+}
+
+static bool xfer_open( char *filename, BYTE mode ){
+	FRESULT fr;
+	strncpy( st->filename, filename, XFER_NAME_SIZE-1 );
+	st->filename[XFER_NAME_SIZE-1] = 0;
+	st->done = 0;
+	st->start_us = time_us_64();
+	sd_reset( (mode & FA_READ)==FA_READ );
+
+	fr = f_open( &xfer_file, st->filename, mode );
+	if (fr != FR_OK) { // see FRESULT in ff.h
+			sprintf( debug_msg, "xfer: open error %d on %s", fr, st->filename );
+			debug_print( debug_msg );
+			st->error = "File open error";
+			return false;
+	}
+	if( (mode & FA_READ)==FA_READ )
+		sd_fast_seek( &xfer_file, xfer_linkmap, SD_LINKMAP_SIZE );
+	return true;
+}
+
+//---------------------------------------------------------------------------
+//  Receive
+//---------------------------------------------------------------------------
+
+static int xfer_read_block( uint8_t *num, uint32_t timeout_ms ){
+	// Read a block into block_data. Returns the block size or BLOCK_xxx.
+	int size, ch = xfer_getc( timeout_ms );
+	switch( ch ){
+		case SOH:
+			size = 128;
+			break;
+		case STX:
+			size = 1024;
+			break;
+		case EOT:
+			return BLOCK_EOT;
+		case CAN:
+			return (xfer_getc( XFER_CHAR_MS )==CAN) ? BLOCK_CANCEL : BLOCK_ERROR;
+		case BLOCK_ABORT:
+			return BLOCK_ABORT;
+		default:
+			return BLOCK_ERROR;
+	}
+	int blk = xfer_getc( XFER_CHAR_MS );
+	int inv = xfer_getc( XFER_CHAR_MS );
+	for( int i=0; i<size; i++ ){
+		if( (ch = xfer_getc( XFER_CHAR_MS )) < 0 )
+			return user_abort ? BLOCK_ABORT : BLOCK_ERROR;
+		block_data[i] = ch;
+	}
+	int crc_hi = xfer_getc( XFER_CHAR_MS );
+	int crc_lo = xfer_getc( XFER_CHAR_MS );
+	if( user_abort )
+		return BLOCK_ABORT;
+	if( (blk<0) || (inv<0) || (crc_hi<0) || (crc_lo<0) || ((blk ^ inv) != 0xFF) )
+		return BLOCK_ERROR;
+	if( crc16( block_data, size ) != (uint16_t)((crc_hi << 8) | crc_lo) )
+		return BLOCK_ERROR;
+	block_data[size] = 0;
+	*num = blk;
+	return size;
+}
+
+static bool receive_data( bool ymodem ){
+	// Blocks 1..n of the opened file up to the EOT.
+	// With YMODEM, the data beyond the announced size (padding) is dropped.
+	uint8_t expected = 1, num;
+	int errors = 0;
+	bool started = false;
+	bool eot_nak = false;
+
+	xfer_putc( CRC_REQUEST );
+	while( true ){
+		int len = xfer_read_block( &num, started ? XFER_BLOCK_MS : XFER_START_MS );
+		if( len>0 ){
+			if( num==expected ){
+				uint32_t count = len;
+				if( (st->size>0) && (st->done+count > st->size) )
+					count = st->size - st->done;
+				xfer_putc( ACK ); // the host sends the next block while we store this one
+				if( !sd_store( block_data, count ) ){
+					xfer_cancel();
+					return false;
+				}
+				st->done += count;
+				expected++;
+				started = true;
+				errors = 0;
+				if( !xfer_progress() ){
+					xfer_cancel();
+					st->error = "User abort";
+					return false;
+				}
+				continue;
+			}
+			if( num==(uint8_t)(expected-1) ){
+				xfer_putc( ACK ); // our ACK was lost, block already stored
+				continue;
+			}
+			xfer_cancel();
+			st->error = "Block sequence error";
+			return false;
+		}
+
+		switch( len ){
+			case BLOCK_EOT:
+				if( ymodem && !eot_nak ){
+					eot_nak = true; // YMODEM: the EOT must be sent twice
+					xfer_putc( NAK );
+					continue;
+				}
+				xfer_putc( ACK );
+				return sd_flush();
+			case BLOCK_CANCEL:
+				st->error = "Cancelled by host";
+				return false;
+			case BLOCK_ABORT:
+				xfer_cancel();
+				st->error = "User abort";
+				return false;
+		}
+		// timeout or damaged block
+		if( ++errors > (started ? XFER_MAX_ERRORS : XFER_START_TRIES) ){
+			xfer_cancel();
+			st->error = started ? "Too many errors" : "No sender";
+			return false;
+		}
+		if( started ){
+			st->errors++;
+			xfer_purge();
+		}
+		xfer_putc( started ? NAK : CRC_REQUEST );
+	}
+}
+
+bool xmodem_receive( char *filename, xfer_status_t *status, xfer_progress_t progress ){
+	// XMODEM has no file size: the last block is stored with its padding.
+	if( !xfer_begin( status, progress ) )
+		return false;
+	if( !xfer_open( filename, FA_WRITE | FA_CREATE_ALWAYS ) )
+		return xfer_end( false );
+	bool ok = receive_data( false );
+	f_close( &xfer_file );
+	if( ok )
+		st->files++;
+	return xfer_end( ok );
+}
+
+bool ymodem_receive( xfer_status_t *status, xfer_progress_t progress ){
+	// Block 0 gives the file name and size. An empty name ends the batch.
+	uint8_t num;
+	bool ok = true;
+	if( !xfer_begin( status, progress ) )
+		return false;
+
+	while( ok ){
+		int len, errors = 0;
+		do {
+			xfer_putc( CRC_REQUEST );
+			len = xfer_read_block( &num, XFER_START_MS );
+			if( len==BLOCK_EOT ){
+				xfer_putc( ACK ); // last EOT sent again (our ACK was lost)
+				len = BLOCK_ERROR;
+			}
+		} while( (len==BLOCK_ERROR) && (++errors < XFER_START_TRIES) );
+
+		if( (len<=0) || (num!=0) ){
+			st->error = (len==BLOCK_CANCEL) ? "Cancelled by host" : (len==BLOCK_ABORT) ? "User abort" : "No YMODEM header";
+			if( len!=BLOCK_CANCEL )
+				xfer_cancel();
+			ok = false;
+			break;
+		}
+		if( block_data[0]==0 ){
+			xfer_putc( ACK ); // end of batch
+			break;
+		}
+
+		char *name = strrchr( (char *)block_data, '/' ); // store at the current folder
+		name = (name==NULL) ? (char *)block_data : name+1;
+		st->size = atol( (char *)block_data + strlen((char *)block_data) + 1 );
+		if( !xfer_open( name, FA_WRITE | FA_CREATE_ALWAYS ) ){
+			xfer_cancel();
+			ok = false;
+			break;
+		}
+		xfer_putc( ACK );
+		ok = receive_data( true );
+		f_close( &xfer_file );
+		if( ok )
+			st->files++;
+	}
+	return xfer_end( ok );
+}
+
+//---------------------------------------------------------------------------
+//  Send
+//---------------------------------------------------------------------------
+
+static int xfer_wait_response( uint32_t timeout_ms ){
+	// ACK, NAK, 'C' or CAN from the receiver (BLOCK_ERROR on timeout)
+	while( true ){
+		int ch = xfer_getc( timeout_ms );
+		if( ch<0 )
+			return ch;
+		if( (ch==ACK) || (ch==NAK) || (ch==CRC_REQUEST) )
+			return ch;
+		if( (ch==CAN) && (xfer_getc( XFER_CHAR_MS )==CAN) )
+			return CAN;
+		// noise, ignored
+	}
+}
+
+static int xfer_wait_start(){
+	// 'C' (CRC) or NAK (checksum) from the receiver
+	for( int i=0; i<XFER_START_TRIES; i++ ){
+		int ch = xfer_wait_response( XFER_START_MS );
+		if( (ch==CRC_REQUEST) || (ch==NAK) || (ch==CAN) || (ch==BLOCK_ABORT) )
+			return ch;
+	}
+	return BLOCK_ERROR;
+}
+
+static bool send_block( uint8_t num, int size, bool crc ){
+	// send block_data until acknowledged
+	uint8_t header[3] = { size==1024 ? STX : SOH, num, ~num };
+	uint8_t trailer[2];
+
+	if( crc ){
+		uint16_t value = crc16( block_data, size );
+		trailer[0] = value >> 8;
+		trailer[1] = value & 0xFF;
+	}
+	else {
+		trailer[0] = 0;
+		for( int i=0; i<size; i++ )
+			trailer[0] += block_data[i];
+	}
+
+	for( int tries=0; tries<XFER_MAX_ERRORS; tries++ ){
+		xfer_write( header, sizeof(header) );
+		xfer_write( block_data, size );
+		xfer_write( trailer, crc ? 2 : 1 );
+		switch( xfer_wait_response( XFER_BLOCK_MS ) ){
+			case ACK:
+				return !sd_error; // prefetch may have failed
+			case CAN:
+				st->error = "Cancelled by receiver";
+				return false;
+			case BLOCK_ABORT:
+				xfer_cancel();
+				st->error = "User abort";
+				return false;
+		}
+		st->errors++; // NAK, 'C' or timeout: send it again
+	}
+	xfer_cancel();
+	st->error = "Too many errors";
+	return false;
+}
+
+static bool send_end(){
+	// EOT until acknowledged (YMODEM receivers NAK the first one)
+	for( int tries=0; tries<XFER_MAX_ERRORS; tries++ ){
+		xfer_putc( EOT );
+		switch( xfer_wait_response( XFER_BLOCK_MS ) ){
+			case ACK:
+				return true;
+			case CAN:
+				st->error = "Cancelled by receiver";
+				return false;
+			case BLOCK_ABORT:
+				xfer_cancel();
+				st->error = "User abort";
+				return false;
+		}
+	}
+	st->error = "EOT not acknowledged";
+	return false;
+}
+
+static bool send_data( bool use_1k, bool crc ){
+	// Blocks 1..n of the opened file then EOT. 1K blocks are used as long as
+	// a full block remains, so the padding never exceeds 127 bytes.
+	uint8_t num = 1;
+	uint16_t pos = 0;
+
+	if( !sd_read( sd_active ) )
+		return false;
+	while( true ){
+		if( pos >= sd_len[sd_active] ){
+			// buffer sent, continue with the prefetched one
+			if( sd_len[sd_active] < XFER_SD_BUFFER_SIZE )
+				break; // end of file
+			sd_ready[sd_active] = false;
+			sd_active = 1-sd_active;
+			pos = 0;
+			if( !sd_ready[sd_active] && !sd_read( sd_active ) )
+				return false;
+			if( sd_len[sd_active]==0 )
+				break;
+		}
+		uint remain = sd_len[sd_active] - pos;
+		int size = (use_1k && (remain >= 1024)) ? 1024 : 128;
+		uint count = (remain < size) ? remain : size;
+		memcpy( block_data, sd_buffer[sd_active]+pos, count );
+		memset( block_data+count, CPMEOF, size-count );
+		if( !send_block( num, size, crc ) )
+			return false;
+		pos += count;
+		num++;
+		st->done += count;
+		if( !xfer_progress() ){
+			xfer_cancel();
+			st->error = "User abort";
+			return false;
+		}
+	}
+	return send_end();
+}
+
+static bool xfer_send_start( char *filename ){
+	if( !xfer_open( filename, FA_READ ) )
+		return false;
+	st->size = f_size( &xfer_file );
+	return true;
+}
+
+bool xmodem_send( char *filename, bool use_1k, xfer_status_t *status, xfer_progress_t progress ){
+	if( !xfer_begin( status, progress ) )
+		return false;
+	if( !xfer_send_start( filename ) )
+		return xfer_end( false );
+
+	bool ok = false;
+	int ch = xfer_wait_start();
+	if( (ch==CRC_REQUEST) || (ch==NAK) )
+		ok = send_data( use_1k && (ch==CRC_REQUEST), ch==CRC_REQUEST ); // 1K needs CRC
+	else
+		st->error = (ch==BLOCK_ABORT) ? "User abort" : (ch==CAN) ? "Cancelled by receiver" : "No receiver";
+	f_close( &xfer_file );
+	if( ok )
+		st->files++;
+	return xfer_end( ok );
+}
+
+bool ymodem_send( char *filename, xfer_status_t *status, xfer_progress_t progress ){
+	if( !xfer_begin( status, progress ) )
+		return false;
+	if( !xfer_send_start( filename ) )
+		return xfer_end( false );
+
+	bool ok = false;
+	if( xfer_wait_start()!=CRC_REQUEST )
+		st->error = user_abort ? "User abort" : "No YMODEM receiver";
+	else {
+		// block 0: "name\0size"
+		char *name = strrchr( st->filename, '/' );
+		name = (name==NULL) ? st->filename : name+1;
+		memset( block_data, 0, 128 );
+		strcpy( (char *)block_data, name );
+		sprintf( (char *)block_data + strlen(name) + 1, "%lu", st->size );
+		if( send_block( 0, 128, true ) ){
+			if( xfer_wait_start()==CRC_REQUEST )
+				ok = send_data( true, true );
+			else
+				st->error = user_abort ? "User abort" : "Receiver not ready";
+		}
+	}
+	f_close( &xfer_file );
+
+	if( ok ){
+		st->files++;
+		// empty block 0 ends the batch
+		if( xfer_wait_start()==CRC_REQUEST ){
+			memset( block_data, 0, 128 );
+			send_block( 0, 128, true );
+		}
+	}
+	return xfer_end( ok );
+}
+
+//---------------------------------------------------------------------------
+//  ZMODEM
+//
+//  Headers are received in hex, binary CRC-16 or binary CRC-32 form. The
+//  data subpackets use the CRC of the header that started the frame.
+//  The receiver streams (buffer size 0, CANOVIO): an error is reported
+//  with a ZRPOS and the sender resumes from the last good position.
+//  The sender streams ZCRCG subpackets and asks a ZACK (ZCRCQ) regularly;
+//  it waits when ZM_WINDOW bytes are not acknowledged (or at the buffer
+//  size announced by the receiver, with ZCRCW).
+//---------------------------------------------------------------------------
+
+#define XON    0x11
+#define XOFF   0x13
+#define ZPAD   '*'
+#define ZDLE   0x18
+#define ZBIN   'A'
+#define ZHEX   'B'
+#define ZBIN32 'C'
+
+// frame types
+#define ZRQINIT    0
+#define ZRINIT     1
+#define ZSINIT     2
+#define ZACK       3
+#define ZFILE      4
+#define ZSKIP      5
+#define ZNAK       6
+#define ZABORT     7
+#define ZFIN       8
+#define ZRPOS      9
+#define ZDATA      10
+#define ZEOF       11
+#define ZFERR      12
+#define ZCHALLENGE 14
+
+// ZDLE sequences
+#define ZCRCE 'h' // end of frame, header follows
+#define ZCRCG 'i' // frame continues nonstop
+#define ZCRCQ 'j' // frame continues, ZACK expected
+#define ZCRCW 'k' // end of frame, ZACK expected
+#define ZRUB0 'l' // 0x7F
+#define ZRUB1 'm' // 0xFF
+#define ZM_FRAME_END 0x100 // zm_getc_zdle(): ZDLE + ZCRCx
+
+// ZRINIT flags (ZF0)
+#define CANFDX  0x01 // full duplex
+#define CANOVIO 0x02 // receives during disk I/O
+#define CANFC32 0x20 // CRC-32 frames
+#define ESCCTL  0x40 // all control chars must be escaped
+#define ZCBIN   1    // ZFILE ZF0: binary transfer
+
+#define ZM_SUBPACKET  1024 // data bytes per subpacket (max received)
+#define ZM_WINDOW     8192 // bytes sent without ZACK
+#define ZM_ACK_EVERY  2048 // ZCRCQ interval
+#define ZM_MAX_GARBAGE 16384 // bytes skipped while looking for a header (data in flight after a ZRPOS)
+#define ZM_SKIPPED    -4   // zm_send_file_header(): file refused by the receiver
+
+static bool zm_rx_crc32;     // CRC of the last header received (and its data)
+static bool zm_tx_crc32;     // receiver accepts CRC-32 (CANFC32)
+static bool zm_escctl;       // receiver wants all control chars escaped
+static uint16_t zm_rx_bufsize; // receiver buffer size (0: streaming)
+static uint8_t zm_last_sent;
+static uint8_t zm_tx[2*ZM_SUBPACKET+16]; // encoded subpacket
+static uint32_t sd_base;     // file offset of sd_buffer[sd_active] (send)
+static const uint8_t zm_zero[4] = { 0, 0, 0, 0 };
+
+static uint32_t zm_pos( const uint8_t *hdr ){
+	return hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+}
+
+static void zm_set_pos( uint8_t *hdr, uint32_t pos ){
+	hdr[0] = pos & 0xFF;
+	hdr[1] = (pos >> 8) & 0xFF;
+	hdr[2] = (pos >> 16) & 0xFF;
+	hdr[3] = pos >> 24;
+}
+
+static int zm_getc( uint32_t timeout_ms ){
+	// next byte from the line, XON/XOFF are ignored
+	int ch;
+	do {
+		ch = xfer_getc( timeout_ms );
+	} while( (ch>=0) && (((ch & 0x7F)==XON) || ((ch & 0x7F)==XOFF)) );
+	return ch;
+}
+
+static int zm_getc_zdle( uint32_t timeout_ms ){
+	// next byte with the ZDLE escape decoded. A frame end is returned as
+	// ZM_FRAME_END | ZCRCx, five CAN as BLOCK_CANCEL.
+	int ch = zm_getc( timeout_ms );
+	if( ch!=ZDLE )
+		return ch;
+	for( int cancels=1; ; cancels++ ){
+		ch = zm_getc( timeout_ms );
+		if( ch!=CAN )
+			break;
+		if( cancels==4 )
+			return BLOCK_CANCEL;
+	}
+	switch( ch ){
+		case ZCRCE:
+		case ZCRCG:
+		case ZCRCQ:
+		case ZCRCW:
+			return ZM_FRAME_END | ch;
+		case ZRUB0:
+			return 0x7F;
+		case ZRUB1:
+			return 0xFF;
+	}
+	if( (ch>=0) && ((ch & 0x60)==0x40) )
+		return ch ^ 0x40;
+	return (ch<0) ? ch : BLOCK_ERROR;
+}
+
+static int zm_get_hex( ){
+	// one byte as 2 hex digits
+	int value = 0;
+	for( int i=0; i<2; i++ ){
+		int ch = zm_getc( XFER_CHAR_MS );
+		if( (ch>='0') && (ch<='9') )
+			value = (value << 4) | (ch-'0');
+		else if( (ch>='a') && (ch<='f') )
+			value = (value << 4) | (ch-'a'+10);
+		else if( (ch>='A') && (ch<='F') )
+			value = (value << 4) | (ch-'A'+10);
+		else
+			return (ch<0) ? ch : BLOCK_ERROR;
+	}
+	return value;
+}
+
+static int zm_get_header_body( uint8_t *hdr, char format ){
+	// type + 4 bytes + CRC after ZPAD ZDLE <format>
+	uint8_t raw[9];
+	int len = (format==ZHEX) ? 7 : (format==ZBIN32) ? 9 : 7;
+	for( int i=0; i<len; i++ ){
+		int ch = (format==ZHEX) ? zm_get_hex() : zm_getc_zdle( XFER_CHAR_MS );
+		if( ch<0 )
+			return ch;
+		if( ch & ZM_FRAME_END )
+			return BLOCK_ERROR;
+		raw[i] = ch;
+	}
+	if( format==ZBIN32 ){
+		uint32_t crc = 0xFFFFFFFF;
+		for( int i=0; i<5; i++ )
+			crc = crc32_update( crc, raw[i] );
+		if( ~crc != (raw[5] | (raw[6] << 8) | (raw[7] << 16) | ((uint32_t)raw[8] << 24)) )
+			return BLOCK_ERROR;
+	}
+	else if( crc16( raw, 5 ) != ((raw[5] << 8) | raw[6]) )
+		return BLOCK_ERROR;
+	if( format==ZHEX ){
+		zm_getc( XFER_PURGE_MS ); // CR
+		zm_getc( XFER_PURGE_MS ); // LF (with the parity bit)
+	}
+	zm_rx_crc32 = (format==ZBIN32);
+	memcpy( hdr, raw+1, 4 );
+	return raw[0];
+}
+
+static int zm_get_header( uint8_t *hdr, uint32_t timeout_ms ){
+	// Wait for a header. Returns the frame type (hdr: the 4 bytes) or BLOCK_xxx.
+	// The bytes before the ZPAD (rest of a damaged subpacket) are skipped.
+	int cancels = 0, garbage = 0;
+	while( true ){
+		int ch = zm_getc( timeout_ms );
+		if( ch<0 )
+			return ch;
+		if( ch==CAN ){
+			if( ++cancels == 5 )
+				return BLOCK_CANCEL;
+			continue;
+		}
+		cancels = 0;
+		if( ch!=ZPAD ){
+			if( ++garbage > ZM_MAX_GARBAGE )
+				return BLOCK_ERROR;
+			continue;
+		}
+		do {
+			ch = zm_getc( XFER_CHAR_MS );
+		} while( ch==ZPAD );
+		if( ch!=ZDLE ){
+			if( ch<0 )
+				return ch;
+			continue;
+		}
+		ch = zm_getc( XFER_CHAR_MS );
+		if( (ch==ZHEX) || (ch==ZBIN) || (ch==ZBIN32) )
+			return zm_get_header_body( hdr, ch );
+		if( ch<0 )
+			return ch;
+	}
+}
+
+static int zm_get_data( int *end ){
+	// data subpacket into block_data. Returns the length (end: ZCRCx) or BLOCK_xxx.
+	uint32_t crc32 = 0xFFFFFFFF;
+	uint16_t crc = 0;
+	int len = 0;
+	while( true ){
+		int ch = zm_getc_zdle( XFER_CHAR_MS );
+		if( ch<0 )
+			return user_abort ? BLOCK_ABORT : ch;
+		if( zm_rx_crc32 )
+			crc32 = crc32_update( crc32, ch & 0xFF );
+		else
+			crc = crc16_update( crc, ch & 0xFF );
+		if( ch & ZM_FRAME_END ){
+			*end = ch & 0xFF;
+			break;
+		}
+		if( len == ZM_SUBPACKET )
+			return BLOCK_ERROR; // larger than the buffer
+		block_data[len++] = ch;
+	}
+	uint32_t value = 0;
+	for( int i=0; i<(zm_rx_crc32 ? 4 : 2); i++ ){
+		int ch = zm_getc_zdle( XFER_CHAR_MS );
+		if( (ch<0) || (ch & ZM_FRAME_END) )
+			return (ch<0) ? ch : BLOCK_ERROR;
+		value = zm_rx_crc32 ? value | ((uint32_t)ch << (8*i)) : (value << 8) | ch; // CRC-32 LSB first
+	}
+	if( zm_rx_crc32 ? (~crc32 != value) : (crc != value) )
+		return BLOCK_ERROR;
+	return len;
+}
+
+static uint zm_escape( uint8_t ch, uint8_t *out ){
+	// ZDLE encoding of one byte, returns 1 or 2
+	bool escape;
+	switch( ch ){
+		case ZDLE:
+		case 0x10: case 0x90: // DLE
+		case XON:  case XON|0x80:
+		case XOFF: case XOFF|0x80:
+			escape = true;
+			break;
+		case '\r': case '\r'|0x80:
+			escape = zm_escctl || ((zm_last_sent & 0x7F)=='@'); // telnet CR @ CR
+			break;
+		default:
+			escape = zm_escctl && ((ch & 0x60)==0);
+	}
+	zm_last_sent = ch;
+	if( !escape ){
+		out[0] = ch;
+		return 1;
+	}
+	out[0] = ZDLE;
+	out[1] = ch ^ 0x40;
+	return 2;
+}
+
+static void zm_send_hex_header( uint8_t type, const uint8_t *hdr ){
+	static const char hex[] = "0123456789abcdef";
+	uint8_t raw[7] = { type, hdr[0], hdr[1], hdr[2], hdr[3] };
+	uint8_t buf[22] = { ZPAD, ZPAD, ZDLE, ZHEX };
+	uint len = 4;
+	uint16_t crc = crc16( raw, 5 );
+	raw[5] = crc >> 8;
+	raw[6] = crc & 0xFF;
+	for( int i=0; i<7; i++ ){
+		buf[len++] = hex[raw[i] >> 4];
+		buf[len++] = hex[raw[i] & 0x0F];
+	}
+	buf[len++] = '\r';
+	buf[len++] = '\n' | 0x80;
+	if( (type!=ZFIN) && (type!=ZACK) )
+		buf[len++] = XON; // restart a sender stopped by XOFF
+	xfer_write( buf, len );
+}
+
+static void zm_send_pos( uint8_t type, uint32_t pos ){
+	uint8_t hdr[4];
+	zm_set_pos( hdr, pos );
+	zm_send_hex_header( type, hdr );
+}
+
+static void zm_send_bin_header( uint8_t type, const uint8_t *hdr ){
+	uint8_t raw[9] = { type, hdr[0], hdr[1], hdr[2], hdr[3] };
+	uint len = 3, raw_len;
+	zm_tx[0] = ZPAD;
+	zm_tx[1] = ZDLE;
+	zm_tx[2] = zm_tx_crc32 ? ZBIN32 : ZBIN;
+	if( zm_tx_crc32 ){
+		uint32_t crc = 0xFFFFFFFF;
+		for( int i=0; i<5; i++ )
+			crc = crc32_update( crc, raw[i] );
+		crc = ~crc;
+		for( int i=0; i<4; i++ )
+			raw[5+i] = (crc >> (8*i)) & 0xFF;
+		raw_len = 9;
+	}
+	else {
+		uint16_t crc = crc16( raw, 5 );
+		raw[5] = crc >> 8;
+		raw[6] = crc & 0xFF;
+		raw_len = 7;
+	}
+	for( int i=0; i<raw_len; i++ )
+		len += zm_escape( raw[i], zm_tx+len );
+	xfer_write( zm_tx, len );
+}
+
+static void zm_send_subpacket( const uint8_t *data, uint size, uint8_t end ){
+	// data + ZDLE ZCRCx + CRC, encoded into zm_tx then queued at once
+	uint len = 0;
+	uint32_t crc32 = 0xFFFFFFFF;
+	uint16_t crc = 0;
+	for( uint i=0; i<size; i++ ){
+		if( zm_tx_crc32 )
+			crc32 = crc32_update( crc32, data[i] );
+		else
+			crc = crc16_update( crc, data[i] );
+		len += zm_escape( data[i], zm_tx+len );
+	}
+	zm_tx[len++] = ZDLE;
+	zm_tx[len++] = end;
+	if( zm_tx_crc32 ){
+		crc32 = ~crc32_update( crc32, end );
+		for( int i=0; i<4; i++ )
+			len += zm_escape( (crc32 >> (8*i)) & 0xFF, zm_tx+len );
+	}
+	else {
+		crc = crc16_update( crc, end );
+		len += zm_escape( crc >> 8, zm_tx+len );
+		len += zm_escape( crc & 0xFF, zm_tx+len );
+	}
+	if( end==ZCRCW )
+		zm_tx[len++] = XON;
+	xfer_write( zm_tx, len );
+}
+
+static void zm_progress(){
+	// at most every XFER_PROGRESS_MS (the status row is slow to draw)
+	if( time_us_64() - last_progress_us >= XFER_PROGRESS_MS*1000 )
+		xfer_progress();
+}
+
+//--- ZMODEM receive ---------------------------------------------------------
+
+static void zm_send_rinit(){
+	// streaming receiver (no buffer size), CRC-32 welcome
+	uint8_t hdr[4] = { 0, 0, 0, CANFDX | CANOVIO | CANFC32 };
+	zm_send_hex_header( ZRINIT, hdr );
+}
+
+static bool zm_fail( const char *error, bool cancel ){
+	if( cancel )
+		xfer_cancel();
+	st->error = error;
+	return false;
+}
+
+static bool zm_receive_file(){
+	// data of the opened file, from ZRPOS 0 up to the ZEOF
+	uint8_t hdr[4];
+	int errors = 0;
+
+	zm_send_pos( ZRPOS, 0 );
+	while( true ){
+		int end, len, type = zm_get_header( hdr, XFER_BLOCK_MS );
+		switch( type ){
+			case ZDATA:
+				if( zm_pos(hdr) != st->done ){
+					// frame sent before our ZRPOS, ask again for the right position
+					if( ++errors > XFER_MAX_ERRORS )
+						return zm_fail( "Too many errors", true );
+					zm_send_pos( ZRPOS, st->done );
+					continue;
+				}
+				do {
+					len = zm_get_data( &end );
+					if( len<0 )
+						break;
+					if( !sd_store( block_data, len ) ) // the SD is written while the next subpackets arrive
+						return zm_fail( st->error, true );
+					st->done += len;
+					errors = 0;
+					if( (end==ZCRCQ) || (end==ZCRCW) )
+						zm_send_pos( ZACK, st->done );
+					zm_progress();
+					if( user_abort )
+						return zm_fail( "User abort", true );
+				} while( (end==ZCRCG) || (end==ZCRCQ) );
+				if( len>=0 )
+					continue; // ZCRCE or ZCRCW: next header
+				if( len==BLOCK_CANCEL )
+					return zm_fail( "Cancelled by host", false );
+				if( len==BLOCK_ABORT )
+					return zm_fail( "User abort", true );
+				// damaged subpacket: resume from the last good position
+				st->errors++;
+				if( ++errors > XFER_MAX_ERRORS )
+					return zm_fail( "Too many errors", true );
+				zm_send_pos( ZRPOS, st->done );
+				continue;
+			case ZEOF:
+				if( zm_pos(hdr) != st->done )
+					continue; // sent before our ZRPOS reached the sender
+				return sd_flush();
+			case ZFILE:
+				zm_get_data( &end ); // our ZRPOS was lost
+				zm_send_pos( ZRPOS, st->done );
+				continue;
+			case BLOCK_CANCEL:
+				return zm_fail( "Cancelled by host", false );
+			case BLOCK_ABORT:
+				return zm_fail( "User abort", true );
+		}
+		// timeout, damaged or unexpected header
+		st->errors++;
+		if( ++errors > XFER_MAX_ERRORS )
+			return zm_fail( "Too many errors", true );
+		zm_send_pos( ZRPOS, st->done );
+	}
+}
+
+bool zmodem_receive( xfer_status_t *status, xfer_progress_t progress ){
+	// Batch: ZFILE gives the name and the size of each file, ZFIN ends the session.
+	uint8_t hdr[4];
+	int end, len, errors = 0;
+	bool ok = false, done = false;
+	if( !xfer_begin( status, progress ) )
+		return false;
+
+	zm_send_rinit();
+	while( !done ){
+		int type = zm_get_header( hdr, XFER_START_MS );
+		switch( type ){
+			case ZRQINIT:
+			case ZEOF: // repeated, our ZRINIT was lost
+				zm_send_rinit();
+				continue;
+			case ZSINIT:
+				// attention string (not used)
+				if( zm_get_data( &end )>=0 )
+					zm_send_hex_header( ZACK, zm_zero );
+				else
+					zm_send_hex_header( ZNAK, zm_zero );
+				continue;
+			case ZFILE: {
+				// "name\0size mtime mode ..."
+				len = zm_get_data( &end );
+				if( len<0 ){
+					zm_send_hex_header( ZNAK, zm_zero );
+					continue;
+				}
+				block_data[len] = 0;
+				char *name = strrchr( (char *)block_data, '/' ); // store at the current folder
+				name = (name==NULL) ? (char *)block_data : name+1;
+				st->size = atol( (char *)block_data + strlen((char *)block_data) + 1 );
+				if( !xfer_open( name, FA_WRITE | FA_CREATE_ALWAYS ) ){
+					xfer_cancel();
+					done = true;
+					break;
+				}
+				bool file_ok = zm_receive_file();
+				f_close( &xfer_file );
+				if( !file_ok ){
+					done = true;
+					break;
+				}
+				st->files++;
+				errors = 0;
+				zm_send_rinit(); // ready for the next file
+				continue;
+			}
+			case ZFIN:
+				zm_send_hex_header( ZFIN, zm_zero );
+				zm_getc( XFER_PURGE_MS ); // "OO" (over and out)
+				zm_getc( XFER_PURGE_MS );
+				ok = (st->files > 0);
+				if( !ok )
+					st->error = "No file received";
+				done = true;
+				break;
+			case BLOCK_CANCEL:
+				st->error = "Cancelled by host";
+				done = true;
+				break;
+			case BLOCK_ABORT:
+				zm_fail( "User abort", true );
+				done = true;
+				break;
+			default:
+				// timeout or unexpected header
+				if( ++errors > XFER_START_TRIES ){
+					zm_fail( st->files>0 ? "Too many errors" : "No sender", true );
+					done = true;
+					break;
+				}
+				zm_send_rinit();
+		}
+	}
+	return xfer_end( ok );
+}
+
+//--- ZMODEM send -------------------------------------------------------------
+
+static int zm_fetch( uint32_t pos, uint8_t *buf, uint len ){
+	// Copy the file data at pos from the SD buffers (the next one is read
+	// ahead by sd_background). Seek when the receiver asked an other position.
+	// Returns the count of bytes (0 at the end of the file), -1 on error.
+	uint count = 0;
+	while( count < len ){
+		uint8_t idle = 1-sd_active;
+		uint32_t end = sd_base + sd_len[sd_active];
+		if( sd_ready[sd_active] && (pos >= sd_base) && (pos < end) ){
+			uint n = end - pos;
+			if( n > len-count )
+				n = len-count;
+			memcpy( buf+count, sd_buffer[sd_active] + (pos-sd_base), n );
+			count += n;
+			pos += n;
+			continue;
+		}
+		if( sd_ready[sd_active] && (pos == end) ){
+			if( sd_len[sd_active] < XFER_SD_BUFFER_SIZE )
+				break; // end of file
+			// continue with the next buffer (read now when not yet prefetched)
+			if( !sd_ready[idle] && !sd_read( idle ) )
+				return -1;
+			sd_ready[sd_active] = false;
+			sd_active = idle;
+			sd_base = end;
+			continue;
+		}
+		// position outside of the buffers (ZRPOS)
+		if( f_lseek( &xfer_file, pos ) != FR_OK ){
+			st->error = "SD seek error";
+			return -1;
+		}
+		sd_ready[0] = false;
+		sd_ready[1] = false;
+		sd_eof = false;
+		sd_base = pos;
+		if( !sd_read( sd_active ) )
+			return -1;
+		if( sd_len[sd_active]==0 )
+			break;
+	}
+	return count;
+}
+
+static bool zm_send_init(){
+	// ZRQINIT until the receiver answers with ZRINIT
+	uint8_t hdr[4];
+	for( int tries=0; tries<XFER_START_TRIES; tries++ ){
+		zm_send_hex_header( ZRQINIT, zm_zero );
+		switch( zm_get_header( hdr, XFER_START_MS ) ){
+			case ZRINIT:
+				zm_rx_bufsize = hdr[0] | (hdr[1] << 8);
+				zm_tx_crc32 = (hdr[3] & CANFC32) != 0;
+				zm_escctl = (hdr[3] & ESCCTL) != 0;
+				return true;
+			case ZCHALLENGE:
+				zm_send_hex_header( ZACK, hdr ); // echo the value
+				break;
+			case BLOCK_CANCEL:
+				return zm_fail( "Cancelled by receiver", false );
+			case BLOCK_ABORT:
+				return zm_fail( "User abort", true );
+		}
+	}
+	return zm_fail( "No ZMODEM receiver", true );
+}
+
+static int zm_send_file_header(){
+	// ZFILE + "name\0size mtime mode" until the receiver gives the start
+	// position (ZRPOS) or skips the file. Returns the position or BLOCK_xxx.
+	uint8_t hdr[4] = { 0, 0, 0, ZCBIN };
+	char *name = strrchr( st->filename, '/' );
+	name = (name==NULL) ? st->filename : name+1;
+	memset( block_data, 0, 128 );
+	strcpy( (char *)block_data, name );
+	uint len = strlen(name) + 1;
+	len += sprintf( (char *)block_data + len, "%lu 0 0", st->size ) + 1;
+
+	for( int tries=0; tries<XFER_MAX_ERRORS; tries++ ){
+		zm_send_bin_header( ZFILE, hdr );
+		zm_send_subpacket( block_data, len, ZCRCW );
+		uint8_t answer[4];
+		int type;
+		do {
+			type = zm_get_header( answer, XFER_BLOCK_MS );
+		} while( (type==ZRINIT) || (type==ZACK) ); // repeated answers to ZRQINIT
+		switch( type ){
+			case ZRPOS:
+				return zm_pos( answer );
+			case ZSKIP:
+				return ZM_SKIPPED;
+			case BLOCK_CANCEL:
+			case BLOCK_ABORT:
+				return type;
+		}
+		st->errors++; // ZNAK, timeout: send it again
+	}
+	return BLOCK_ERROR;
+}
+
+static int zm_poll( uint8_t *hdr, uint32_t timeout_ms ){
+	// header from the receiver. With timeout 0, only when bytes are waiting.
+	if( (timeout_ms==0) && (rx_tail==rx_head) )
+		return BLOCK_ERROR;
+	return zm_get_header( hdr, timeout_ms );
+}
+
+static bool zm_send_data( uint32_t pos ){
+	// ZDATA frames from pos then ZEOF, until the receiver asks the next file
+	uint8_t hdr[4];
+	uint32_t acked = pos; // acknowledged by the receiver
+	uint32_t window = (zm_rx_bufsize>0) ? zm_rx_bufsize : ZM_WINDOW;
+	uint16_t blk = (window < ZM_SUBPACKET) ? window : ZM_SUBPACKET;
+	uint32_t last_rpos = pos;
+	bool new_frame = true;
+	int errors = 0;
+
+	if( pos > st->size )
+		pos = acked = st->size;
+	st->done = pos;
+	if( pos==st->size ){
+		zm_set_pos( hdr, pos );
+		zm_send_bin_header( ZEOF, hdr );
+	}
+	while( true ){
+		bool eof = (pos >= st->size);
+		bool full = !eof && (pos - acked + blk > window);
+		int type = zm_poll( hdr, (eof || full) ? XFER_BLOCK_MS : 0 );
+		switch( type ){
+			case ZACK:
+				if( (zm_pos(hdr) > acked) && (zm_pos(hdr) <= pos) )
+					acked = zm_pos(hdr);
+				errors = 0;
+				continue;
+			case ZRPOS:
+				// data lost by the receiver, resume from its position
+				st->errors++;
+				if( zm_pos(hdr) > last_rpos )
+					errors = 0; // progress since the previous error
+				last_rpos = zm_pos(hdr);
+				if( ++errors > XFER_MAX_ERRORS )
+					return zm_fail( "Too many errors", true );
+				pos = acked = (zm_pos(hdr) < st->size) ? zm_pos(hdr) : st->size;
+				st->done = pos;
+				new_frame = true;
+				if( pos==st->size ){
+					zm_set_pos( hdr, pos );
+					zm_send_bin_header( ZEOF, hdr );
+				}
+				continue;
+			case ZRINIT:
+				if( eof )
+					return true; // ZEOF accepted, ready for the next file
+				continue;
+			case ZSKIP:
+				return true;
+			case BLOCK_CANCEL:
+				return zm_fail( "Cancelled by receiver", false );
+			case BLOCK_ABORT:
+				return zm_fail( "User abort", true );
+		}
+		if( eof || full ){
+			// no answer: ZEOF again or resend from the acknowledged position
+			st->errors++;
+			if( ++errors > XFER_MAX_ERRORS )
+				return zm_fail( "Too many errors", true );
+			if( eof && (acked==pos) ){
+				zm_set_pos( hdr, pos );
+				zm_send_bin_header( ZEOF, hdr );
+			}
+			else {
+				pos = acked;
+				new_frame = true;
+			}
+			continue;
+		}
+
+		// next subpacket
+		int len = zm_fetch( pos, block_data, blk );
+		if( len<=0 )
+			return zm_fail( (len<0) ? st->error : "File truncated", true );
+		if( new_frame ){
+			zm_set_pos( hdr, pos );
+			zm_send_bin_header( ZDATA, hdr );
+			new_frame = false;
+		}
+		pos += len;
+		uint8_t end;
+		if( pos >= st->size )
+			end = ZCRCE;
+		else if( pos - acked + blk > window )
+			end = (zm_rx_bufsize>0) ? ZCRCW : ZCRCQ; // window full, ask a ZACK
+		else if( (pos % ZM_ACK_EVERY) < len )
+			end = ZCRCQ;
+		else
+			end = ZCRCG;
+		zm_send_subpacket( block_data, len, end );
+		st->done = pos;
+		if( end==ZCRCW )
+			new_frame = true;
+		if( end==ZCRCE ){
+			zm_set_pos( hdr, pos );
+			zm_send_bin_header( ZEOF, hdr );
+			new_frame = true;
+		}
+		sd_background(); // prefetch while the subpacket is on the wire
+		zm_progress();
+		if( user_abort )
+			return zm_fail( "User abort", true );
+	}
+}
+
+static void zm_send_fin(){
+	// ZFIN until the receiver answers ZFIN, then "OO" (over and out)
+	uint8_t hdr[4];
+	for( int tries=0; tries<3; tries++ ){
+		zm_send_hex_header( ZFIN, zm_zero );
+		if( zm_get_header( hdr, XFER_START_MS )==ZFIN ){
+			xfer_write( (const uint8_t *)"OO", 2 );
+			return;
+		}
+	}
+}
+
+bool zmodem_send( char *filename, xfer_status_t *status, xfer_progress_t progress ){
+	if( !xfer_begin( status, progress ) )
+		return false;
+	if( !xfer_send_start( filename ) )
+		return xfer_end( false );
+
+	zm_tx_crc32 = false;
+	zm_escctl = false;
+	zm_last_sent = 0;
+	sd_base = 0;
+	bool ok = zm_send_init();
+	if( ok ){
+		int pos = zm_send_file_header();
+		if( pos>=0 )
+			ok = zm_send_data( pos );
+		else if( pos!=ZM_SKIPPED )
+			ok = zm_fail( (pos==BLOCK_CANCEL) ? "Cancelled by receiver" : (pos==BLOCK_ABORT) ? "User abort" : "File refused", pos!=BLOCK_CANCEL );
+	}
+	f_close( &xfer_file );
+	if( ok ){
+		st->files++;
+		zm_send_fin();
+	}
+	return xfer_end( ok );
+}
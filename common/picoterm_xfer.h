@@ -0,0 +1,44 @@
+/* ==========================================================================
+    XMODEM / YMODEM / ZMODEM file transfers between the host and the SD card.
+
+		While a transfer runs, the bytes received on the UART are diverted
+		from the terminal to a dedicated ring buffer (see xfer_rx_byte). The
+		data goes to the SD card through two 4 KB buffers; a full buffer is
+		written while the host sends the next block.
+   ========================================================================== */
+
+#ifndef _PICOTERM_XFER_H
+#define _PICOTERM_XFER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define XFER_RX_BUFFER_SIZE 2048 // UART reception during a transfer (power of 2)
+#define XFER_SD_BUFFER_SIZE 4096 // size of each of the 2 SD buffers (8 sectors)
+#define XFER_NAME_SIZE      64
+#define XFER_MAX_ERRORS     10   // consecutive errors before cancelling
+
+typedef struct XferStatus {
+	char filename[XFER_NAME_SIZE];
+	uint32_t size;      // file size, 0 when unknown (XMODEM receive)
+	uint32_t done;      // bytes transferred for the current file
+	uint16_t errors;    // blocks sent again
+	uint8_t  files;     // files completed (YMODEM batch)
+	uint64_t start_us;  // start of the current file
+	const char *error;  // reason of the failure, NULL otherwise
+} xfer_status_t;
+
+// called after each block and while waiting. Returns false to abort.
+typedef bool (*xfer_progress_t)( xfer_status_t *status );
+
+bool xmodem_receive( char *filename, xfer_status_t *status, xfer_progress_t progress );
+bool xmodem_send( char *filename, bool use_1k, xfer_status_t *status, xfer_progress_t progress );
+bool ymodem_receive( xfer_status_t *status, xfer_progress_t progress ); // batch, file names from the host
+bool ymodem_send( char *filename, xfer_status_t *status, xfer_progress_t progress );
+bool zmodem_receive( xfer_status_t *status, xfer_progress_t progress ); // batch, file names from the host
+bool zmodem_send( char *filename, xfer_status_t *status, xfer_progress_t progress );
+
+bool xfer_rx_byte( char ch ); // called from the UART RX IRQ, true when consumed
+bool is_transferring();
+
+#endif
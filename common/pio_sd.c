@@ -6,19 +6,31 @@
 #include "pio_spi.h"
 #include "pio_sd.h"
 #include "pico/stdlib.h"
+#include "hardware/dma.h"
 #include "stdio.h"
 #include "picoterm_harddef.h" // Hardware definition
 #include "../pio_fatfs/ff.h"
+#include "../pio_fatfs/tf_card.h"
 
 #include "picoterm_debug.h"
+#include "picoterm_config.h"
+#include "picoterm_uart.h"
+#include "picoterm_hotkey.h"
+
+/* picoterm_config.c */
+extern picoterm_config_t config;
 
 pio_spi_inst_t spi_sd = {
 				.pio = pio1, // pio0,
 				.sm = 1,     // 0,
-				.cs_pin = SPI_SD_CSN_PIN
+				.cs_pin = SPI_SD_CSN_PIN,
+				.tx_dma = -1, // see pio_spi_dma_init()
+				.rx_dma = -1
 };
 
 bool _mounted = false;
+static FATFS sd_fs; // FatFs keeps a reference on it as long as the volume is mounted
+static absolute_time_t sd_power_up; // card ready after spi_sd_init() + SD_POWER_UP_MS
 
 
 void spi_sd_init(){
@@ -43,20 +55,39 @@ void spi_sd_init(){
 	 							 SPI_SD_TX_PIN,
 	 							 SPI_SD_RX_PIN
 	 	);
-	 	sleep_ms( 200 );
+	 	// block transfers are performed by DMA (fallback to polling without channels).
+	 	// scanvideo claims fixed channels when the video starts: keep them free.
+	 	uint32_t reserved = 0;
+	 	for( uint ch=0; ch<NUM_DMA_CHANNELS; ch++ )
+	 		if( (SD_DMA_VIDEO_MASK & (1u<<ch)) && !dma_channel_is_claimed(ch) )
+	 			reserved |= (1u<<ch);
+	 	dma_claim_mask( reserved );
+	 	if( !pio_spi_dma_init( &spi_sd ) )
+	 		debug_print( "pio_sd: no DMA channel, using polled SPI" );
+	 	for( uint ch=0; ch<NUM_DMA_CHANNELS; ch++ )
+	 		if( reserved & (1u<<ch) )
+	 			dma_channel_unclaim( ch );
+	 	// the card needs some time after power up: checked by sd_powered_up()
+	 	// (boot_task) and sd_mount() instead of delaying the boot.
+	 	sd_power_up = make_timeout_time_ms( SD_POWER_UP_MS );
 		_mounted = false;
 }
 
+bool sd_powered_up(){
+	return time_reached( sd_power_up );
+}
+
 
 bool sd_mount( void ){
 		// Perform SD test with lot of debug messages
-		FATFS fs;
 		FRESULT fr;     /* FatFs return code */
 
 		debug_print("pio_sd: mount()");
 		_mounted = false;
+		sleep_until( sd_power_up ); // only waits right after spi_sd_init()
 
-		fr = f_mount(&fs, "", 1);
+		sd_cache_window( sd_fs.win ); // cache the FAT & directory sectors
+		fr = f_mount(&sd_fs, "", 1);
 	  if (fr != FR_OK) { // see FRESULT in ff.h
 	        sprintf( debug_msg, "pio_sd: mount error %d", fr);
 					debug_print( debug_msg );
@@ -65,7 +96,7 @@ bool sd_mount( void ){
 		_mounted = true;
 	  debug_print("pio_sd: mount ok");
 
-		switch (fs.fs_type) {
+		switch (sd_fs.fs_type) {
 				case FS_FAT12:
 						debug_print("Type is FAT12");
 						break;
@@ -85,6 +116,8 @@ bool sd_mount( void ){
 		}
 		//sprintf( debug_msg, "Card size: %7.2f GB (GB = 1E9 bytes)\n\n", fs.csize * fs.n_fatent * 512E-9);
 		//debug_print( debug_msg );
+		if( _mounted )
+			hotkey_scan(); // load the hotkey macros into RAM
 		return _mounted;
 }
 
@@ -102,64 +135,314 @@ bool is_sd_mount(){
 	return _mounted;
 }
 
-bool send_file_to_uart( char *filename ){
-	// send content of the named file to uart (to host). Kindly useful for
-	// shortcut key management. If the host does echo then you will see the content.
-	//
-	// Check debugging messages in case of trouble.
+bool sd_next_name( char *filename, const char *prefix, const char *ext ){
+	// first <prefix>NNN.<ext> not existing yet (eg: cap000.log)
+	FILINFO fno;
+	for( int i=0; i<1000; i++ ){
+		sprintf( filename, "%s%03d.%s", prefix, i, ext );
+		if( f_stat( filename, &fno ) == FR_NO_FILE )
+			return true;
+	}
+	return false;
+}
+
+bool sd_fast_seek( FIL *fp, DWORD *linkmap, UINT size ){
+	// Build the cluster link map of a file opened for reading, so f_read and
+	// f_lseek no longer walk the FAT chain. linkmap must stay allocated until
+	// f_close. Returns false (regular FAT walk) when the file is too fragmented.
+	linkmap[0] = size;
+	fp->cltbl = linkmap;
+	FRESULT fr = f_lseek( fp, CREATE_LINKMAP );
+	if (fr != FR_OK) { // FR_NOT_ENOUGH_CORE: linkmap[0] is the required size
+			sprintf( debug_msg, "pio_sd: no link map (%d), %lu items needed", fr, linkmap[0] );
+			debug_print( debug_msg );
+			fp->cltbl = NULL;
+			return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+//  Sequential throughput benchmark
+//---------------------------------------------------------------------------
+
+static uint8_t bench_buffer[SD_BENCH_CHUNK]; // sector aligned chunks (multi-block CMD18/CMD25)
+
+bool sd_bench( uint32_t size_kb, uint32_t *write_us, uint32_t *read_us ){
+	// Write then read back a file of size_kb KB with large chunks so FatFs
+	// transfers directly the sectors with multi-block commands.
+	// Returns false on error (see debug messages).
 	FIL file;
-	FATFS fs;
-	FRESULT fr;     /* FatFs return code */
-	UINT bytesRead;
+	FRESULT fr;
+	UINT bw, br;
+	uint32_t chunks = (size_kb*1024) / SD_BENCH_CHUNK;
+	uint64_t start;
 
-	// send content of file to the host uart (used for shortcut key)
-	sprintf( debug_msg, "send_file_to_uart: %s", filename );
-	debug_print( debug_msg );
-	//if( !is_sd_mount() ) // will attempt to remount
-	//	return false;
+	if( !is_sd_mount() ) // will attempt to remount
+		return false;
+	for( int i=0; i<SD_BENCH_CHUNK; i++ )
+		bench_buffer[i] = (uint8_t)i;
 
-	// We must mount the file system to make it working.
-	fr = f_mount(&fs, "", 1);
+	// Write
+	fr = f_open( &file, SD_BENCH_FILE, FA_WRITE | FA_CREATE_ALWAYS );
 	if (fr != FR_OK) { // see FRESULT in ff.h
-			sprintf( debug_msg, "SD mount error %d", fr);
+			sprintf( debug_msg, "sd_bench: open error %d", fr);
 			debug_print( debug_msg );
 			return false;
 	}
+	start = time_us_64();
+	uint32_t done = 0;
+	for( uint32_t i=0; i<chunks; i++ ){
+		fr = f_write( &file, bench_buffer, SD_BENCH_CHUNK, &bw );
+		if( (fr != FR_OK) || (bw != SD_BENCH_CHUNK) )
+			break; // error or card full
+		done++;
+	}
+	if( fr == FR_OK )
+		fr = f_sync( &file ); // count the flush of the FAT into the write time
+	*write_us = time_us_64() - start;
+	f_close( &file );
+	if( (fr != FR_OK) || (done != chunks) ){
+			sprintf( debug_msg, "sd_bench: write error %d (%lu of %lu KB)", fr, (done*SD_BENCH_CHUNK)/1024, size_kb );
+			debug_print( debug_msg );
+			f_unlink( SD_BENCH_FILE );
+			return false;
+	}
 
-	// try to open the file in read mode
-	fr = f_open(&file, filename, FA_READ);
+	// Read
+	fr = f_open( &file, SD_BENCH_FILE, FA_READ );
+	if (fr == FR_OK) {
+		start = time_us_64();
+		done = 0;
+		for( uint32_t i=0; i<chunks; i++ ){
+			fr = f_read( &file, bench_buffer, SD_BENCH_CHUNK, &br );
+			if( (fr != FR_OK) || (br != SD_BENCH_CHUNK) )
+				break;
+			done++;
+		}
+		*read_us = time_us_64() - start;
+		f_close( &file );
+	}
+	f_unlink( SD_BENCH_FILE );
+	if( (fr != FR_OK) || (done != chunks) ){
+			sprintf( debug_msg, "sd_bench: read error %d (%lu of %lu KB)", fr, (done*SD_BENCH_CHUNK)/1024, size_kb );
+			debug_print( debug_msg );
+			return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+//  File streamer - send a file to the host UART in the background
+//---------------------------------------------------------------------------
+//
+//  The file is read by chunks into two buffers. While the chars of the active
+//  buffer are queued to the UART (see picoterm_uart.c), the other one is
+//  refilled from the SD. The pacing (char delay, line delay, XON/XOFF) stored
+//  into the config is applied when queuing the chars.
+//  sd_stream_task() must be called from the main loop.
+
+#define XON  0x11
+#define XOFF 0x13
+
+static FIL stream_file;
+static DWORD stream_linkmap[SD_LINKMAP_SIZE];
+static char stream_buffer[2][STREAM_BUFFER_SIZE];
+static uint16_t stream_len[2];   // bytes available in each buffer
+static uint32_t stream_pos = 0;  // next char to send in the active buffer
+static const char *stream_ram = NULL; // streaming from RAM (hotkey cache) instead of a file
+static uint8_t stream_active = 0;// buffer being sent
+static bool stream_eof = false;
+static bool streaming = false;
+static bool stream_last_cr = false;   // CR+LF is a single line ending
+static bool stream_line_wait = false; // line sent, wait for the UART to drain
+static volatile bool stream_xoff = false;
+static uint64_t stream_next_us = 0;   // not before this time for the next char
+static uint32_t stream_sent = 0;
+static uint32_t stream_size = 0;
+
+static void stream_stop(){
+	if( stream_ram==NULL )
+		f_close( &stream_file );
+	stream_ram = NULL;
+	streaming = false;
+	stream_xoff = false;
+	sprintf( debug_msg, "sd_stream: %lu / %lu bytes sent", stream_sent, stream_size );
+	debug_print( debug_msg );
+}
+
+static bool stream_fill( uint8_t idx ){
+	// read the next chunk into the buffer idx.
+	UINT bytesRead;
+	FRESULT fr = f_read( &stream_file, stream_buffer[idx], STREAM_BUFFER_SIZE, &bytesRead );
 	if (fr != FR_OK) { // see FRESULT in ff.h
-			sprintf( debug_msg, "File open error %d", fr);
+			sprintf( debug_msg, "sd_stream: read error %d", fr);
 			debug_print( debug_msg );
+			sd_unmount(); // card removed? force a remount on next access
 			return false;
 	}
+	stream_len[idx] = bytesRead;
+	if( bytesRead < STREAM_BUFFER_SIZE )
+		stream_eof = true;
+	return true;
+}
+
+static void stream_reset(){
+	stream_sent = 0;
+	stream_pos = 0;
+	stream_active = 0;
+	stream_len[0] = 0;
+	stream_len[1] = 0;
+	stream_eof = false;
+	stream_last_cr = false;
+	stream_line_wait = false;
+	stream_xoff = false;
+	stream_next_us = time_us_64();
+}
+
+bool stream_file_to_uart( char *filename ){
+	// Open the file and prefetch the first buffer. The transmission itself
+	// is performed by sd_stream_task().
+	FRESULT fr;
+
+	if( streaming ){
+		debug_print( "sd_stream: already busy" );
+		return false;
+	}
+	if( !is_sd_mount() ) // will attempt to remount
+		return false;
 
-	// using debug_msg buffer to read FIRST CHUNCK of file content
-	fr = f_read(&file, debug_msg, sizeof(debug_msg), &bytesRead);
+	fr = f_open(&stream_file, filename, FA_READ);
 	if (fr != FR_OK) { // see FRESULT in ff.h
-			sprintf( debug_msg, "File read error %d", fr);
+			sprintf( debug_msg, "sd_stream: open error %d", fr);
 			debug_print( debug_msg );
-			f_close(&file);
 			return false;
 	}
+	sd_fast_seek( &stream_file, stream_linkmap, SD_LINKMAP_SIZE );
+	stream_reset();
+	stream_size = f_size( &stream_file );
+	if( !stream_fill(0) ){
+		f_close( &stream_file );
+		return false;
+	}
+	streaming = true;
+	return true;
+}
 
-	while( bytesRead > 0 ){
-			// send file CHUNCK over serial
-			for( int i=0; i<bytesRead; i++) {
-					uart_putc( UART_ID, debug_msg[i] );
-					sleep_ms( 1 );
-	    }
-			// Chunck sent!
-			// read next CHUNCK
-			fr = f_read(&file, debug_msg, sizeof(debug_msg), &bytesRead);
-			if (fr != FR_OK) { // see FRESULT in ff.h
-					sprintf( debug_msg, "\r\nFile read error %d", fr);
-					debug_print( debug_msg );
-					f_close(&file);
-					return false;
+bool stream_ram_to_uart( const char *data, uint32_t size ){
+	// Same pacing as a file but the data is already in RAM (the caller must
+	// keep it unchanged until the end of the transmission).
+	if( streaming ){
+		debug_print( "sd_stream: already busy" );
+		return false;
+	}
+	stream_reset();
+	stream_ram = data;
+	stream_size = size;
+	stream_eof = true;
+	streaming = true;
+	return true;
+}
+
+void sd_stream_task(){
+	if( !streaming )
+		return;
+
+	// Refill the idle buffer while the active one is being sent
+	uint8_t idle = 1-stream_active;
+	if( (stream_ram==NULL) && (stream_len[idle]==0) && !stream_eof )
+		if( !stream_fill( idle ) ){
+			stream_stop();
+			return;
+		}
+
+	uint64_t now = time_us_64();
+	if( stream_line_wait ){
+		// line delay starts when the line has left the UART
+		if( !uart_tx_empty() )
+			return;
+		stream_line_wait = false;
+		stream_next_us = now + (uint64_t)config.line_delay * 1000;
+	}
+
+	while( !stream_xoff && (now >= stream_next_us) ){
+		if( stream_ram!=NULL ){
+			if( stream_pos >= stream_size ){
+				stream_stop(); // done
+				return;
+			}
+		}
+		else if( stream_pos >= stream_len[stream_active] ){
+			// active buffer exhausted, swap to the other one
+			stream_len[stream_active] = 0;
+			stream_pos = 0;
+			stream_active = idle;
+			idle = 1-stream_active;
+			if( stream_len[stream_active]==0 ){
+				if( stream_eof )
+					stream_stop(); // done
+				return; // wait for the next refill
 			}
+		}
+		if( uart_tx_free() <= UART_TX_RESERVE )
+			return; // UART queue full (keep room for the keyboard), retry next time
+		char ch = (stream_ram!=NULL) ? stream_ram[stream_pos] : stream_buffer[stream_active][stream_pos];
+		uart_tx_put( ch );
+		stream_pos++;
+		stream_sent++;
+
+		if( config.char_delay > 0 ){
+			// keep a steady rate even if the main loop was late
+			stream_next_us += config.char_delay;
+			if( stream_next_us < now )
+				stream_next_us = now;
+		}
+		if( (config.line_delay > 0) && ((ch=='\r') || ((ch=='\n') && !stream_last_cr)) ){
+			stream_last_cr = (ch=='\r');
+			stream_line_wait = true;
+			return;
+		}
+		stream_last_cr = (ch=='\r');
 	}
+}
 
-	f_close(&file);
-	return true;
+bool stream_flow_control( char ch ){
+	// Called from the UART RX IRQ. Capture the XON/XOFF sent by the host
+	// while streaming (return true when the char is consumed).
+	if( !streaming || !config.flow_control )
+		return false;
+	if( ch==XOFF ){
+		stream_xoff = true;
+		return true;
+	}
+	if( ch==XON ){
+		stream_xoff = false;
+		return true;
+	}
+	return false;
+}
+
+bool is_streaming(){
+	return streaming;
+}
+
+void stream_abort(){
+	if( streaming )
+		stream_stop();
+}
+
+void stream_progress( uint32_t *sent, uint32_t *size ){
+	*sent = stream_sent;
+	*size = stream_size;
+}
+
+bool send_file_to_uart( char *filename ){
+	// send content of the named file to uart (to host). Kindly useful for
+	// shortcut key management. If the host does echo then you will see the content.
+	// The file is sent in the background (see sd_stream_task).
+	//
+	// Check debugging messages in case of trouble.
+	sprintf( debug_msg, "send_file_to_uart: %s", filename );
+	debug_print( debug_msg );
+	return stream_file_to_uart( filename );
 }
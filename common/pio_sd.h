@@ -5,12 +5,39 @@
 #ifndef _PIO_SD_H
 #define _PIO_SD_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "../pio_fatfs/ff.h" // FIL
+
+
+#define SD_POWER_UP_MS 200 // delay between spi_sd_init() and the first mount
+#define SD_DMA_VIDEO_MASK 0x000f // DMA channels claimed later by scanvideo_setup() (fixed numbers)
 
 void spi_sd_init();   // Initialise the SPI interface
+bool sd_powered_up();  // card power up delay elapsed since spi_sd_init()
 bool sd_mount();         // mount the SD card
 void sd_unmount(); 	// reset the mount flag!
 bool is_sd_mount(); 	// did the last SPI_sd_mount succeed ?
+bool sd_next_name( char *filename, const char *prefix, const char *ext ); // first free <prefix>NNN.<ext>
+
+#define SD_LINKMAP_SIZE 32 // DWORDs, cluster link map of up to 15 fragments
+
+bool sd_fast_seek( FIL *fp, DWORD *linkmap, UINT size ); // after f_open( FA_READ )
+
+#define SD_BENCH_FILE  "sd_bench.tmp"
+#define SD_BENCH_CHUNK 4096 // bytes per f_write/f_read (8 sectors)
+
+bool sd_bench( uint32_t size_kb, uint32_t *write_us, uint32_t *read_us ); // sequential write & read timing
+
+#define STREAM_BUFFER_SIZE 512 // size of each of the 2 read buffers
 
-bool send_file_to_uart( char *filename );
+bool send_file_to_uart( char *filename ); // start streaming file to the host
+bool stream_file_to_uart( char *filename );
+bool stream_ram_to_uart( const char *data, uint32_t size );
+void sd_stream_task();     // to be called from the main loop
+bool stream_flow_control( char ch ); // XON/XOFF handling, called from the UART RX IRQ
+bool is_streaming();
+void stream_abort();
+void stream_progress( uint32_t *sent, uint32_t *size );
 
 #endif
@@ -6,6 +6,8 @@
  /* copied from   pico-examples/pio/spi/spi_flash.c    */
 
 #include "pio_spi.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
 
 // Just 8 bit functions provided here. The PIO program supports any frame size
 // 1...32, but the software to do the necessary FIFO shuffling is left as an
@@ -83,3 +85,74 @@ void __time_critical_func(pio_spi_write8_read8_blocking)(const pio_spi_inst_t *s
         }
     }
 }
+
+// The spi_cpha0 program takes 4 state machine cycles per SCK period.
+#define PIO_SPI_CYCLES_PER_BIT 4
+
+uint32_t pio_spi_set_baudrate(const pio_spi_inst_t *spi, uint32_t baudrate) {
+    // Use an integer divider (a fractional one produces an uneven SCK).
+    uint32_t sm_clk = clock_get_hz(clk_sys) / PIO_SPI_CYCLES_PER_BIT;
+    uint32_t div = (sm_clk + baudrate - 1) / baudrate; // never faster than requested
+    if (div < 1) div = 1;
+    if (div > 0xFFFF) div = 0xFFFF;
+    pio_sm_set_clkdiv_int_frac(spi->pio, spi->sm, div, 0);
+    pio_sm_clkdiv_restart(spi->pio, spi->sm);
+    return sm_clk / div;
+}
+
+// DMA versions of the transfers. One channel feeds the TX FIFO while the
+// other one drains the RX FIFO, both paced by the PIO DREQ. The caller waits
+// for the RX channel (the last byte clocked in) before returning.
+
+static uint8_t dma_tx_val;   // constant byte sent while reading
+static uint8_t dma_rx_dummy; // sink for the bytes received while writing
+
+bool pio_spi_dma_init(pio_spi_inst_t *spi) {
+    spi->tx_dma = dma_claim_unused_channel(false);
+    spi->rx_dma = dma_claim_unused_channel(false);
+    if (spi->tx_dma < 0 || spi->rx_dma < 0) {
+        if (spi->tx_dma >= 0) dma_channel_unclaim(spi->tx_dma);
+        if (spi->rx_dma >= 0) dma_channel_unclaim(spi->rx_dma);
+        spi->tx_dma = -1;
+        spi->rx_dma = -1;
+        return false;
+    }
+    return true;
+}
+
+static void __time_critical_func(pio_spi_dma_transfer)(const pio_spi_inst_t *spi, const uint8_t *src, bool src_incr,
+                                                       uint8_t *dst, bool dst_incr, size_t len) {
+    dma_channel_config c = dma_channel_get_default_config(spi->tx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, src_incr);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(spi->pio, spi->sm, true));
+    dma_channel_configure(spi->tx_dma, &c, &spi->pio->txf[spi->sm], src, len, false);
+
+    c = dma_channel_get_default_config(spi->rx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, dst_incr);
+    channel_config_set_dreq(&c, pio_get_dreq(spi->pio, spi->sm, false));
+    dma_channel_configure(spi->rx_dma, &c, dst, &spi->pio->rxf[spi->sm], len, false);
+
+    dma_start_channel_mask((1u << spi->tx_dma) | (1u << spi->rx_dma));
+    dma_channel_wait_for_finish_blocking(spi->rx_dma);
+}
+
+void __time_critical_func(pio_spi_write8_dma)(const pio_spi_inst_t *spi, const uint8_t *src, size_t len) {
+    if (spi->tx_dma < 0 || len < PIO_SPI_DMA_MIN_LEN) {
+        pio_spi_write8_blocking(spi, src, len);
+        return;
+    }
+    pio_spi_dma_transfer(spi, src, true, &dma_rx_dummy, false, len);
+}
+
+void __time_critical_func(pio_spi_read8_dma_with)(const pio_spi_inst_t *spi, uint8_t tx_val, uint8_t *dst, size_t len) {
+    if (spi->tx_dma < 0 || len < PIO_SPI_DMA_MIN_LEN) {
+        pio_spi_read8_blocking_with(spi, tx_val, dst, len);
+        return;
+    }
+    dma_tx_val = tx_val;
+    pio_spi_dma_transfer(spi, &dma_tx_val, false, dst, true, len);
+}
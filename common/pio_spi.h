@@ -15,8 +15,13 @@ typedef struct pio_spi_inst {
     PIO pio;
     uint sm;
     uint cs_pin;
+    int tx_dma; // DMA channels (-1 when not claimed, see pio_spi_dma_init)
+    int rx_dma;
 } pio_spi_inst_t;
 
+// Below this size, the busy-polling is faster than setting up the DMA
+#define PIO_SPI_DMA_MIN_LEN 32
+
 void pio_spi_write8_blocking(const pio_spi_inst_t *spi, const uint8_t *src, size_t len);
 
 void pio_spi_read8_blocking(const pio_spi_inst_t *spi, uint8_t *dst, size_t len);
@@ -26,4 +31,12 @@ void pio_spi_write8_read8_blocking(const pio_spi_inst_t *spi, uint8_t *src, uint
 /* Added by Domeu for SD Card over SPI */
 void pio_spi_read8_blocking_with(const pio_spi_inst_t *spi, char tx_val, uint8_t *dst, size_t len);
 
+/* Reprogram the SCK rate (state machine clock divider). Returns the rate really applied */
+uint32_t pio_spi_set_baudrate(const pio_spi_inst_t *spi, uint32_t baudrate);
+
+/* DMA transfers: the CPU does not poll the FIFOs byte per byte */
+bool pio_spi_dma_init(pio_spi_inst_t *spi);
+void pio_spi_write8_dma(const pio_spi_inst_t *spi, const uint8_t *src, size_t len);
+void pio_spi_read8_dma_with(const pio_spi_inst_t *spi, uint8_t tx_val, uint8_t *dst, size_t len);
+
 #endif
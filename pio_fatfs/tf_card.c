@@ -1,5 +1,6 @@
 #include "tf_card.h"
 
+#include <string.h>
 #include "pico.h"
 #include "pico/stdlib.h"
 #include "hardware/clocks.h"
@@ -47,9 +48,40 @@ extern pio_spi_inst_t spi_sd;
 #define CT_SDC         (CT_SD1|CT_SD2) /* SD */
 #define CT_BLOCK       0x08            /* Block addressing */
 
-#define CLK_SLOW	(100 * KHZ)
+#define CLK_SLOW	(400 * KHZ)	/* Card initialisation (400 kHz max for SD) */
 //#define CLK_FAST	(50 * MHZ) // moved to tf_card.h
 
+/* Data clock ladder. FCLK_FAST() applies the current step, FCLK_STEP_DOWN()
+   moves to the next (slower) one after a CRC or response error and
+   FCLK_CLEAN() climbs back one step after CLK_STEP_UP clean transfers. */
+static const uint32_t clk_ladder[] = { CLK_FAST, 16 * MHZ, 12 * MHZ, 8 * MHZ, 4 * MHZ, 2 * MHZ, 1 * MHZ };
+#define CLK_LADDER_LEN	(sizeof(clk_ladder)/sizeof(clk_ladder[0]))
+#define MAX_RETRY	3	/* Max clock step down for a single read/write */
+#define CLK_STEP_UP	256	/* Clean transfers before trying the next faster clock */
+
+static uint8_t clk_step = 0;		/* Current entry in clk_ladder */
+static uint32_t clk_clean = 0;		/* Clean transfers since the last step */
+static uint32_t clk_rate = 0;		/* SCK rate really applied (Hz) */
+static uint32_t crc_errors = 0;		/* Data blocks received with bad CRC */
+static uint32_t resp_errors = 0;	/* Commands/data rejected by the card */
+
+#define SD_CHECK_CRC	1		/* Verify the CRC16 of the received data blocks */
+#if SD_CHECK_CRC
+static uint16_t crc16_table[256];	/* CRC16-CCITT (polynomial 0x1021), built by disk_initialize() */
+#endif
+
+/* Sector cache (LRU) of the FAT and directory sectors. FatFs always reads
+   them through the window of the FATFS object (see sd_cache_window) while
+   the file data goes to the file buffer or straight to the caller buffer. */
+#define SD_CACHE_SECTORS	8	/* 4 KB of RAM */
+static BYTE cache_data[SD_CACHE_SECTORS][512];
+static LBA_t cache_lba[SD_CACHE_SECTORS];
+static uint32_t cache_used[SD_CACHE_SECTORS];	/* LRU stamp, 0:Free entry */
+static uint32_t cache_stamp = 0;
+static const BYTE *cache_win = 0;	/* FATFS.win, reads into it are cached */
+static uint32_t cache_hits = 0;
+static uint32_t cache_misses = 0;
+
 static volatile
 DSTATUS Stat = STA_NOINIT;	/* Physical drive status */
 
@@ -79,14 +111,36 @@ static inline void cs_deselect(uint cs_pin) {
 
 static void FCLK_SLOW(void)
 {
-    // Domeu, we will not change the clock speed
-		// spi_set_baudrate(spi, CLK_SLOW);
+	clk_rate = pio_spi_set_baudrate(&spi_sd, CLK_SLOW);
 }
 
 static void FCLK_FAST(void)
 {
-	// DOMEU: we will not change the clock speed
-  //  spi_set_baudrate(spi, CLK_FAST);
+	clk_rate = pio_spi_set_baudrate(&spi_sd, clk_ladder[clk_step]);
+}
+
+static int FCLK_STEP_DOWN(void)	/* 1:Slower clock applied, 0:Already the slowest */
+{
+	uint32_t rate = clk_rate;
+	clk_clean = 0;
+	while (clk_step < CLK_LADDER_LEN - 1) {
+		clk_step++;
+		FCLK_FAST();
+		if (clk_rate < rate) return 1;	/* Same divider may give the same rate */
+	}
+	return 0;
+}
+
+static void FCLK_CLEAN(void)	/* A transfer succeeded: back to a faster clock when steady */
+{
+	if (clk_step == 0 || ++clk_clean < CLK_STEP_UP) return;
+	uint32_t rate = clk_rate;
+	clk_clean = 0;
+	while (clk_step > 0) {	/* A new error steps down again */
+		clk_step--;
+		FCLK_FAST();
+		if (clk_rate > rate) return;
+	}
 }
 
 static void CS_HIGH(void)
@@ -186,7 +240,7 @@ void rcvr_spi_multi (
 {
 	uint8_t *b = (uint8_t *) buff;
 	//spi_read_blocking(spi, 0xff, b, btr);
-	pio_spi_read8_blocking_with(&spi_sd, 0xFF, b, btr);
+	pio_spi_read8_dma_with(&spi_sd, 0xFF, b, btr); // DMA (see spi_sd_init)
 }
 
 
@@ -242,6 +296,36 @@ int _select (void)	/* 1:OK, 0:Timeout */
 
 
 
+#if SD_CHECK_CRC
+/*-----------------------------------------------------------------------*/
+/* CRC16 of a data block                                                 */
+/*-----------------------------------------------------------------------*/
+
+static
+void crc16_init (void)
+{
+	for (int i = 0; i < 256; i++) {
+		WORD crc = (WORD)i << 8;
+		for (int b = 0; b < 8; b++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		crc16_table[i] = crc;
+	}
+}
+
+static
+WORD crc16 (
+	const BYTE *buff,	/* Data to check */
+	UINT len			/* Number of bytes */
+)
+{
+	WORD crc = 0;
+	while (len--)
+		crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ *buff++) & 0xFF];
+	return crc;
+}
+#endif
+
+
 /*-----------------------------------------------------------------------*/
 /* Receive a data packet from the MMC                                    */
 /*-----------------------------------------------------------------------*/
@@ -253,6 +337,7 @@ int rcvr_datablock (	/* 1:OK, 0:Error */
 )
 {
 	BYTE token;
+	WORD crc;
 
 	const uint32_t timeout = 200;
 	uint32_t t = _millis();
@@ -263,8 +348,15 @@ int rcvr_datablock (	/* 1:OK, 0:Error */
 	if(token != 0xFE) return 0;		/* Function fails if invalid DataStart token or timeout */
 
 	rcvr_spi_multi(buff, btr);		/* Store trailing data to the buffer */
-	xchg_spi(0xFF); xchg_spi(0xFF);			/* Discard CRC */
+	crc = (WORD)xchg_spi(0xFF) << 8;	/* CRC16 */
+	crc |= xchg_spi(0xFF);
 
+#if SD_CHECK_CRC
+	if (btr == 512 && crc16(buff, btr) != crc) {	/* Only full blocks (partial reads of ACMD13 are purged) */
+		crc_errors++;
+		return 0;
+	}
+#endif
 	return 1;						/* Function succeeded */
 }
 
@@ -322,6 +414,49 @@ BYTE send_cmd (		/* Return value: R1 resp (bit7==1:Failed to send) */
 ---------------------------------------------------------------------------*/
 
 
+/*-----------------------------------------------------------------------*/
+/* Sector cache                                                          */
+/*-----------------------------------------------------------------------*/
+
+static
+void cache_clear (void)
+{
+	for (int i = 0; i < SD_CACHE_SECTORS; i++) cache_used[i] = 0;
+}
+
+static
+int cache_find (	/* Entry index, -1:Not cached */
+	LBA_t sector
+)
+{
+	for (int i = 0; i < SD_CACHE_SECTORS; i++) {
+		if (cache_used[i] && cache_lba[i] == sector) return i;
+	}
+	return -1;
+}
+
+static
+void cache_store (
+	const BYTE *buff,
+	LBA_t sector
+)
+{
+	int i, lru = 0;
+
+	i = cache_find(sector);
+	if (i < 0) {	/* Take a free entry or the least recently used one */
+		for (i = 0; i < SD_CACHE_SECTORS; i++) {
+			if (cache_used[i] < cache_used[lru]) lru = i;
+		}
+		i = lru;
+	}
+	memcpy(cache_data[i], buff, 512);
+	cache_lba[i] = sector;
+	cache_used[i] = ++cache_stamp;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Initialize disk drive                                                 */
 /*-----------------------------------------------------------------------*/
@@ -341,6 +476,12 @@ DSTATUS disk_initialize (
 
 	if (Stat & STA_NODISK) return Stat;	/* Is card existing in the soket? */
 
+#if SD_CHECK_CRC
+	if (crc16_table[1] == 0) crc16_init();
+#endif
+	clk_step = 0;	/* A new card may support the fastest clock */
+	clk_clean = 0;
+	cache_clear();	/* The card may have been swapped */
 	FCLK_SLOW();
 	for (n = 10; n; n--) xchg_spi(0xFF);	/* Send 80 dummy clocks */
 
@@ -401,23 +542,16 @@ DSTATUS disk_status (
 /* Read sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_read (
-	BYTE drv,		/* Physical drive number (0) */
+static
+int read_sectors (	/* 1:OK, 0:Error */
 	BYTE *buff,		/* Pointer to the data buffer to store read data */
-	LBA_t sector,	/* Start sector number (LBA) */
+	LBA_t sector,	/* Start sector number (LBA or BA) */
 	UINT count		/* Number of sectors to read (1..128) */
 )
 {
-	if (drv || !count) return RES_PARERR;		/* Check parameter */
-	if (Stat & STA_NOINIT) return RES_NOTRDY;	/* Check if drive is ready */
-
-	if (!(CardType & CT_BLOCK)) sector *= 512;	/* LBA ot BA conversion (byte addressing cards) */
-
 	if (count == 1) {	/* Single sector read */
-		if ((send_cmd(CMD17, sector) == 0)	/* READ_SINGLE_BLOCK */
-			&& rcvr_datablock(buff, 512)) {
-			count = 0;
-		}
+		if (send_cmd(CMD17, sector) != 0) resp_errors++;	/* READ_SINGLE_BLOCK */
+		else if (rcvr_datablock(buff, 512)) count = 0;
 	}
 	else {				/* Multiple sector read */
 		if (send_cmd(CMD18, sector) == 0) {	/* READ_MULTIPLE_BLOCK */
@@ -427,10 +561,44 @@ DRESULT disk_read (
 			} while (--count);
 			send_cmd(CMD12, 0);				/* STOP_TRANSMISSION */
 		}
+		else resp_errors++;
 	}
 	deselect();
 
-	return count ? RES_ERROR : RES_OK;	/* Return result */
+	return count ? 0 : 1;
+}
+
+DRESULT disk_read (
+	BYTE drv,		/* Physical drive number (0) */
+	BYTE *buff,		/* Pointer to the data buffer to store read data */
+	LBA_t sector,	/* Start sector number (LBA) */
+	UINT count		/* Number of sectors to read (1..128) */
+)
+{
+	if (drv || !count) return RES_PARERR;		/* Check parameter */
+	if (Stat & STA_NOINIT) return RES_NOTRDY;	/* Check if drive is ready */
+
+	LBA_t lba = sector;
+	bool cached = (count == 1 && buff == cache_win);	/* FAT or directory sector */
+	if (cached) {
+		int i = cache_find(lba);
+		if (i >= 0) {
+			memcpy(buff, cache_data[i], 512);
+			cache_used[i] = ++cache_stamp;
+			cache_hits++;
+			return RES_OK;
+		}
+		cache_misses++;
+	}
+
+	if (!(CardType & CT_BLOCK)) sector *= 512;	/* LBA ot BA conversion (byte addressing cards) */
+
+	for (int retry = 0; !read_sectors(buff, sector, count); retry++) {
+		if (retry == MAX_RETRY || !FCLK_STEP_DOWN()) return RES_ERROR;	/* Retry at a slower clock */
+	}
+	FCLK_CLEAN();
+	if (cached) cache_store(buff, lba);
+	return RES_OK;
 }
 
 
@@ -453,7 +621,7 @@ void xmit_spi_multi (
 {
 	const uint8_t *b = (const uint8_t *) buff;
 	//spi_write_blocking(spi, b, btx);
-	pio_spi_write8_blocking(&spi_sd, b, btx);
+	pio_spi_write8_dma(&spi_sd, b, btx); // DMA (see spi_sd_init)
 }
 
 /*-----------------------------------------------------------------------*/
@@ -474,8 +642,11 @@ int xmit_datablock (	/* 1:OK, 0:Error */
 		xchg_spi(0xFF); /* CRC (Dummy) */
 		xchg_spi(0xFF);
 		resp = xchg_spi(0xFF); /* Reveive data response */
-		if ((resp & 0x1F) != 0x05) /* If not accepted, return with error */
+		if ((resp & 0x1F) != 0x05) { /* If not accepted, return with error */
+			if ((resp & 0x1F) == 0x0B) crc_errors++; /* Data rejected due to a CRC error */
+			else resp_errors++;
 			return 0;
+		}
 	}
 	return 1;
 }
@@ -484,26 +655,18 @@ int xmit_datablock (	/* 1:OK, 0:Error */
 /* Write sector(s)                                                       */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_write (
-	BYTE drv,			/* Physical drive number (0) */
+static
+int write_sectors (	/* 1:OK, 0:Error */
 	const BYTE *buff,	/* Ponter to the data to write */
-	LBA_t sector,		/* Start sector number (LBA) */
+	LBA_t sector,		/* Start sector number (LBA or BA) */
 	UINT count			/* Number of sectors to write (1..128) */
 )
 {
-	if (drv || !count) return RES_PARERR;		/* Check parameter */
-	if (Stat & STA_NOINIT) return RES_NOTRDY;	/* Check drive status */
-	if (Stat & STA_PROTECT) return RES_WRPRT;	/* Check write protect */
-
-	if (!(CardType & CT_BLOCK)) sector *= 512;	/* LBA ==> BA conversion (byte addressing cards) */
-
-	if (!_select()) return RES_NOTRDY;
+	if (!_select()) return 0;
 
 	if (count == 1) {	/* Single sector write */
-		if ((send_cmd(CMD24, sector) == 0)	/* WRITE_BLOCK */
-			&& xmit_datablock(buff, 0xFE)) {
-			count = 0;
-		}
+		if (send_cmd(CMD24, sector) != 0) resp_errors++;	/* WRITE_BLOCK */
+		else if (xmit_datablock(buff, 0xFE)) count = 0;
 	}
 	else {				/* Multiple sector write */
 		if (CardType & CT_SDC) send_cmd(ACMD23, count);	/* Predefine number of sectors */
@@ -514,10 +677,39 @@ DRESULT disk_write (
 			} while (--count);
 			if (!xmit_datablock(0, 0xFD)) count = 1;	/* STOP_TRAN token */
 		}
+		else resp_errors++;
 	}
 	deselect();
 
-	return count ? RES_ERROR : RES_OK;	/* Return result */
+	return count ? 0 : 1;
+}
+
+DRESULT disk_write (
+	BYTE drv,			/* Physical drive number (0) */
+	const BYTE *buff,	/* Ponter to the data to write */
+	LBA_t sector,		/* Start sector number (LBA) */
+	UINT count			/* Number of sectors to write (1..128) */
+)
+{
+	if (drv || !count) return RES_PARERR;		/* Check parameter */
+	if (Stat & STA_NOINIT) return RES_NOTRDY;	/* Check drive status */
+	if (Stat & STA_PROTECT) return RES_WRPRT;	/* Check write protect */
+
+	for (UINT n = 0; n < count; n++) {	/* Write through: keep the cached copies up to date */
+		int i = cache_find(sector + n);
+		if (i >= 0) memcpy(cache_data[i], buff + n * 512, 512);
+	}
+
+	if (!(CardType & CT_BLOCK)) sector *= 512;	/* LBA ==> BA conversion (byte addressing cards) */
+
+	for (int retry = 0; !write_sectors(buff, sector, count); retry++) {
+		if (retry == MAX_RETRY || !FCLK_STEP_DOWN()) {	/* Retry at a slower clock */
+			cache_clear();	/* The sectors content on the card is unknown */
+			return RES_ERROR;
+		}
+	}
+	FCLK_CLEAN();
+	return RES_OK;
 }
 #endif
 
@@ -583,6 +775,14 @@ DRESULT disk_ioctl (
 		}
 		break;
 
+	case MMC_GET_CSD :		/* Read CSD (16 bytes) */
+		if ((send_cmd(CMD9, 0) == 0) && rcvr_datablock(buff, 16)) res = RES_OK;
+		break;
+
+	case MMC_GET_CID :		/* Read CID (16 bytes) */
+		if ((send_cmd(CMD10, 0) == 0) && rcvr_datablock(buff, 16)) res = RES_OK;
+		break;
+
 	case CTRL_TRIM :	/* Erase a block of sectors (used when _USE_ERASE == 1) */
 		if (!(CardType & CT_SDC)) break;				/* Check if the card is SDC */
 		if (disk_ioctl(drv, MMC_GET_CSD, csd)) break;	/* Get CSD */
@@ -604,3 +804,39 @@ DRESULT disk_ioctl (
 
 	return res;
 }
+
+
+/*-----------------------------------------------------------------------*/
+/* SPI clock, error & cache counters (see sd_info)                      */
+/*-----------------------------------------------------------------------*/
+
+uint32_t sd_spi_baudrate (void)
+{
+	return clk_rate;
+}
+
+uint32_t sd_spi_crc_errors (void)
+{
+	return crc_errors;
+}
+
+uint32_t sd_spi_resp_errors (void)
+{
+	return resp_errors;
+}
+
+void sd_cache_window (const void *win)
+{
+	cache_win = win;
+	cache_clear();
+}
+
+uint32_t sd_cache_hits (void)
+{
+	return cache_hits;
+}
+
+uint32_t sd_cache_misses (void)
+{
+	return cache_misses;
+}
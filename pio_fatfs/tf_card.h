@@ -4,9 +4,12 @@
 //#define USE_SPI0 // to use PIN_SPI0_xxx
 //#define USE_SPI1 // to use PIN_SPI1_xxx
 
-// CLK_FAST: actually set to clk_peri (= 125.0 MHz) / N,
-// which is determined by spi_set_baudrate() in pico-sdk/src/rp2_common/hardware_spi/spi.c
-#define CLK_FAST	(50 * MHZ)
+#include <stdint.h>
+
+// CLK_FAST: fastest SCK requested for data transfer. Actually set to clk_sys / 4 / N
+// with an integer N (see pio_spi_set_baudrate): 15.6 MHz with clk_sys at 125 MHz.
+// tf_card.c steps down when CRC or response errors occurs.
+#define CLK_FAST	(25 * MHZ)
 
 /* SPI pin assignment */
 #define PIN_SPI0_MISO   4   // 0, 4, 16
@@ -19,4 +22,12 @@
 #define PIN_SPI1_SCK    10  // 10, 14
 #define PIN_SPI1_MOSI   11  // 11, 15
 
+uint32_t sd_spi_baudrate (void);		/* Current SCK rate (Hz) */
+uint32_t sd_spi_crc_errors (void);		/* Data blocks with CRC error */
+uint32_t sd_spi_resp_errors (void);		/* Commands/data rejected by the card */
+
+void sd_cache_window (const void *win);	/* FATFS.win, its FAT & directory sectors are cached */
+uint32_t sd_cache_hits (void);			/* Sector reads served by the cache */
+uint32_t sd_cache_misses (void);		/* Sector reads sent to the card */
+
 #endif // _TF_CARD_H_
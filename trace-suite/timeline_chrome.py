@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+""" timeline_chrome.py - Convert a PicoTerm timeline dump to the Chrome trace format.
+
+	The timeline (see common/picoterm_timeline.h) is read from:
+	  * a tlNNN.bin file written on the SD card by `timeline -s`
+	  * a capture of the debug UART while `timeline -u` was running
+	    (TR_TIMELINE_EVENT trace records, see trace_decode.py)
+
+	The JSON file opens in chrome://tracing or https://ui.perfetto.dev
+"""
+
+__version__ = '0.1'
+
+import sys
+import os
+import json
+import struct
+
+from trace_decode import FRAME_MARK, RECORD_SIZE, IDS_FILE, load_ids
+
+# Trace points, same order as TL_xxx in common/picoterm_timeline.h
+POINTS = [ 'uart_irq', 'tuh_task', 'handle_keyboard_input', 'render_scanline' ]
+CORES = [ 'core 0 (IRQ, USB, parser)', 'core 1 (video)' ]
+
+TIME_BITS = 26
+TL_END = 0x80000000
+
+def show_help():
+	print( 'USAGE:')
+	print( '  ./timeline_chrome.py <source> <output.json> [-h]' )
+	print( '' )
+	print( '<source>      : tlNNN.bin file from the SD card or capture of the debug UART.' )
+	print( '<output.json> : Chrome trace file.' )
+	print( '-h            : display this help.')
+	print( '' )
+
+def read_sd_dump( data ):
+	""" tlNNN.bin: 'PTTL', count core 0, count core 1, events """
+	count0, count1 = struct.unpack_from( '<II', data, 4 )
+	events = struct.unpack_from( '<%dI' % (count0+count1), data, 12 )
+	return [ list(events[:count0]), list(events[count0:]) ]
+
+def read_uart_dump( data ):
+	""" TR_TIMELINE_EVENT records (a = core, b = event) in the debug stream """
+	names = [ _id[0] for _id in load_ids( IDS_FILE ) ]
+	timeline_id = names.index( 'TR_TIMELINE_EVENT' )
+	cores = [ [], [] ]
+	i = 0
+	while i < len(data):
+		if data[i] == FRAME_MARK and i+1+RECORD_SIZE <= len(data):
+			_id, time_us, a, b = struct.unpack_from( '<BIII', data, i+1 )
+			if _id == timeline_id and a < 2:
+				cores[a].append( b )
+			i += 1+RECORD_SIZE
+		else:
+			i += 1
+	return cores
+
+def unwrap( events ):
+	""" (point, is_end, time_us) with the 26 bits time made monotonic """
+	r = []
+	offset = 0
+	last = None
+	for e in events:
+		t = e & ((1<<TIME_BITS)-1)
+		if last != None and t < last:
+			offset += 1<<TIME_BITS
+		last = t
+		r.append( ( (e>>TIME_BITS) & 0x1F, (e & TL_END)!=0, t+offset ) )
+	return r
+
+def to_chrome( cores ):
+	trace = []
+	for core, events in enumerate( cores ):
+		trace.append( { 'name':'thread_name', 'ph':'M', 'pid':1, 'tid':core, 'args':{'name':CORES[core]} } )
+		open_points = []
+		for point, is_end, t in unwrap( events ):
+			name = POINTS[point] if point < len(POINTS) else 'point %u' % point
+			if is_end:
+				if point not in open_points: # begin before the recorded window
+					continue
+				open_points.remove( point )
+			else:
+				open_points.append( point )
+			trace.append( { 'name':name, 'ph':'E' if is_end else 'B', 'ts':t, 'pid':1, 'tid':core } )
+	return { 'traceEvents':trace, 'displayTimeUnit':'ns' }
+
+if __name__ == '__main__':
+	if ('-h' in sys.argv) or (len(sys.argv) < 3):
+		show_help()
+		sys.exit(0 if '-h' in sys.argv else 1)
+	with open( sys.argv[1], 'rb' ) as f:
+		data = f.read()
+	cores = read_sd_dump( data ) if data[:4]==b'PTTL' else read_uart_dump( data )
+	print( '%u events core 0, %u events core 1' % (len(cores[0]), len(cores[1])) )
+	with open( sys.argv[2], 'w' ) as f:
+		json.dump( to_chrome( cores ), f )
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+""" trace_decode.py - Decode the PicoTerm debug UART stream (text & binary trace records).
+
+	The text messages (debug_print) are displayed as is. The binary records
+	(TRACE, see common/picoterm_trace.h) start with the 0x1E byte followed by
+	13 bytes: id, time_us, a, b (little endian). They are formatted with the
+	TRACE_ID entries of common/picoterm_trace_ids.h .
+"""
+
+__version__ = '0.1'
+
+import sys
+import os
+import re
+import struct
+
+FRAME_MARK = 0x1E
+RECORD_SIZE = 13
+IDS_FILE = os.path.join( os.path.dirname(os.path.abspath(__file__)), '..', 'common', 'picoterm_trace_ids.h' )
+
+def show_help():
+	print( 'USAGE:')
+	print( '  ./trace_decode.py <source> [-ids file] [-h]' )
+	print( '' )
+	print( '<source>  : serial device connected to the debug UART (115200 bauds)' )
+	print( '            or file captured from it.' )
+	print( '-ids file : trace points definition (default: %s)' % IDS_FILE )
+	print( '-h        : display this help.')
+	print( '' )
+
+def get_args( argv ):
+	""" Process argv and extract: source, ids """
+	r = { 'source' : None, 'ids' : IDS_FILE }
+	used = [] # list of used entries in argv
+	used.append(0) # item #0 is the script name
+	unamed = [] # unamed parameters
+
+	if '-h' in argv:
+		show_help()
+		sys.exit(0)
+	if '-ids' in argv:
+		idx = argv.index('-ids')
+		r['ids'] = argv[idx+1]
+		used.append( idx )
+		used.append( idx+1 )
+
+	# Locate the unamed parameter
+	for i in range( len(argv) ):
+		if i in used:
+			continue
+		else:
+			unamed.append( argv[i] )
+	# First unamed is the source
+	if len(unamed) > 0:
+		r['source'] = unamed[0]
+
+	# Sanity check
+	if r['source']==None:
+		raise Exception('missing source')
+	return r
+
+def load_ids( filename ):
+	""" list of (name, level, format) indexed by the trace id """
+	ids = []
+	with open( filename ) as f:
+		for line in f:
+			m = re.match( r'\s*TRACE_ID\(\s*(\w+)\s*,\s*(\w+)\s*,\s*"(.*)"\s*\)', line )
+			if m:
+				ids.append( (m.group(1), m.group(2), m.group(3)) )
+	return ids
+
+def format_record( ids, record ):
+	""" record: the 13 bytes following the frame mark """
+	_id, time_us, a, b = struct.unpack( '<BIII', record )
+	if _id >= len(ids):
+		return '[%10.6f] unknown trace id %u (%u, %u)' % (time_us/1E6, _id, a, b)
+	name, level, fmt = ids[_id]
+	args = []
+	for conv, value in zip( re.findall( r'%[udxc]', fmt ), (a, b) ):
+		if conv == '%d':
+			value = struct.unpack( '<i', struct.pack('<I', value) )[0]
+		elif conv == '%c':
+			value = chr( value & 0xFF )
+		args.append( value )
+	try:
+		text = fmt % tuple(args)
+	except TypeError:
+		text = fmt
+	return '[%10.6f] %s %s' % (time_us/1E6, level.replace('TRACE_',''), text)
+
+def decode( stream, ids, out ):
+	""" read the stream byte by byte, write the decoded lines to out """
+	text = b''
+	while True:
+		c = stream.read(1)
+		if len(c)==0:
+			break
+		if c[0] == FRAME_MARK:
+			record = stream.read( RECORD_SIZE )
+			if len(record) < RECORD_SIZE:
+				break
+			if text.strip():
+				out.write( text.decode('ascii', errors='replace').rstrip('\r\n') + '\n' )
+			text = b''
+			out.write( format_record( ids, record ) + '\n' )
+		elif c == b'\n':
+			out.write( text.decode('ascii', errors='replace').rstrip('\r') + '\n' )
+			text = b''
+		else:
+			text += c
+		out.flush()
+
+if __name__ == '__main__':
+	args = get_args( sys.argv )
+	ids = load_ids( args['ids'] )
+	if os.path.isfile( args['source'] ):
+		with open( args['source'], 'rb' ) as f:
+			decode( f, ids, sys.stdout )
+	else:
+		import serial
+		with serial.Serial( args['source'], 115200 ) as ser:
+			decode( ser, ids, sys.stdout )